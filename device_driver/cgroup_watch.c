@@ -0,0 +1,200 @@
+#include "device_file.h"
+#include "event_ring.h"
+#include "cgroup_watch.h"
+#include <linux/version.h>
+#include <linux/kernel.h>     /* printk() */
+#include <linux/errno.h>      /* error codes */
+#include <linux/err.h>        /* IS_ERR(), PTR_ERR() */
+#include <linux/mutex.h>      /* mutex stuff */
+#include <linux/sched.h>      /* struct task_struct */
+#include <linux/cgroup.h>     /* cgroup_get_from_fd(), task_under_cgroup_hierarchy() */
+#include <linux/rcupdate.h>   /* rcu_read_lock() */
+#include <linux/tracepoint.h> /* tracepoint_probe_register() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/signal.h> /* for_each_process(), thread_group_leader() */
+#endif
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0) && defined(CONFIG_CGROUPS)
+typedef struct VPMUCgroupWatch {
+    struct cgroup *cgrp; /* NULL if the session watches no cgroup */
+    void *         base; /* Register window of the session */
+} VPMUCgroupWatch;
+
+static VPMUCgroupWatch    vpmu_watches[VPMU_DEVICE_MAX_SESSIONS] = {};
+static int                vpmu_num_watches                       = 0;
+static struct tracepoint *vpmu_tp_fork                           = NULL;
+static struct tracepoint *vpmu_tp_exit                           = NULL;
+/* Serialize attach/detach, the probes only read vpmu_watches */
+static DEFINE_MUTEX(vpmu_watch_mutex);
+
+/* Write pid to register reg of every session watching a cgroup holding the task */
+static void write_watching_sessions(struct task_struct *task, uintptr_t reg)
+{
+    struct cgroup *cgrp = NULL;
+    int            i    = 0;
+
+    rcu_read_lock();
+    for (i = 0; i < VPMU_DEVICE_MAX_SESSIONS; i++) {
+        cgrp = smp_load_acquire(&vpmu_watches[i].cgrp);
+        if (cgrp == NULL || !task_under_cgroup_hierarchy(task, cgrp)) continue;
+#ifndef DRY_RUN
+        VPMU_IO_WRITE(vpmu_watches[i].base + reg, task->tgid);
+#endif
+    }
+    rcu_read_unlock();
+}
+
+static void probe_cgroup_fork(void *              data,
+                              struct task_struct *parent,
+                              struct task_struct *child)
+{
+    // Threads are counted together with their process
+    if (!thread_group_leader(child)) return;
+    write_watching_sessions(child, VPMU_MMAP_ATTACH_PID);
+}
+
+static void probe_cgroup_exit(void *data, struct task_struct *task)
+{
+    // Detach when the last thread of the process exits
+    if (atomic_read(&task->signal->live) != 0) return;
+    write_watching_sessions(task, VPMU_MMAP_DETACH_PID);
+}
+
+static void unregister_probes(void)
+{
+    if (vpmu_tp_fork) tracepoint_probe_unregister(vpmu_tp_fork, probe_cgroup_fork, NULL);
+    if (vpmu_tp_exit) tracepoint_probe_unregister(vpmu_tp_exit, probe_cgroup_exit, NULL);
+    vpmu_tp_fork = NULL;
+    vpmu_tp_exit = NULL;
+    tracepoint_synchronize_unregister();
+}
+
+static int register_probes(void)
+{
+    int err = 0;
+
+    vpmu_tp_fork = vpmu_find_tracepoint("sched_process_fork");
+    vpmu_tp_exit = vpmu_find_tracepoint("sched_process_exit");
+    if (vpmu_tp_fork == NULL || vpmu_tp_exit == NULL) {
+        vpmu_tp_fork = vpmu_tp_exit = NULL;
+        return -ENOENT;
+    }
+    err = tracepoint_probe_register(vpmu_tp_fork, probe_cgroup_fork, NULL);
+    if (err) {
+        vpmu_tp_fork = vpmu_tp_exit = NULL;
+        return err;
+    }
+    err = tracepoint_probe_register(vpmu_tp_exit, probe_cgroup_exit, NULL);
+    if (err) {
+        vpmu_tp_exit = NULL;
+        unregister_probes();
+    }
+    return err;
+}
+
+/* Write the pid of every process in the cgroup to register reg of base */
+static int write_cgroup_pids(struct cgroup *cgrp, void *base, uintptr_t reg)
+{
+    struct task_struct *p = NULL;
+    int                 n = 0;
+
+    rcu_read_lock();
+    for_each_process(p)
+    {
+        if (!task_under_cgroup_hierarchy(p, cgrp)) continue;
+#ifndef DRY_RUN
+        VPMU_IO_WRITE(base + reg, p->tgid);
+#endif
+        n++;
+    }
+    rcu_read_unlock();
+    return n;
+}
+
+int vpmu_cgroup_attach(int session, void *base, int fd)
+{
+    struct cgroup *cgrp = NULL;
+    int            err  = 0;
+    int            n    = 0;
+
+    if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) return -EINVAL;
+    // Fails with -EBADF if fd is not a directory of cgroup v2
+    cgrp = cgroup_get_from_fd(fd);
+    if (IS_ERR(cgrp)) return PTR_ERR(cgrp);
+
+    mutex_lock(&vpmu_watch_mutex);
+    if (vpmu_watches[session].cgrp) {
+        err = -EBUSY;
+        goto fail;
+    }
+    if (vpmu_num_watches == 0) {
+        err = register_probes();
+        if (err) goto fail;
+    }
+    vpmu_num_watches++;
+    vpmu_watches[session].base = base;
+    // Publish base before the probes can see the cgroup
+    smp_store_release(&vpmu_watches[session].cgrp, cgrp);
+
+    // The probes handle the processes forked from now on, attach the existing ones
+    n = write_cgroup_pids(cgrp, base, VPMU_MMAP_ATTACH_PID);
+    mutex_unlock(&vpmu_watch_mutex);
+    printk(KERN_DEBUG "VPMU: Session %d watches a cgroup of %d processes\n", session, n);
+    return 0;
+
+fail:
+    mutex_unlock(&vpmu_watch_mutex);
+    cgroup_put(cgrp);
+    return err;
+}
+
+int vpmu_cgroup_detach(int session, void *base)
+{
+    struct cgroup *cgrp = NULL;
+
+    if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) return -EINVAL;
+    mutex_lock(&vpmu_watch_mutex);
+    cgrp = vpmu_watches[session].cgrp;
+    if (cgrp == NULL) {
+        mutex_unlock(&vpmu_watch_mutex);
+        return -ENOENT;
+    }
+    WRITE_ONCE(vpmu_watches[session].cgrp, NULL);
+    vpmu_num_watches--;
+    // Wait for the running probes before dropping the cgroup
+    if (vpmu_num_watches == 0)
+        unregister_probes();
+    else
+        tracepoint_synchronize_unregister();
+
+    write_cgroup_pids(cgrp, base, VPMU_MMAP_DETACH_PID);
+    mutex_unlock(&vpmu_watch_mutex);
+    cgroup_put(cgrp);
+    return 0;
+}
+
+void vpmu_cgroup_exit(void)
+{
+    int i = 0;
+
+    for (i = 0; i < VPMU_DEVICE_MAX_SESSIONS; i++) {
+        if (vpmu_watches[i].cgrp) vpmu_cgroup_detach(i, vpmu_watches[i].base);
+    }
+}
+
+#else
+int vpmu_cgroup_attach(int session, void *base, int fd)
+{
+    printk(KERN_WARNING "VPMU: cgroup requires Linux 4.8 or later with CONFIG_CGROUPS\n");
+    return -ENOSYS;
+}
+
+int vpmu_cgroup_detach(int session, void *base)
+{
+    return -ENOENT;
+}
+
+void vpmu_cgroup_exit(void) {}
+#endif
@@ -0,0 +1,12 @@
+#ifndef CGROUP_WATCH_H_
+#define CGROUP_WATCH_H_
+
+/* Attach every process in the cgroup of directory fd to the session of VPMU at base
+ * and keep attaching (detaching) the processes forked (exited) in it afterward.
+ * Only the unified hierarchy (cgroup v2) is supported.
+ */
+int  vpmu_cgroup_attach(int session, void *base, int fd);
+int  vpmu_cgroup_detach(int session, void *base);
+void vpmu_cgroup_exit(void);
+
+#endif // CGROUP_WATCH_H_
@@ -16,8 +16,18 @@
 
 #include <linux/vmalloc.h> /* vm_struct and vmalloc(), vmap() */
 #include <linux/mm.h>      /* vm_area_struct and remap_pfn_range() */
+#include <linux/file.h>    /* fget(), fput() */
+#include <linux/string.h>  /* strndup_user(), memdup_user() */
+#include <linux/interrupt.h> /* request_irq(), free_irq() */
+#include <linux/poll.h>      /* poll_wait() */
+#include <linux/wait.h>      /* wait_event_interruptible() */
+#include <linux/compat.h>    /* compat_ptr() */
 
 #include "../vpmu-device.h" /* VPMU Configurations */
+#include "../vpmu-ioctl.h"  /* ioctl ABI shared with user space */
+#include "event_ring.h"     /* Rings shared with VPMU */
+#include "cgroup_watch.h"   /* vpmu_cgroup_attach() */
+#include "object_ship.h"    /* vpmu_ship_file(), vpmu_ship_user() */
 
 /* In 2.2.3 /usr/include/linux/version.h includes a
  * macro for this, but 2.0.35 doesn't - so I add it
@@ -35,10 +45,18 @@
 
 /* Device handler for all states and data */
 struct vpmu_dev {
-    unsigned char *data;
-    unsigned long  buffer_size;
-    struct mutex   vpmu_mutex;
-    struct cdev    cdev;
+    unsigned char *   data;
+    unsigned long     buffer_size;
+    struct mutex      vpmu_mutex;
+    struct cdev       cdev;
+    unsigned long     phys_base;    /* Physical address of the register window */
+    void *            base;         /* Register window of this device (session) */
+    VPMUEventRing *   trace_ring;   /* Trace records produced by VPMU, mapped by users */
+    struct page *     trace_pages;  /* Pages of trace_ring */
+    VPMUEventRing *   notify_ring;  /* Notifications from VPMU, NULL if disabled */
+    struct page *     notify_pages; /* Pages of notify_ring */
+    struct mutex      notify_mutex; /* Serialize the consumers of notify_ring */
+    wait_queue_head_t notify_wait;  /* Woken up by the interrupt of VPMU */
 };
 
 void *                  vpmu_base    = NULL;
@@ -49,31 +67,51 @@ static int vpmu_major_number = 0;
 static int vpmu_ndevices     = 1;
 
 module_param(vpmu_ndevices, int, S_IRUGO);
-
-void copy_from_vpmu(uintptr_t *buffer, uintptr_t addr_base, size_t count)
+/* Number of pages of the trace ring of each device */
+static int vpmu_trace_ring_pages = 256;
+module_param(vpmu_trace_ring_pages, int, S_IRUGO);
+/* Interrupt line of VPMU for notifications, 0 to disable poll() and notifications */
+static int vpmu_irq = 0;
+module_param(vpmu_irq, int, S_IRUGO);
+
+/* Ask VPMU to fill the staging area with at most count bytes of its stream at offset
+ * pos. It returns the number of bytes available in the staging area, 0 means EOF.
+ */
+static size_t vpmu_xfer_read(struct vpmu_dev *dev, loff_t pos, size_t count)
 {
-    uintptr_t i              = 0;
-    uintptr_t val            = 0;
-    uintptr_t count_in_words = 0;
+    size_t got = 0;
 
-    count_in_words = count / sizeof(uintptr_t); // Bytes to size of pointers
-    // Read the data from VPMU word by word
-    for (i = 0; i < count_in_words; i++) {
-        VPMU_IO_READ(addr_base + i * sizeof(uintptr_t), val);
-        buffer[i] = val;
-    }
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_XFER_OFFSET, pos);
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_XFER_READ, count); // Doorbell
+    VPMU_IO_READ(dev->base + VPMU_MMAP_XFER_RESULT, got);
+    if (got > count) got = count;
+    // The staging area is backed by RAM in VPMU, this is a plain block copy
+    memcpy_fromio(dev->data, dev->base + VPMU_MMAP_STAGING_BASE, got);
+#else
+    // Emulate a stream of zeros with the size of staging area
+    if (pos < VPMU_MMAP_STAGING_SIZE)
+        got = min_t(size_t, count, VPMU_MMAP_STAGING_SIZE - pos);
+    memset(dev->data, 0, got);
+#endif
+    return got;
 }
 
-void copy_to_vpmu(uintptr_t addr_base, uintptr_t *buffer, size_t count)
+/* Hand count bytes in dev->data over to VPMU as its stream at offset pos.
+ * It returns the number of bytes consumed by VPMU.
+ */
+static size_t vpmu_xfer_write(struct vpmu_dev *dev, loff_t pos, size_t count)
 {
-    uintptr_t i              = 0;
-    uintptr_t count_in_words = 0;
+    size_t done = count;
 
-    count_in_words = count / sizeof(uintptr_t); // Bytes to size of pointers
-    // Read the data from VPMU word by word
-    for (i = 0; i < count_in_words; i++) {
-        VPMU_IO_WRITE(addr_base + i * sizeof(uintptr_t), buffer[i]);
-    }
+#ifndef DRY_RUN
+    memcpy_toio(dev->base + VPMU_MMAP_STAGING_BASE, dev->data, count);
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_XFER_OFFSET, pos);
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_XFER_WRITE, count); // Doorbell
+    VPMU_IO_READ(dev->base + VPMU_MMAP_XFER_RESULT, done);
+    if (done > count) done = count;
+#endif
+    return done;
 }
 
 /*=====================================================================================*/
@@ -83,31 +121,26 @@ static ssize_t device_file_read(struct file *file_ptr,
                                 loff_t *     possition)
 {
     struct vpmu_dev *dev    = (struct vpmu_dev *)file_ptr->private_data;
-    int              retval = 0;
+    ssize_t          retval = 0;
+    size_t           done   = 0;
 
     if (mutex_lock_killable(&dev->vpmu_mutex)) return -EINTR;
 
-    printk(KERN_DEBUG "VPMU: Device file %s is read at "
-                      "offset = %i, read bytes count = %u\n",
-           file_ptr->f_path.dentry->d_iname,
-           (int)*possition,
-           (unsigned int)count);
-
-    if (*possition >= dev->buffer_size) goto out; /* EOF */
-
-    if (*possition + count > dev->buffer_size) count = dev->buffer_size - *possition;
+    // Transfer the data block by block through the staging area
+    while (done < count) {
+        size_t chunk = min_t(size_t, count - done, dev->buffer_size);
+        size_t got   = vpmu_xfer_read(dev, *possition, chunk);
 
-#ifndef DRY_RUN
-    copy_from_vpmu((uintptr_t *)(dev->data + *possition), (uintptr_t)vpmu_base, count);
-#endif
-
-    if (copy_to_user(user_buffer, dev->data + *possition, count) != 0) {
-        retval = -EFAULT;
-        goto out;
+        if (got == 0) break; /* EOF */
+        if (copy_to_user(user_buffer + done, dev->data, got) != 0) {
+            retval = -EFAULT;
+            goto out;
+        }
+        done += got;
+        *possition += got;
+        if (got < chunk) break; /* Short read, no more data for now */
     }
-
-    *possition += count;
-    retval = count;
+    retval = done;
 
 out:
     mutex_unlock(&dev->vpmu_mutex);
@@ -120,35 +153,27 @@ static ssize_t device_file_write(struct file *file_ptr,
                                  loff_t *           possition)
 {
     struct vpmu_dev *dev    = (struct vpmu_dev *)file_ptr->private_data;
-    int              retval = 0;
+    ssize_t          retval = 0;
+    size_t           done   = 0;
 
     if (mutex_lock_killable(&dev->vpmu_mutex)) return -EINTR;
 
-    printk(KERN_DEBUG "VPMU: Device file %s is write at "
-                      "offset = %i, write bytes count = %u\n",
-           file_ptr->f_path.dentry->d_iname,
-           (int)*possition,
-           (unsigned int)count);
-
-    if (*possition >= dev->buffer_size) {
-        /* Writing beyond the end of the buffer is not allowed. */
-        retval = -EINVAL;
-        goto out;
-    }
-
-    if (*possition + count > dev->buffer_size) count = dev->buffer_size - *possition;
+    // Transfer the data block by block through the staging area
+    while (done < count) {
+        size_t chunk = min_t(size_t, count - done, dev->buffer_size);
+        size_t sent  = 0;
 
-    if (copy_from_user(dev->data + *possition, user_buffer, count) != 0) {
-        retval = -EFAULT;
-        goto out;
+        if (copy_from_user(dev->data, user_buffer + done, chunk) != 0) {
+            retval = -EFAULT;
+            goto out;
+        }
+        sent = vpmu_xfer_write(dev, *possition, chunk);
+        done += sent;
+        *possition += sent;
+        if (sent < chunk) break; /* VPMU does not take more data */
     }
-
-    *possition += count;
-    retval = count;
-
-#ifndef DRY_RUN
-    copy_to_vpmu((uintptr_t)vpmu_base, (uintptr_t *)(dev->data + *possition), count);
-#endif
+    // Writing nothing at all is not allowed
+    retval = (done == 0 && count > 0) ? -ENOSPC : done;
 
 out:
     mutex_unlock(&dev->vpmu_mutex);
@@ -225,19 +250,367 @@ static int device_file_release(struct inode *inode, struct file *file_ptr)
     return 0;
 }
 
+/* A user pointer in a uint64_t field of the ioctl structures */
+static void __user *vpmu_user_ptr(uint64_t addr)
+{
+#if defined(CONFIG_COMPAT) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+    // 32-bit processes pass it zero-extended, compat_ptr() knows the rest (e.g. s390)
+    if (in_compat_syscall()) return compat_ptr((compat_uptr_t)addr);
+#endif
+    return (void __user *)(uintptr_t)addr;
+}
+
+/* Ship the whole file of a user fd to VPMU without reading it in user space.
+ * VPMU copies the pages of page cache by their physical addresses.
+ */
+static long vpmu_cmd_send_fd(struct vpmu_dev *dev, VPMUCommand *cmd)
+{
+    struct file *file   = NULL;
+    char *       name   = NULL;
+    loff_t       size   = 0;
+    long         retval = 0;
+
+    file = fget((unsigned int)cmd->arg[0]);
+    if (file == NULL) return -EBADF;
+    // Only a regular file the caller can read, not a device, pipe or socket
+    if (!(file->f_mode & FMODE_READ)) {
+        retval = -EBADF;
+        goto out;
+    }
+    if (!S_ISREG(file_inode(file)->i_mode)) {
+        retval = -EINVAL;
+        goto out;
+    }
+
+    name = strndup_user(vpmu_user_ptr(cmd->arg[1]), PATH_MAX);
+    if (IS_ERR(name)) {
+        retval = PTR_ERR(name);
+        name   = NULL;
+        goto out;
+    }
+
+    size = i_size_read(file_inode(file));
+    if (size <= 0 || size > VPMU_IOCTL_MAX_FILE_SIZE) {
+        retval = -EINVAL;
+        goto out;
+    }
+
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_ADD_PROC_NAME, name);
+#endif
+    retval = vpmu_ship_file(dev->base, VPMU_OBJ_PROC_BINARY, file, name);
+
+out:
+    kfree(name);
+    fput(file);
+    return retval;
+}
+
+/* Ship a user buffer to VPMU, its pages are pinned and passed by physical address */
+static long vpmu_cmd_send_buffer(struct vpmu_dev *dev, VPMUCommand *cmd)
+{
+    const void __user *buf    = vpmu_user_ptr(cmd->arg[0]);
+    char *             name   = NULL;
+    long               retval = 0;
+
+    if (cmd->arg[1] == 0 || cmd->arg[1] > VPMU_IOCTL_MAX_FILE_SIZE) return -EINVAL;
+    name = strndup_user(vpmu_user_ptr(cmd->arg[2]), PATH_MAX);
+    if (IS_ERR(name)) return PTR_ERR(name);
+
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_ADD_PROC_NAME, name);
+#endif
+    retval = vpmu_ship_user(dev->base, VPMU_OBJ_PROC_BINARY, name, buf, cmd->arg[1]);
+    kfree(name);
+    return retval;
+}
+
+/* Pass a copy of the name of processes, VPMU reads it on the write of the register */
+static long vpmu_cmd_write_name(struct vpmu_dev *dev, VPMUCommand *cmd)
+{
+    char *name = strndup_user(vpmu_user_ptr(cmd->arg[1]), PATH_MAX);
+
+    if (IS_ERR(name)) return PTR_ERR(name);
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(dev->base + cmd->arg[0], name);
+#endif
+    kfree(name);
+    return 0;
+}
+
+/* Registers taking addresses that VPMU dereferences, or programmed by the driver only */
+static bool vpmu_reg_is_protected(uint64_t offset)
+{
+    switch (offset) {
+    case VPMU_MMAP_ADD_PROC_NAME:
+    case VPMU_MMAP_REMOVE_PROC_NAME:
+    case VPMU_MMAP_SET_PROC_SIZE:
+    case VPMU_MMAP_SET_PROC_BIN:
+    case VPMU_MMAP_OBJ_BEGIN:
+    case VPMU_MMAP_OBJ_SIZE:
+    case VPMU_MMAP_OBJ_NAME:
+    case VPMU_MMAP_OBJ_PADDR:
+    case VPMU_MMAP_OBJ_PLEN:
+    case VPMU_MMAP_OBJ_COMMIT:
+    case VPMU_MMAP_EVENT_RING_ADDR:
+    case VPMU_MMAP_EVENT_RING_SIZE:
+    case VPMU_MMAP_EVENT_RING_KICK:
+    case VPMU_MMAP_TRACE_RING_ADDR:
+    case VPMU_MMAP_TRACE_RING_SIZE:
+    case VPMU_MMAP_NOTIFY_RING_ADDR:
+    case VPMU_MMAP_NOTIFY_RING_SIZE:
+        return true;
+    }
+    // Offsets of kernel structures and symbols, set at module load
+    if (offset >= VPMU_MMAP_OFFSET_FILE_f_path_dentry
+        && offset <= VPMU_MMAP_OFFSET_TASK_STRUCT_pid)
+        return true;
+    if (offset >= VPMU_MMAP_OFFSET_LINUX_VERSION && offset <= VPMU_MMAP_THREAD_SIZE)
+        return true;
+    return false;
+}
+
+static long vpmu_cmd_validate(VPMUCommand *cmd)
+{
+    switch (cmd->op) {
+    case VPMU_CMD_WRITE:
+    case VPMU_CMD_READ:
+        // Only aligned registers inside the window of VPMU
+        if (cmd->arg[0] >= VPMU_DEVICE_IOMEM_SIZE) return -EINVAL;
+        if (cmd->arg[0] % TARGET_WORD_SIZE != 0) return -EINVAL;
+        // Names and binaries go by VPMU_CMD_SEND_FD/SEND_BUFFER, whose pointers are
+        // checked by the driver, never as raw addresses
+        if (cmd->op == VPMU_CMD_WRITE && vpmu_reg_is_protected(cmd->arg[0]))
+            return -EPERM;
+        return 0;
+    case VPMU_CMD_SEND_FD:
+        if (cmd->arg[1] == 0) return -EFAULT;
+        // Fall through
+    case VPMU_CMD_ATTACH_CGROUP:
+        // A descriptor is an int, fget() would take the truncated value otherwise
+        if (cmd->arg[0] > INT_MAX) return -EBADF;
+        return 0;
+    case VPMU_CMD_DETACH_CGROUP:
+    case VPMU_CMD_SEND_BUFFER:
+        return 0;
+    case VPMU_CMD_WRITE_NAME:
+        if (cmd->arg[0] != VPMU_MMAP_ADD_PROC_NAME
+            && cmd->arg[0] != VPMU_MMAP_REMOVE_PROC_NAME)
+            return -EINVAL;
+        if (cmd->arg[1] == 0) return -EFAULT;
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+static long vpmu_cmd_execute(struct vpmu_dev *dev, VPMUCommand *cmd)
+{
+    uintptr_t val = 0;
+
+    switch (cmd->op) {
+    case VPMU_CMD_WRITE:
+#ifndef DRY_RUN
+        VPMU_IO_WRITE(dev->base + cmd->arg[0], (uintptr_t)cmd->arg[1]);
+#endif
+        return 0;
+    case VPMU_CMD_READ:
+#ifndef DRY_RUN
+        VPMU_IO_READ(dev->base + cmd->arg[0], val);
+#endif
+        cmd->arg[1] = val;
+        return 0;
+    case VPMU_CMD_SEND_FD:
+        return vpmu_cmd_send_fd(dev, cmd);
+    case VPMU_CMD_ATTACH_CGROUP:
+        return vpmu_cgroup_attach(dev - vpmu_devices, dev->base, (int)cmd->arg[0]);
+    case VPMU_CMD_DETACH_CGROUP:
+        return vpmu_cgroup_detach(dev - vpmu_devices, dev->base);
+    case VPMU_CMD_SEND_BUFFER:
+        return vpmu_cmd_send_buffer(dev, cmd);
+    case VPMU_CMD_WRITE_NAME:
+        return vpmu_cmd_write_name(dev, cmd);
+    default:
+        return -EINVAL;
+    }
+}
+
+static bool vpmu_notify_pending(struct vpmu_dev *dev)
+{
+    VPMUEventRing *ring = dev->notify_ring;
+
+    return smp_load_acquire(&ring->head) != READ_ONCE(ring->tail);
+}
+
+/* Copy the notifications out of the ring, wait for them if there is none */
+static long
+vpmu_read_notify(struct vpmu_dev *dev, struct file *file_ptr, unsigned long arg)
+{
+    VPMUEventRing *         ring    = dev->notify_ring;
+    VPMUEventRecord __user *records = NULL;
+    VPMUNotifyRead          req     = {};
+    uint32_t                head    = 0;
+    uint32_t                tail    = 0;
+    long                    retval  = 0;
+
+    if (ring == NULL) return -ENODEV;
+    if (copy_from_user(&req, (void __user *)arg, sizeof(req)) != 0) return -EFAULT;
+    if (req.max_records == 0) return -EINVAL;
+    records = vpmu_user_ptr(req.records);
+
+    if (mutex_lock_killable(&dev->notify_mutex)) return -EINTR;
+    while (!vpmu_notify_pending(dev)) {
+        mutex_unlock(&dev->notify_mutex);
+        if (file_ptr->f_flags & O_NONBLOCK) return -EAGAIN;
+        if (wait_event_interruptible(dev->notify_wait, vpmu_notify_pending(dev)))
+            return -ERESTARTSYS;
+        if (mutex_lock_killable(&dev->notify_mutex)) return -EINTR;
+    }
+
+    head = smp_load_acquire(&ring->head);
+    tail = ring->tail;
+    // num_records is an output, whatever the caller passed in
+    req.num_records = 0;
+    for (; tail != head && req.num_records < req.max_records; tail++) {
+        if (copy_to_user(&records[req.num_records],
+                         &ring->records[tail & (ring->num_records - 1)],
+                         sizeof(VPMUEventRecord))
+            != 0) {
+            retval = -EFAULT;
+            break;
+        }
+        req.num_records++;
+    }
+    // Release the slots to VPMU after the records are copied
+    smp_store_release(&ring->tail, tail);
+    req.dropped = READ_ONCE(ring->dropped);
+    mutex_unlock(&dev->notify_mutex);
+
+    if (copy_to_user((void __user *)arg, &req, sizeof(req)) != 0) retval = -EFAULT;
+    return retval;
+}
+
+static long device_file_ioctl(struct file * file_ptr,
+                              unsigned int  ioctl_num,
+                              unsigned long arg)
+{
+    struct vpmu_dev * dev     = (struct vpmu_dev *)file_ptr->private_data;
+    VPMUCommandBatch  batch   = {};
+    VPMUCommand *     cmds    = NULL;
+    uint32_t          version = VPMU_IOCTL_VERSION;
+    uint32_t          i       = 0;
+    long              retval  = 0;
+
+    switch (ioctl_num) {
+    case VPMU_IOCTL_GET_VERSION:
+        if (copy_to_user((void __user *)arg, &version, sizeof(version)) != 0)
+            return -EFAULT;
+        return 0;
+    case VPMU_IOCTL_SUBMIT:
+        break;
+    case VPMU_IOCTL_READ_NOTIFY:
+        return vpmu_read_notify(dev, file_ptr, arg);
+    default:
+        return -ENOTTY;
+    }
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)) != 0) return -EFAULT;
+    if (batch.version != VPMU_IOCTL_VERSION) return -EINVAL;
+    if (batch.num_cmds == 0 || batch.num_cmds > VPMU_IOCTL_MAX_CMDS) return -EINVAL;
+
+    cmds = memdup_user(vpmu_user_ptr(batch.cmds),
+                       batch.num_cmds * sizeof(VPMUCommand));
+    if (IS_ERR(cmds)) return PTR_ERR(cmds);
+
+    // Validate the whole batch before replaying any of the commands
+    for (i = 0; i < batch.num_cmds; i++) {
+        retval = vpmu_cmd_validate(&cmds[i]);
+        if (retval) goto out;
+    }
+
+    if (mutex_lock_killable(&dev->vpmu_mutex)) {
+        retval = -EINTR;
+        goto out;
+    }
+    // Replay the commands back-to-back to VPMU
+    for (i = 0; i < batch.num_cmds; i++) {
+        retval = vpmu_cmd_execute(dev, &cmds[i]);
+        if (retval) break;
+    }
+    mutex_unlock(&dev->vpmu_mutex);
+
+    batch.num_done = i;
+    batch.error    = retval;
+    // Return the results of VPMU_CMD_READ and the status of batch
+    if (copy_to_user(vpmu_user_ptr(batch.cmds),
+                     cmds,
+                     batch.num_cmds * sizeof(VPMUCommand))
+          != 0
+        || copy_to_user((void __user *)arg, &batch, sizeof(batch)) != 0) {
+        retval = -EFAULT;
+    }
+
+out:
+    kfree(cmds);
+    return retval;
+}
+
+/* The trace ring is allocated on the first mapping and lives until the module exits */
+static int vpmu_trace_ring_mmap(struct vpmu_dev *dev, struct vm_area_struct *vma)
+{
+    unsigned long size   = vma->vm_end - vma->vm_start;
+    int           retval = 0;
+
+    if (vpmu_trace_ring_pages <= 0) return -ENODEV;
+    mutex_lock(&dev->vpmu_mutex);
+    if (dev->trace_ring == NULL) {
+        dev->trace_ring = vpmu_ring_alloc(vpmu_trace_ring_pages, &dev->trace_pages);
+        if (dev->trace_ring == NULL) {
+            retval = -ENOMEM;
+            goto out;
+        }
+#ifndef DRY_RUN
+        // VPMU writes the records by physical address
+        VPMU_IO_WRITE(dev->base + VPMU_MMAP_TRACE_RING_ADDR,
+                      virt_to_phys(dev->trace_ring));
+        VPMU_IO_WRITE(dev->base + VPMU_MMAP_TRACE_RING_SIZE,
+                      vpmu_ring_size(dev->trace_ring));
+#endif
+    }
+    if (size > vpmu_ring_size(dev->trace_ring)) {
+        retval = -EINVAL;
+        goto out;
+    }
+    retval = remap_pfn_range(
+      vma, vma->vm_start, page_to_pfn(dev->trace_pages), size, vma->vm_page_prot);
+out:
+    mutex_unlock(&dev->vpmu_mutex);
+    return retval;
+}
+
 static int device_file_mmap(struct file *file_ptr, struct vm_area_struct *vma)
 {
     int retval = 0;
 
-    // Requesting more than what VPMU has, deny it
-    if (vma->vm_end - vma->vm_start > VPMU_DEVICE_IOMEM_SIZE) {
-        return -EIO;
-    }
     // at offset 0 we map the VPMU_DEVICE_BASE_ADDR to user address
     if (vma->vm_pgoff == 0) {
         // If the address is virtual, use:
         // virt_to_physical(buffer_pointer) >> PAGE_SHIFT
-        vma->vm_pgoff = (VPMU_DEVICE_BASE_ADDR) >> PAGE_SHIFT;
+        struct vpmu_dev *dev = (struct vpmu_dev *)file_ptr->private_data;
+
+        // Requesting more than what VPMU has, deny it
+        if (vma->vm_end - vma->vm_start > VPMU_DEVICE_IOMEM_SIZE) {
+            return -EIO;
+        }
+        // The registers are read-only to user space, writes go through ioctl where the
+        // driver keeps the registers of addresses (vpmu_reg_is_protected()) to itself
+        if (vma->vm_flags & VM_WRITE) return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        vm_flags_clear(vma, VM_MAYWRITE);
+#else
+        vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+        vma->vm_pgoff = (dev->phys_base) >> PAGE_SHIFT;
         retval        = remap_pfn_range(vma,
                                  vma->vm_start,
                                  vma->vm_pgoff,
@@ -249,16 +622,112 @@ static int device_file_mmap(struct file *file_ptr, struct vm_area_struct *vma)
         vma->vm_private_data = file_ptr->private_data;
         return 0;
     }
+    // at the offset of trace ring we map the ring of this device
+    if (vma->vm_pgoff == (VPMU_DEVICE_TRACE_RING_OFFSET >> PAGE_SHIFT)) {
+        return vpmu_trace_ring_mmap((struct vpmu_dev *)file_ptr->private_data, vma);
+    }
     // at any other offset we return an error
     return -EIO;
 }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+static __poll_t device_file_poll(struct file *file_ptr, poll_table *wait)
+#else
+static unsigned int device_file_poll(struct file *file_ptr, poll_table *wait)
+#endif
+{
+    struct vpmu_dev *dev = (struct vpmu_dev *)file_ptr->private_data;
+
+    // Without the interrupt nobody wakes up the waiters
+    if (dev->notify_ring == NULL) return POLLERR;
+    poll_wait(file_ptr, &dev->notify_wait, wait);
+    return vpmu_notify_pending(dev) ? (POLLIN | POLLRDNORM) : 0;
+}
+
+static irqreturn_t vpmu_notify_irq(int irq, void *dev_id)
+{
+    struct vpmu_dev *dev    = (struct vpmu_dev *)dev_id;
+    uintptr_t        status = 1;
+
+#ifndef DRY_RUN
+    // The line is shared by all the sessions, check whether it's raised by this one
+    VPMU_IO_READ(dev->base + VPMU_MMAP_NOTIFY_STATUS, status);
+    if (status == 0) return IRQ_NONE;
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_NOTIFY_STATUS, status);
+#endif
+    wake_up_interruptible(&dev->notify_wait);
+    return IRQ_HANDLED;
+}
+
+/* Notifications are optional, the device works without them */
+static void vpmu_notify_setup(struct vpmu_dev *dev, int minor)
+{
+    int err = 0;
+
+    mutex_init(&dev->notify_mutex);
+    init_waitqueue_head(&dev->notify_wait);
+    if (vpmu_irq <= 0) return;
+
+    dev->notify_ring = vpmu_ring_alloc(1, &dev->notify_pages);
+    if (dev->notify_ring == NULL) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    err = request_irq(vpmu_irq, vpmu_notify_irq, IRQF_SHARED, VPMU_CDEVICE_NAME, dev);
+    if (err) goto fail;
+#ifndef DRY_RUN
+    // VPMU writes the records by physical address
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_NOTIFY_RING_ADDR,
+                  virt_to_phys(dev->notify_ring));
+    VPMU_IO_WRITE(dev->base + VPMU_MMAP_NOTIFY_RING_SIZE,
+                  vpmu_ring_size(dev->notify_ring));
+#endif
+    return;
+
+fail:
+    printk(KERN_WARNING "VPMU: Notifications of %s-%d are OFF (%d)\n",
+           VPMU_CDEVICE_NAME,
+           minor,
+           err);
+    vpmu_ring_free(dev->notify_ring, dev->notify_pages);
+    dev->notify_ring = NULL;
+}
+
+static void vpmu_notify_teardown(struct vpmu_dev *dev)
+{
+    if (dev->notify_ring) {
+#ifndef DRY_RUN
+        // Stop VPMU from writing to the ring before releasing the memory
+        VPMU_IO_WRITE(dev->base + VPMU_MMAP_NOTIFY_RING_SIZE, 0);
+#endif
+        free_irq(vpmu_irq, dev);
+        vpmu_ring_free(dev->notify_ring, dev->notify_pages);
+        dev->notify_ring = NULL;
+    }
+    mutex_destroy(&dev->notify_mutex);
+}
+
+#ifdef CONFIG_COMPAT
+/* The ioctl structures have the same layout in 32-bit processes, their pointers are
+ * all uint64_t, so only arg itself needs the conversion */
+static long
+vpmu_compat_ioctl(struct file *file_ptr, unsigned int ioctl_num, unsigned long arg)
+{
+    return device_file_ioctl(file_ptr, ioctl_num, (unsigned long)compat_ptr(arg));
+}
+#endif
+
 /*=====================================================================================*/
-static struct file_operations simple_driver_fops = {.owner   = THIS_MODULE,
-                                                    .read    = device_file_read,
-                                                    .write   = device_file_write,
-                                                    .open    = device_file_open,
-                                                    .release = device_file_release,
-                                                    .mmap    = device_file_mmap};
+static struct file_operations simple_driver_fops = {.owner          = THIS_MODULE,
+                                                    .read           = device_file_read,
+                                                    .write          = device_file_write,
+                                                    .open           = device_file_open,
+                                                    .release        = device_file_release,
+                                                    .unlocked_ioctl = device_file_ioctl,
+#ifdef CONFIG_COMPAT
+                                                    .compat_ioctl   = vpmu_compat_ioctl,
+#endif
+                                                    .poll           = device_file_poll,
+                                                    .mmap           = device_file_mmap};
 
 /* ================================================================ */
 /* Setup and register the device with specific index (the index is also
@@ -275,9 +744,22 @@ static int vpmu_construct_device(struct vpmu_dev *dev, int minor, struct class *
 
     /* Memory is to be allocated when the device is opened the first time */
     dev->data        = NULL;
-    dev->buffer_size = VPMU_DEVICE_IOMEM_SIZE;
+    dev->buffer_size = VPMU_MMAP_STAGING_SIZE;
     mutex_init(&dev->vpmu_mutex);
 
+    /* Each minor has its own register window, i.e. an independent VPMU session */
+    dev->phys_base = VPMU_DEVICE_WINDOW_ADDR(minor);
+#ifndef DRY_RUN
+    dev->base = ioremap(dev->phys_base, VPMU_DEVICE_IOMEM_SIZE);
+    if (dev->base == NULL) {
+        printk(KERN_WARNING "VPMU: Error while trying to map the window of %s%d\n",
+               VPMU_CDEVICE_NAME,
+               minor);
+        return -ENOMEM;
+    }
+#endif
+    vpmu_notify_setup(dev, minor);
+
     cdev_init(&dev->cdev, &simple_driver_fops);
     dev->cdev.owner = THIS_MODULE;
 
@@ -287,6 +769,8 @@ static int vpmu_construct_device(struct vpmu_dev *dev, int minor, struct class *
                err,
                VPMU_CDEVICE_NAME,
                minor);
+        vpmu_notify_teardown(dev);
+        if (dev->base) iounmap(dev->base);
         return err;
     }
 
@@ -304,6 +788,8 @@ static int vpmu_construct_device(struct vpmu_dev *dev, int minor, struct class *
                VPMU_CDEVICE_NAME,
                minor);
         cdev_del(&dev->cdev);
+        vpmu_notify_teardown(dev);
+        if (dev->base) iounmap(dev->base);
         return err;
     }
     return 0;
@@ -317,9 +803,8 @@ static char *vpmu_devnode(struct device *dev, mode_t *mode)
 #endif
 {
     if (!mode) return NULL;
-    if (dev->devt == MKDEV(vpmu_major_number, 0)
-        || dev->devt == MKDEV(vpmu_major_number, 2))
-        *mode = 0666;
+    // Every session is accessible to users
+    if (MAJOR(dev->devt) == vpmu_major_number) *mode = 0666;
     return NULL;
 }
 
@@ -332,7 +817,7 @@ int register_device(void)
 
     printk(KERN_DEBUG "VPMU: register_device() is called.\n");
 
-    if (vpmu_ndevices <= 0) {
+    if (vpmu_ndevices <= 0 || vpmu_ndevices > VPMU_DEVICE_MAX_SESSIONS) {
         printk(KERN_WARNING "VPMU: Invalid value of vpmu_ndevices: %d\n", vpmu_ndevices);
         err = -EINVAL;
         return err;
@@ -395,6 +880,15 @@ static void vpmu_destroy_device(struct vpmu_dev *dev, int minor, struct class *c
     device_destroy(class, MKDEV(vpmu_major_number, minor));
     cdev_del(&dev->cdev);
     kfree(dev->data);
+    if (dev->trace_ring) {
+#ifndef DRY_RUN
+        // Stop VPMU from writing to the ring before releasing the memory
+        VPMU_IO_WRITE(dev->base + VPMU_MMAP_TRACE_RING_SIZE, 0);
+#endif
+        vpmu_ring_free(dev->trace_ring, dev->trace_pages);
+    }
+    vpmu_notify_teardown(dev);
+    if (dev->base) iounmap(dev->base);
     mutex_destroy(&dev->vpmu_mutex);
     return;
 }
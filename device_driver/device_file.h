@@ -43,5 +43,30 @@ void vpmu_cleanup_module(int devices_to_destroy);
                "  You may define it in this header if you need to.")
 #endif
 
+/*
+ * Arguments of the probed function in the pre-handler of kprobe.
+ * Only the first five arguments are supported.
+ */
+#if defined(__arm__)
+// AAPCS passes four arguments in r0-r3, the fifth one is on the stack
+#define VPMU_KPROBE_ARG(_regs, _n)                                                       \
+    ((_n) < 4 ? (_regs)->uregs[_n] : regs_get_kernel_stack_nth(_regs, 0))
+#elif defined(__x86_64__)
+#define VPMU_KPROBE_ARG(_regs, _n)                                                       \
+    ((_n) == 0 ? (_regs)->di                                                             \
+               : (_n) == 1 ? (_regs)->si                                                 \
+                           : (_n) == 2 ? (_regs)->dx                                     \
+                                       : (_n) == 3 ? (_regs)->cx : (_regs)->r8)
+#elif defined(__i386__)
+// Kernel is compiled with -mregparm=3, the fourth and fifth ones are on the stack
+#define VPMU_KPROBE_ARG(_regs, _n)                                                       \
+    ((_n) == 0 ? (_regs)->ax                                                             \
+               : (_n) == 1 ? (_regs)->dx                                                 \
+                           : (_n) == 2 ? (_regs)->cx                                     \
+                                       : regs_get_kernel_stack_nth(_regs, (_n) - 2))
+#else
+#error message("VPMU_KPROBE_ARG is not defined for this architecture")
+#endif
+
 extern void *vpmu_base;
 #endif // DEVICE_FILE_H_
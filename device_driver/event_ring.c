@@ -0,0 +1,325 @@
+#include "device_file.h"
+#include "event_ring.h"
+#include <linux/version.h>
+#include <linux/kernel.h>     /* printk() */
+#include <linux/module.h>     /* module_param() */
+#include <linux/errno.h>      /* error codes */
+#include <linux/gfp.h>        /* alloc_pages() */
+#include <linux/mm.h>         /* page_address(), VM_EXEC */
+#include <linux/fs.h>         /* struct file */
+#include <linux/dcache.h>     /* d_path() */
+#include <linux/err.h>        /* IS_ERR() */
+#include <linux/string.h>     /* strnlen(), memcpy() */
+#include <linux/sched.h>      /* struct task_struct, local_clock() */
+#include <linux/binfmts.h>    /* struct linux_binprm */
+#include <linux/kprobes.h>    /* register_kprobe() */
+#include <linux/tracepoint.h> /* tracepoint_probe_register() */
+#include <linux/spinlock.h>   /* raw spinlock stuff */
+#include <linux/log2.h>       /* roundup_pow_of_two() */
+#include <asm/io.h>           /* virt_to_phys() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h> /* local_clock() */
+#endif
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+
+/* Number of pages of the event ring, 0 to disable it and use breakpoints of VPMU */
+static int vpmu_event_ring_pages = 0;
+module_param(vpmu_event_ring_pages, int, S_IRUGO);
+
+VPMUEventRing *vpmu_ring_alloc(unsigned int nr_pages, struct page **out_pages)
+{
+    VPMUEventRing *ring  = NULL;
+    struct page *  pages = NULL;
+    unsigned int   order = 0;
+
+    nr_pages = roundup_pow_of_two(nr_pages);
+    order    = ilog2(nr_pages);
+    pages    = alloc_pages(GFP_KERNEL | __GFP_ZERO, order);
+    if (pages == NULL) return NULL;
+
+    ring              = (VPMUEventRing *)page_address(pages);
+    ring->magic       = VPMU_EVENT_RING_MAGIC;
+    ring->version     = VPMU_EVENT_RING_VERSION;
+    ring->record_size = sizeof(VPMUEventRecord);
+    ring->num_records = rounddown_pow_of_two(
+      (nr_pages * PAGE_SIZE - sizeof(VPMUEventRing)) / sizeof(VPMUEventRecord));
+
+    *out_pages = pages;
+    return ring;
+}
+
+/* The size in bytes of the pages holding the ring */
+size_t vpmu_ring_size(VPMUEventRing *ring)
+{
+    return PAGE_SIZE << get_order(sizeof(VPMUEventRing)
+                                  + ring->num_records * sizeof(VPMUEventRecord));
+}
+
+void vpmu_ring_free(VPMUEventRing *ring, struct page *pages)
+{
+    if (ring == NULL) return;
+    __free_pages(pages, get_order(vpmu_ring_size(ring)));
+}
+
+bool vpmu_ring_push(VPMUEventRing *ring, const VPMUEventRecord *record)
+{
+    uint32_t head = ring->head;
+
+    if (head - smp_load_acquire(&ring->tail) >= ring->num_records) {
+        ring->dropped++;
+        return false;
+    }
+    ring->records[head & (ring->num_records - 1)] = *record;
+    // Publish the record after it's written
+    smp_store_release(&ring->head, head + 1);
+    return true;
+}
+
+/*=====================================================================================*/
+static VPMUEventRing *vpmu_event_ring      = NULL;
+static struct page *  vpmu_event_ring_page = NULL;
+static DEFINE_RAW_SPINLOCK(vpmu_event_ring_lock);
+
+/* Push a record followed by the VPMU_EVENT_NAME records of name if it is not NULL */
+static void record_event_name(struct task_struct *task,
+                              uint32_t            event,
+                              uint32_t            flags,
+                              uint64_t            addr,
+                              uint64_t            len,
+                              const char *        name,
+                              uint64_t            pgoff)
+{
+    VPMUEventRecord record    = {};
+    VPMUEventRecord chunk     = {};
+    char            bytes[16] = {};
+    size_t          name_len  = 0;
+    size_t          i         = 0;
+    unsigned long   irq       = 0;
+    uint32_t        used      = 0;
+    uint32_t        pushed    = 1;
+
+    record.timestamp = local_clock();
+    record.pid       = task->tgid;
+    record.tid       = task->pid;
+    record.event     = event;
+    record.flags     = flags;
+    record.addr      = addr;
+    record.len       = len;
+    if (name) name_len = strnlen(name, VPMU_EVENT_NAME_MAX);
+    chunk       = record;
+    chunk.event = VPMU_EVENT_NAME;
+
+    // Events come from all the cores, serialize the producers
+    raw_spin_lock_irqsave(&vpmu_event_ring_lock, irq);
+    vpmu_ring_push(vpmu_event_ring, &record);
+    if (name) {
+        // The names go right after the record, a consumer never sees them split
+        chunk.flags = 0;
+        chunk.addr  = pgoff;
+        chunk.len   = name_len;
+        vpmu_ring_push(vpmu_event_ring, &chunk);
+        pushed++;
+        for (i = 0; i < name_len; i += sizeof(bytes)) {
+            memset(bytes, 0, sizeof(bytes));
+            memcpy(bytes, name + i, min(name_len - i, sizeof(bytes)));
+            memcpy(&chunk.addr, bytes, 8);
+            memcpy(&chunk.len, bytes + 8, 8);
+            chunk.flags = i / sizeof(bytes) + 1;
+            vpmu_ring_push(vpmu_event_ring, &chunk);
+            pushed++;
+        }
+    }
+    used = vpmu_event_ring->head - READ_ONCE(vpmu_event_ring->tail);
+    raw_spin_unlock_irqrestore(&vpmu_event_ring_lock, irq);
+
+    // Kick VPMU to drain the ring when it becomes half full
+#ifndef DRY_RUN
+    if (used >= vpmu_event_ring->num_records / 2
+        && used - pushed < vpmu_event_ring->num_records / 2)
+        VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_EVENT_RING_KICK, used);
+#endif
+}
+
+static void record_event(struct task_struct *task,
+                         uint32_t            event,
+                         uint32_t            flags,
+                         uint64_t            addr,
+                         uint64_t            len)
+{
+    record_event_name(task, event, flags, addr, len, NULL, 0);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+static void probe_sched_switch(void *              data,
+                               bool                preempt,
+                               struct task_struct *prev,
+                               struct task_struct *next,
+                               unsigned int        prev_state)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
+static void probe_sched_switch(void *              data,
+                               bool                preempt,
+                               struct task_struct *prev,
+                               struct task_struct *next)
+#else
+static void
+probe_sched_switch(void *data, struct task_struct *prev, struct task_struct *next)
+#endif
+{
+    record_event(next, VPMU_EVENT_SWITCH, 0, prev->pid, 0);
+}
+
+static void probe_sched_process_fork(void *              data,
+                                     struct task_struct *parent,
+                                     struct task_struct *child)
+{
+    uint32_t flags = (child->tgid == parent->tgid) ? VPMU_EVENT_FORK_THREAD : 0;
+
+    record_event(parent, VPMU_EVENT_FORK, flags, child->pid, 0);
+}
+
+static void probe_sched_process_exit(void *data, struct task_struct *task)
+{
+    record_event(task, VPMU_EVENT_EXIT, 0, 0, 0);
+}
+
+static void probe_sched_process_exec(void *               data,
+                                     struct task_struct * task,
+                                     pid_t                old_pid,
+                                     struct linux_binprm *bprm)
+{
+    record_event_name(task, VPMU_EVENT_EXEC, 0, old_pid, 0, task->comm, 0);
+}
+
+/* Pre-handler of mmap_region(file, addr, len, vm_flags, pgoff, ...) */
+static int probe_mmap_region(struct kprobe *p, struct pt_regs *regs)
+{
+    struct file * file     = (struct file *)VPMU_KPROBE_ARG(regs, 0);
+    unsigned long vm_flags = (unsigned long)VPMU_KPROBE_ARG(regs, 3);
+    unsigned long pgoff    = (unsigned long)VPMU_KPROBE_ARG(regs, 4);
+    char          buf[VPMU_EVENT_NAME_MAX];
+    char *        name     = NULL;
+
+    // Only the code needs a name, for symbolizing the samples of VPMU
+    if (file && (vm_flags & VM_EXEC)) {
+        name = d_path(&file->f_path, buf, sizeof(buf));
+        if (IS_ERR(name)) name = NULL;
+    }
+    record_event_name(current,
+                      VPMU_EVENT_MMAP,
+                      (uint32_t)vm_flags,
+                      VPMU_KPROBE_ARG(regs, 1),
+                      VPMU_KPROBE_ARG(regs, 2),
+                      name,
+                      (uint64_t)pgoff << PAGE_SHIFT);
+    return 0;
+}
+
+static struct kprobe vpmu_event_mmap_kprobe = {
+  .symbol_name = "mmap_region", .pre_handler = probe_mmap_region,
+};
+
+typedef struct VPMUTracepoint {
+    const char *       name;
+    void *             probe;
+    struct tracepoint *tp;
+} VPMUTracepoint;
+
+static VPMUTracepoint vpmu_tracepoints[] = {
+  {"sched_switch", probe_sched_switch, NULL},
+  {"sched_process_fork", probe_sched_process_fork, NULL},
+  {"sched_process_exit", probe_sched_process_exit, NULL},
+  {"sched_process_exec", probe_sched_process_exec, NULL},
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+static void find_tracepoint(struct tracepoint *tp, void *priv)
+{
+    VPMUTracepoint *target = (VPMUTracepoint *)priv;
+
+    if (strcmp(tp->name, target->name) == 0) target->tp = tp;
+}
+
+struct tracepoint *vpmu_find_tracepoint(const char *name)
+{
+    VPMUTracepoint target = {name, NULL, NULL};
+
+    for_each_kernel_tracepoint(find_tracepoint, &target);
+    return target.tp;
+}
+#endif
+
+static void unregister_tracepoints(void)
+{
+    int i = 0;
+
+    for (i = 0; i < ARRAY_SIZE(vpmu_tracepoints); i++) {
+        if (vpmu_tracepoints[i].tp == NULL) continue;
+        tracepoint_probe_unregister(
+          vpmu_tracepoints[i].tp, vpmu_tracepoints[i].probe, NULL);
+        vpmu_tracepoints[i].tp = NULL;
+    }
+    tracepoint_synchronize_unregister();
+}
+
+int vpmu_event_ring_init(void)
+{
+    int err = 0;
+    int i   = 0;
+
+    if (vpmu_event_ring_pages <= 0) return 0;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0)
+    printk(KERN_WARNING "VPMU: Event ring requires Linux 4.3 or later\n");
+    return -ENOSYS;
+#else
+    vpmu_event_ring = vpmu_ring_alloc(vpmu_event_ring_pages, &vpmu_event_ring_page);
+    if (vpmu_event_ring == NULL) return -ENOMEM;
+
+    for (i = 0; i < ARRAY_SIZE(vpmu_tracepoints); i++) {
+        vpmu_tracepoints[i].tp = vpmu_find_tracepoint(vpmu_tracepoints[i].name);
+        if (vpmu_tracepoints[i].tp == NULL) {
+            printk(KERN_WARNING "VPMU: Tracepoint %s is not found\n",
+                   vpmu_tracepoints[i].name);
+            err = -ENOENT;
+            goto fail;
+        }
+        err = tracepoint_probe_register(
+          vpmu_tracepoints[i].tp, vpmu_tracepoints[i].probe, NULL);
+        if (err) {
+            vpmu_tracepoints[i].tp = NULL;
+            goto fail;
+        }
+    }
+    err = register_kprobe(&vpmu_event_mmap_kprobe);
+    if (err < 0) goto fail;
+
+#ifndef DRY_RUN
+    // Tell VPMU where the ring is, it reads the ring by physical address
+    VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_EVENT_RING_ADDR, virt_to_phys(vpmu_event_ring));
+    VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_EVENT_RING_SIZE, vpmu_ring_size(vpmu_event_ring));
+#endif
+    printk(KERN_DEBUG "VPMU: Event ring with %u records is ON\n",
+           vpmu_event_ring->num_records);
+    return 1;
+
+fail:
+    printk(KERN_WARNING "VPMU: Failed to set up event ring (%d)\n", err);
+    unregister_tracepoints();
+    vpmu_ring_free(vpmu_event_ring, vpmu_event_ring_page);
+    vpmu_event_ring = NULL;
+    return err;
+#endif
+}
+
+void vpmu_event_ring_exit(void)
+{
+    if (vpmu_event_ring == NULL) return;
+#ifndef DRY_RUN
+    // Disable the ring in VPMU before releasing the memory
+    VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_EVENT_RING_SIZE, 0);
+#endif
+    unregister_kprobe(&vpmu_event_mmap_kprobe);
+    unregister_tracepoints();
+    vpmu_ring_free(vpmu_event_ring, vpmu_event_ring_page);
+    vpmu_event_ring = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef EVENT_RING_H_
+#define EVENT_RING_H_
+#include <linux/mm_types.h> // struct page
+
+#include "../vpmu-event.h" // Layout of the ring shared with VPMU
+
+/* A ring in physically contiguous pages which can be read by VPMU directly */
+VPMUEventRing *vpmu_ring_alloc(unsigned int nr_pages, struct page **out_pages);
+void vpmu_ring_free(VPMUEventRing *ring, struct page *pages);
+size_t vpmu_ring_size(VPMUEventRing *ring);
+/* Returns false if the ring is full and the record is dropped */
+bool vpmu_ring_push(VPMUEventRing *ring, const VPMUEventRecord *record);
+
+/* Record the task and memory events of guest kernel into the ring for VPMU.
+ * Returns 1 if the ring is active, 0 if it's disabled, negative on errors.
+ */
+int  vpmu_event_ring_init(void);
+void vpmu_event_ring_exit(void);
+
+/* Look up a kernel tracepoint by name (Linux 4.3 or later), NULL if not found */
+struct tracepoint *vpmu_find_tracepoint(const char *name);
+
+#endif // EVENT_RING_H_
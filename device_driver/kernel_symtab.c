@@ -0,0 +1,150 @@
+#include "device_file.h"
+#include "object_ship.h"
+#include "kernel_symtab.h"
+#include <linux/kernel.h>  /* printk() */
+#include <linux/errno.h>   /* error codes */
+#include <linux/string.h>  /* strlen(), memcpy() */
+#include <linux/vmalloc.h> /* vmalloc(), vfree() */
+#include <linux/sort.h>    /* sort() */
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+
+/* Grow a vmalloc buffer to hold at least need bytes (no vrealloc in older kernels) */
+static void *grow_buffer(void *buf, size_t used, size_t *cap, size_t need)
+{
+    void * new_buf = NULL;
+    size_t new_cap = (*cap) ? *cap : 4096;
+
+    if (need <= *cap) return buf;
+    while (new_cap < need) new_cap *= 2;
+    new_buf = vmalloc(new_cap);
+    if (new_buf == NULL) return NULL;
+    if (buf) {
+        memcpy(new_buf, buf, used);
+        vfree(buf);
+    }
+    *cap = new_cap;
+    return new_buf;
+}
+
+void vpmu_symtab_add(VPMUSymtab *tab, const char *name, unsigned long addr)
+{
+    size_t len = strlen(name) + 1;
+    void * buf = NULL;
+
+    if (tab->failed) return;
+    buf = grow_buffer(tab->symbols,
+                      tab->num_symbols * sizeof(VPMUSymbol),
+                      &tab->max_symbols,
+                      (tab->num_symbols + 1) * sizeof(VPMUSymbol));
+    if (buf == NULL) goto fail;
+    tab->symbols = buf;
+    buf = grow_buffer(
+      tab->strtab, tab->strtab_size, &tab->max_strtab, tab->strtab_size + len);
+    if (buf == NULL) goto fail;
+    tab->strtab = buf;
+
+    tab->symbols[tab->num_symbols].addr = addr;
+    tab->symbols[tab->num_symbols].size = 0;
+    tab->symbols[tab->num_symbols].name = tab->strtab_size;
+    tab->num_symbols++;
+    memcpy(tab->strtab + tab->strtab_size, name, len);
+    tab->strtab_size += len;
+    return;
+fail:
+    tab->failed = true;
+}
+
+static int compare_symbol(const void *a, const void *b)
+{
+    const VPMUSymbol *x = a;
+    const VPMUSymbol *y = b;
+
+    if (x->addr != y->addr) return (x->addr > y->addr) ? 1 : -1;
+    return 0;
+}
+
+int vpmu_symtab_ship(VPMUSymtab *tab, unsigned long text_start, unsigned long text_end)
+{
+    VPMUSymbolTable *table  = NULL;
+    char *           strtab = NULL;
+    size_t           num    = 0;
+    size_t           size   = 0;
+    size_t           len    = 0;
+    size_t           i      = 0;
+    size_t           j      = 0;
+    int              retval = 0;
+
+    if (tab->failed) {
+        retval = -ENOMEM;
+        goto out;
+    }
+    if (text_start == 0 || text_end <= text_start) {
+        retval = -ENOENT;
+        goto out;
+    }
+    // Keep the kernel text only, in place
+    for (i = 0; i < tab->num_symbols; i++) {
+        if (tab->symbols[i].addr >= text_start && tab->symbols[i].addr < text_end) {
+            tab->symbols[num++] = tab->symbols[i];
+            size += strlen(tab->strtab + tab->symbols[i].name) + 1;
+        }
+    }
+    if (num == 0) {
+        retval = -ENOENT;
+        goto out;
+    }
+    sort(tab->symbols, num, sizeof(VPMUSymbol), compare_symbol, NULL);
+    // The size of a symbol spans to the next symbol at a different address
+    for (i = 0; i < num; i = j) {
+        uint64_t next = text_end;
+
+        for (j = i + 1; j < num && tab->symbols[j].addr == tab->symbols[i].addr; j++)
+            ;
+        if (j < num) next = tab->symbols[j].addr;
+        for (; i < j; i++) tab->symbols[i].size = next - tab->symbols[i].addr;
+    }
+
+    table = vmalloc(sizeof(VPMUSymbolTable) + num * sizeof(VPMUSymbol) + size);
+    if (table == NULL) {
+        retval = -ENOMEM;
+        goto out;
+    }
+    table->magic       = VPMU_SYMTAB_MAGIC;
+    table->version     = VPMU_SYMTAB_VERSION;
+    table->num_symbols = num;
+    table->strtab_size = size;
+    // Pack the names of the symbols kept in the order of addresses
+    strtab = (char *)&table->symbols[num];
+    size   = 0;
+    for (i = 0; i < num; i++) {
+        len                    = strlen(tab->strtab + tab->symbols[i].name) + 1;
+        table->symbols[i]      = tab->symbols[i];
+        table->symbols[i].name = size;
+        memcpy(strtab + size, tab->strtab + tab->symbols[i].name, len);
+        size += len;
+    }
+    size += sizeof(VPMUSymbolTable) + num * sizeof(VPMUSymbol);
+
+    retval =
+      vpmu_ship_vmalloc(vpmu_base, VPMU_OBJ_KERNEL_SYMTAB, "kallsyms", table, size);
+    if (retval == 0) {
+        printk(KERN_DEBUG "VPMU: Shipped %zu kernel text symbols (%zu bytes)\n",
+               num,
+               size);
+    }
+    vfree(table);
+out:
+    if (retval) {
+        printk(KERN_WARNING "VPMU: Failed to ship kernel symbols (%d)\n", retval);
+    }
+    vpmu_symtab_free(tab);
+    return retval;
+}
+
+void vpmu_symtab_free(VPMUSymtab *tab)
+{
+    vfree(tab->symbols);
+    vfree(tab->strtab);
+    memset(tab, 0, sizeof(VPMUSymtab));
+}
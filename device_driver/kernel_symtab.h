@@ -0,0 +1,23 @@
+#ifndef KERNEL_SYMTAB_H_
+#define KERNEL_SYMTAB_H_
+#include <linux/types.h> // size_t, bool
+
+#include "../vpmu-object.h" // Layout of the table shared with VPMU
+
+/* The table under construction, symbols are collected in the order of kallsyms */
+typedef struct VPMUSymtab {
+    VPMUSymbol *symbols;
+    size_t      num_symbols;
+    size_t      max_symbols;
+    char *      strtab;
+    size_t      strtab_size;
+    size_t      max_strtab;
+    bool        failed; /* Out of memory while collecting */
+} VPMUSymtab;
+
+void vpmu_symtab_add(VPMUSymtab *tab, const char *name, unsigned long addr);
+/* Sort the symbols in [text_start, text_end), ship them as one object and free tab */
+int  vpmu_symtab_ship(VPMUSymtab *tab, unsigned long text_start, unsigned long text_end);
+void vpmu_symtab_free(VPMUSymtab *tab);
+
+#endif // KERNEL_SYMTAB_H_
@@ -1,11 +1,17 @@
 #include "device_file.h"
+#include "object_ship.h"
+#include "event_ring.h"
+#include "kernel_symtab.h"
+#include "offset_table.h"
+#include "cgroup_watch.h"
+#include "perf_pmu.h"
 #include <linux/init.h>     /* module_init, module_exit */
 #include <linux/module.h>   /* version info, MODULE_LICENSE, MODULE_AUTHOR, printk() */
 #include <asm/io.h>         /* ioremap, ioremap_nocache, iounmap */
 #include <linux/fs.h>       /* file stuff */
 #include <linux/sched.h>    /* struct task_struct */
 #include <asm/uaccess.h>    /* Needed by segment descriptors */
-#include <linux/kallsyms.h> /* kallsyms_lookup_name() */
+#include <linux/kallsyms.h> /* kallsyms_on_each_symbol() */
 #include <linux/version.h>
 
 #include "../vpmu-device.h"
@@ -26,28 +32,88 @@ MODULE_AUTHOR("Medicine Yeh");
 #define SET_ARG(_OFFSET, _VAL)                                                           \
     VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_OFFSET_##_OFFSET, (_VAL));
 
+/* Ship the sorted table of kernel text symbols for kernel-level profiling */
+static bool vpmu_kernel_symtab = false;
+module_param(vpmu_kernel_symtab, bool, S_IRUGO);
+
 static int start_with(const char *str, const char *prefix)
 {
     return (strncmp(str, prefix, strlen(prefix)) == 0);
 }
 
-typedef struct KallsymsData {
-    unsigned long addr;
-    const char *  prefix_name;
+typedef struct KernelSymbol {
     const char *  name;
+    bool          prefix; /* Match the first symbol starting with name */
+    int           group;  /* Symbols of the same group are alternatives of each other */
+    unsigned long addr;
+} KernelSymbol;
+
+/* Every symbol required by VPMU, all of them are resolved in one pass of kallsyms.
+ * The groups are numbered in order, a kernel has one symbol of each group at least.
+ */
+static KernelSymbol kernel_symbols[] = {
+  {"mmap_region", false, 0, 0},
+  {"mprotect_fixup", false, 1, 0},
+  {"unmap_region", false, 2, 0},
+  {"_do_fork", false, 3, 0},
+  {"do_fork", false, 3, 0},
+  {"wake_up_new_task", false, 4, 0},
+  {"do_exit", false, 5, 0},
+  {"__switch_to", false, 6, 0},
+  {"__do_execve_file", true, 7, 0},
+  {"do_execveat_common", true, 7, 0},
+  {"do_execve_common", true, 7, 0},
+  {"perf_event_overflow", false, 8, 0},
+  {"_stext", false, 9, 0},
+  {"_etext", false, 10, 0},
+};
+#define NUM_SYMBOL_GROUPS (kernel_symbols[ARRAY_SIZE(kernel_symbols) - 1].group + 1)
+
+typedef struct KallsymsData {
+    int         num_found; /* Groups with a symbol found */
+    VPMUSymtab *symtab;    /* NULL if the table is not required */
 } KallsymsData;
 
+static bool symbol_group_found(int group)
+{
+    int i = 0;
+
+    for (i = 0; i < ARRAY_SIZE(kernel_symbols); i++) {
+        if (kernel_symbols[i].group == group && kernel_symbols[i].addr != 0) return true;
+    }
+    return false;
+}
+
 static int find_fn(void *data, const char *name, struct module *mod, unsigned long addr)
 {
     KallsymsData *ptr = (KallsymsData *)data;
+    int           i   = 0;
 
     // printk(KERN_DEBUG "%s\n", name);
-    if (name != NULL && start_with(name, ptr->prefix_name)) {
-        ptr->addr = addr;
-        ptr->name = name;
-        return 1;
+    if (name == NULL) return 0;
+    for (i = 0; i < ARRAY_SIZE(kernel_symbols); i++) {
+        KernelSymbol *sym = &kernel_symbols[i];
+
+        if (sym->addr != 0) continue;
+        if (sym->prefix ? start_with(name, sym->name) : strcmp(name, sym->name) == 0) {
+            if (!symbol_group_found(sym->group)) ptr->num_found++;
+            sym->addr = addr;
+        }
     }
+    // Symbols of modules are not in the table
+    if (ptr->symtab && mod == NULL) vpmu_symtab_add(ptr->symtab, name, addr);
+
+    // Stop walking once every group is found, a kernel lacks the other alternatives
+    return (ptr->symtab == NULL && ptr->num_found == NUM_SYMBOL_GROUPS);
+}
+
+static unsigned long kernel_symbol_addr(const char *name)
+{
+    int i = 0;
 
+    for (i = 0; i < ARRAY_SIZE(kernel_symbols); i++) {
+        if (strcmp(kernel_symbols[i].name, name) == 0) return kernel_symbols[i].addr;
+    }
     return 0;
 }
 
@@ -55,7 +121,7 @@ int pass_kernel_symbol(const char *name)
 {
     unsigned long ret;
 
-    ret = kallsyms_lookup_name(name);
+    ret = kernel_symbol_addr(name);
     if (ret == 0) {
         printk(KERN_DEBUG "VPMU: Symbol %s is not found\n", name);
         return 0;
@@ -72,18 +138,17 @@ int pass_kernel_symbol(const char *name)
 
 int pass_kernel_symbol_prefix(const char *prefix_name)
 {
-    KallsymsData ret = {};
-    ret.prefix_name  = prefix_name;
+    unsigned long ret;
 
-    kallsyms_on_each_symbol(find_fn, (void *)&ret);
-    if (ret.addr == 0) {
+    ret = kernel_symbol_addr(prefix_name);
+    if (ret == 0) {
         printk(KERN_DEBUG "VPMU: Symbol (prefix) %s is not found\n", prefix_name);
         return 0;
     } else {
-        printk(KERN_DEBUG "VPMU: Symbol (prefix) %s : %lx\n", prefix_name, ret.addr);
+        printk(KERN_DEBUG "VPMU: Symbol (prefix) %s : %lx\n", prefix_name, ret);
 #ifndef DRY_RUN
         SET_ARG(KERNEL_SYM_NAME, prefix_name);
-        SET_ARG(KERNEL_SYM_ADDR, ret.addr);
+        SET_ARG(KERNEL_SYM_ADDR, ret);
 #endif
     }
 
@@ -101,6 +166,11 @@ static int simple_driver_init(void)
     unsigned long offset_pid      = 0;
     // A temporary variable for storing results (return values)
     int result = 0;
+    // Task and mmap events are recorded by tracepoints instead of breakpoints of VPMU
+    bool ring_on = false;
+    // Symbols found in kallsyms
+    KallsymsData ksyms  = {};
+    VPMUSymtab   symtab = {};
 
     printk(KERN_DEBUG "VPMU: Initialization started\n");
 
@@ -116,22 +186,10 @@ static int simple_driver_init(void)
     offset_d_parent = (unsigned long)offsetof(struct dentry, d_parent);
     offset_pid      = (unsigned long)offsetof(struct task_struct, pid);
 
-// Retrieve architecture/version dependent information
-#if defined(__arm__)
-    // ARM specific parameters
+    // Without CONFIG_THREAD_INFO_IN_TASK (e.g. X86 < 4.9) thread_info points to task,
+    // otherwise thread_info is in task_struct and it is described by the offset table.
+#ifndef CONFIG_THREAD_INFO_IN_TASK
     offset_task = (unsigned long)offsetof(struct thread_info, task);
-
-// End of ARM specific parameters
-#else
-// X86 specific parameters
-
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 9, 0)
-    // X86 and kernel < 4.9.0
-    offset_task = (unsigned long)offsetof(struct thread_info, task);
-
-// End of X86 and kernel < 4.9.0
-#endif
-// End of X86 specific parameters
 #endif
 
     // Show debug messages
@@ -158,15 +216,30 @@ static int simple_driver_init(void)
     SET_ARG(LINUX_VERSION, (unsigned long)LINUX_VERSION_CODE);
     VPMU_IO_WRITE(vpmu_base + VPMU_MMAP_THREAD_SIZE, (THREAD_SIZE));
 #endif
+    // The registers above are kept for older VPMU, the table has all the offsets
+    vpmu_offset_table_ship();
+
+    // Fall back to breakpoints if the event ring is disabled or fails
+    ring_on = (vpmu_event_ring_init() > 0);
+
+    // Walk kallsyms only once for all the symbols (and the table)
+    if (vpmu_kernel_symtab) ksyms.symtab = &symtab;
+    kallsyms_on_each_symbol(find_fn, (void *)&ksyms);
+    if (ksyms.symtab) {
+        vpmu_symtab_ship(
+          &symtab, kernel_symbol_addr("_stext"), kernel_symbol_addr("_etext"));
+    }
 
     // Pass kernel symbol address information to VPMU
-    pass_kernel_symbol("mmap_region");
+    if (!ring_on) pass_kernel_symbol("mmap_region");
     pass_kernel_symbol("mprotect_fixup");
     pass_kernel_symbol("unmap_region");
-    if (!pass_kernel_symbol("_do_fork")) pass_kernel_symbol("do_fork");
-    pass_kernel_symbol("wake_up_new_task");
-    pass_kernel_symbol("do_exit");
-    pass_kernel_symbol("__switch_to");
+    if (!ring_on) {
+        if (!pass_kernel_symbol("_do_fork")) pass_kernel_symbol("do_fork");
+        pass_kernel_symbol("wake_up_new_task");
+        pass_kernel_symbol("do_exit");
+        pass_kernel_symbol("__switch_to");
+    }
     if (!pass_kernel_symbol_prefix("__do_execve_file")) {
         if (!pass_kernel_symbol_prefix("do_execveat_common")) {
             pass_kernel_symbol_prefix("do_execve_common");
@@ -174,12 +247,24 @@ static int simple_driver_init(void)
     }
 
     result = register_device();
+    if (result) {
+        vpmu_event_ring_exit();
+        return result;
+    }
+    // Failing to hook is not fatal, the controller can still ship the binaries
+    vpmu_auto_ship_init();
+    // perf is optional as well, vpmu-control works without it
+    vpmu_perf_pmu_init(kernel_symbol_addr("perf_event_overflow"));
     return result;
 }
 /*-------------------------------------------------------------------------------------*/
 static void simple_driver_exit(void)
 {
     printk(KERN_DEBUG "VPMU: Exiting\n");
+    vpmu_perf_pmu_exit();
+    vpmu_cgroup_exit();
+    vpmu_auto_ship_exit();
+    vpmu_event_ring_exit();
 #ifndef DRY_RUN
     iounmap(vpmu_base);
 #endif
@@ -0,0 +1,337 @@
+#include "device_file.h"
+#include "object_ship.h"
+#include <linux/kernel.h>    /* printk() */
+#include <linux/module.h>    /* module_param() */
+#include <linux/errno.h>     /* error codes */
+#include <linux/slab.h>      /* kmalloc(), kfree() */
+#include <linux/mm.h>        /* VM_EXEC, put_page() */
+#include <linux/pagemap.h>   /* read_mapping_page() */
+#include <linux/vmalloc.h>   /* vzalloc(), vmalloc_to_page() */
+#include <linux/file.h>      /* get_file(), fput() */
+#include <linux/kprobes.h>   /* register_kprobe() */
+#include <linux/workqueue.h> /* alloc_workqueue(), queue_work() */
+#include <linux/hashtable.h> /* DEFINE_HASHTABLE() */
+#include <linux/spinlock.h>  /* spinlock stuff */
+#include <linux/mutex.h>     /* mutex stuff */
+#include <asm/io.h>          /* page_to_phys() */
+#include <linux/version.h>
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+
+/* Ship every file-backed executable mapping (exec, libraries, dlopen) to VPMU */
+static bool vpmu_auto_ship = false;
+module_param(vpmu_auto_ship, bool, S_IRUGO);
+
+/* Serialize the register sequences of objects */
+static DEFINE_MUTEX(vpmu_ship_mutex);
+
+typedef struct VPMUShipState {
+    void *      base;      /* Register window of VPMU */
+    phys_addr_t addr;      /* Start of the range not yet passed */
+    size_t      len;       /* Length of the range not yet passed */
+    size_t      remaining; /* Bytes of the object not yet passed */
+} VPMUShipState;
+
+static void ship_flush(VPMUShipState *state)
+{
+    if (state->len == 0) return;
+#ifndef DRY_RUN
+    // VPMU copies the range right away when it receives the length
+    VPMU_IO_WRITE(state->base + VPMU_MMAP_OBJ_PADDR, state->addr);
+    VPMU_IO_WRITE(state->base + VPMU_MMAP_OBJ_PLEN, state->len);
+#endif
+    state->len = 0;
+}
+
+static void ship_begin(VPMUShipState *state,
+                       void *         base,
+                       unsigned long  type,
+                       const char *   name,
+                       size_t         size)
+{
+    state->base      = base;
+    state->addr      = 0;
+    state->len       = 0;
+    state->remaining = size;
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(base + VPMU_MMAP_OBJ_BEGIN, type);
+    VPMU_IO_WRITE(base + VPMU_MMAP_OBJ_SIZE, size);
+    VPMU_IO_WRITE(base + VPMU_MMAP_OBJ_NAME, name);
+#endif
+}
+
+/* Append a piece of page to the object, physically contiguous pieces are merged */
+static void ship_page(VPMUShipState *state, struct page *page, size_t offset, size_t len)
+{
+    phys_addr_t addr = page_to_phys(page) + offset;
+
+    if (len > state->remaining) len = state->remaining;
+    if (len == 0) return;
+    if (state->len > 0 && state->addr + state->len == addr) {
+        state->len += len;
+    } else {
+        ship_flush(state);
+        state->addr = addr;
+        state->len  = len;
+    }
+    state->remaining -= len;
+}
+
+static void ship_commit(VPMUShipState *state)
+{
+    ship_flush(state);
+#ifndef DRY_RUN
+    VPMU_IO_WRITE(state->base + VPMU_MMAP_OBJ_COMMIT, 0);
+#endif
+}
+
+/* Pass the pages of file in page cache, no copy of the content at all */
+int vpmu_ship_file(void *base, unsigned long type, struct file *file, const char *name)
+{
+    VPMUShipState state    = {};
+    struct page **pages    = NULL;
+    loff_t        size     = i_size_read(file_inode(file));
+    pgoff_t       nr_pages = 0;
+    pgoff_t       i        = 0;
+    int           retval   = 0;
+
+    if (size <= 0) return -EINVAL;
+    nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+    pages    = vzalloc(nr_pages * sizeof(struct page *));
+    if (pages == NULL) return -ENOMEM;
+
+    // Bring the whole file into page cache, the pages are held until VPMU copied them
+    for (i = 0; i < nr_pages; i++) {
+        pages[i] = read_mapping_page(file->f_mapping, i, file);
+        if (IS_ERR(pages[i])) {
+            retval   = PTR_ERR(pages[i]);
+            pages[i] = NULL;
+            goto out;
+        }
+    }
+
+    mutex_lock(&vpmu_ship_mutex);
+    ship_begin(&state, base, type, name, size);
+    for (i = 0; i < nr_pages; i++) {
+        ship_page(&state, pages[i], 0, PAGE_SIZE);
+    }
+    ship_commit(&state);
+    mutex_unlock(&vpmu_ship_mutex);
+
+out:
+    for (i = 0; i < nr_pages; i++) {
+        if (pages[i]) put_page(pages[i]);
+    }
+    vfree(pages);
+    return retval;
+}
+
+/* Pass a buffer allocated by vmalloc() or kmalloc() */
+int vpmu_ship_vmalloc(void *        base,
+                      unsigned long type,
+                      const char *  name,
+                      void *        buf,
+                      size_t        size)
+{
+    VPMUShipState state  = {};
+    size_t        offset = 0;
+
+    if (buf == NULL || size == 0) return -EINVAL;
+    mutex_lock(&vpmu_ship_mutex);
+    ship_begin(&state, base, type, name, size);
+    while (offset < size) {
+        void *       ptr  = (char *)buf + offset;
+        size_t       len  = min_t(size_t, PAGE_SIZE - offset_in_page(ptr), size - offset);
+        struct page *page = NULL;
+
+        page = is_vmalloc_addr(ptr) ? vmalloc_to_page(ptr) : virt_to_page(ptr);
+
+        ship_page(&state, page, offset_in_page(ptr), len);
+        offset += len;
+    }
+    ship_commit(&state);
+    mutex_unlock(&vpmu_ship_mutex);
+    return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+#define vpmu_pin_pages(_start, _nr, _pages) pin_user_pages_fast(_start, _nr, 0, _pages)
+#define vpmu_unpin_page(_page) unpin_user_page(_page)
+#else
+#define vpmu_pin_pages(_start, _nr, _pages) get_user_pages_fast(_start, _nr, 0, _pages)
+#define vpmu_unpin_page(_page) put_page(_page)
+#endif
+
+/* Pass a user buffer, its pages are pinned until VPMU copied them */
+int vpmu_ship_user(void *             base,
+                   unsigned long      type,
+                   const char *       name,
+                   const void __user *buf,
+                   size_t             size)
+{
+    VPMUShipState  state    = {};
+    struct page ** pages    = NULL;
+    unsigned long  start    = (unsigned long)buf;
+    size_t         offset   = offset_in_page(start);
+    int            nr_pages = 0;
+    int            pinned   = 0;
+    int            i        = 0;
+    int            retval   = 0;
+
+    if (buf == NULL || size == 0) return -EINVAL;
+    nr_pages = DIV_ROUND_UP(offset + size, PAGE_SIZE);
+    pages    = vzalloc(nr_pages * sizeof(struct page *));
+    if (pages == NULL) return -ENOMEM;
+
+    pinned = vpmu_pin_pages(start - offset, nr_pages, pages);
+    if (pinned != nr_pages) {
+        retval = (pinned < 0) ? pinned : -EFAULT;
+        goto out;
+    }
+
+    // Pages of a huge page are physically contiguous, they end up in one range
+    mutex_lock(&vpmu_ship_mutex);
+    ship_begin(&state, base, type, name, size);
+    for (i = 0; i < nr_pages; i++) {
+        ship_page(&state, pages[i], offset, PAGE_SIZE - offset);
+        offset = 0;
+    }
+    ship_commit(&state);
+    mutex_unlock(&vpmu_ship_mutex);
+
+out:
+    for (i = 0; i < pinned; i++) vpmu_unpin_page(pages[i]);
+    vfree(pages);
+    return retval;
+}
+
+/*=====================================================================================*/
+/* Files shipped already, a file is identified by its device, inode number and size */
+typedef struct VPMUShippedFile {
+    struct hlist_node node;
+    dev_t             dev;
+    unsigned long     ino;
+    loff_t            size;
+} VPMUShippedFile;
+
+typedef struct VPMUShipWork {
+    struct work_struct work;
+    struct file *      file;
+} VPMUShipWork;
+
+static DEFINE_HASHTABLE(vpmu_shipped_files, 8);
+static DEFINE_SPINLOCK(vpmu_shipped_lock);
+static struct workqueue_struct *vpmu_ship_wq = NULL;
+
+/* Return true if the file is newly added (not shipped yet) */
+static bool shipped_files_add(struct inode *inode)
+{
+    VPMUShippedFile *entry = NULL;
+    unsigned long    flags = 0;
+    loff_t           size  = i_size_read(inode);
+    bool             found = false;
+
+    spin_lock_irqsave(&vpmu_shipped_lock, flags);
+    hash_for_each_possible(vpmu_shipped_files, entry, node, inode->i_ino)
+    {
+        if (entry->dev == inode->i_sb->s_dev && entry->ino == inode->i_ino
+            && entry->size == size) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        entry = kmalloc(sizeof(VPMUShippedFile), GFP_ATOMIC);
+        if (entry) {
+            entry->dev  = inode->i_sb->s_dev;
+            entry->ino  = inode->i_ino;
+            entry->size = size;
+            hash_add(vpmu_shipped_files, &entry->node, inode->i_ino);
+        }
+    }
+    spin_unlock_irqrestore(&vpmu_shipped_lock, flags);
+    return !found;
+}
+
+static void vpmu_auto_ship_work(struct work_struct *work)
+{
+    VPMUShipWork *ship = container_of(work, VPMUShipWork, work);
+    char *        buf  = kmalloc(PATH_MAX, GFP_KERNEL);
+    char *        name = NULL;
+
+    if (buf == NULL) goto out;
+    name = d_path(&ship->file->f_path, buf, PATH_MAX);
+    if (IS_ERR(name)) goto out;
+    if (vpmu_ship_file(vpmu_base, VPMU_OBJ_BINARY, ship->file, name) == 0) {
+        printk(KERN_DEBUG "VPMU: Shipped %s\n", name);
+    }
+
+out:
+    kfree(buf);
+    fput(ship->file);
+    kfree(ship);
+}
+
+/* Pre-handler of mmap_region(file, addr, len, vm_flags, ...), runs in atomic context */
+static int vpmu_mmap_region_pre(struct kprobe *p, struct pt_regs *regs)
+{
+    struct file * file     = (struct file *)VPMU_KPROBE_ARG(regs, 0);
+    unsigned long vm_flags = (unsigned long)VPMU_KPROBE_ARG(regs, 3);
+    VPMUShipWork *ship     = NULL;
+
+    if (file == NULL || !(vm_flags & VM_EXEC)) return 0;
+    if (!shipped_files_add(file_inode(file))) return 0;
+
+    // Reading the page cache might sleep, defer it to the work queue
+    ship = kmalloc(sizeof(VPMUShipWork), GFP_ATOMIC);
+    if (ship == NULL) return 0;
+    get_file(file);
+    ship->file = file;
+    INIT_WORK(&ship->work, vpmu_auto_ship_work);
+    queue_work(vpmu_ship_wq, &ship->work);
+    return 0;
+}
+
+static struct kprobe vpmu_mmap_kprobe = {
+  .symbol_name = "mmap_region", .pre_handler = vpmu_mmap_region_pre,
+};
+
+int vpmu_auto_ship_init(void)
+{
+    int err = 0;
+
+    if (!vpmu_auto_ship) return 0;
+    vpmu_ship_wq = alloc_workqueue("vpmu_ship", WQ_UNBOUND, 1);
+    if (vpmu_ship_wq == NULL) return -ENOMEM;
+
+    err = register_kprobe(&vpmu_mmap_kprobe);
+    if (err < 0) {
+        printk(KERN_WARNING "VPMU: Failed to hook mmap_region (%d), "
+                            "automatic shipping is disabled\n",
+               err);
+        destroy_workqueue(vpmu_ship_wq);
+        vpmu_ship_wq = NULL;
+        return err;
+    }
+    printk(KERN_DEBUG "VPMU: Automatic shipping of executable mappings is ON\n");
+    return 0;
+}
+
+void vpmu_auto_ship_exit(void)
+{
+    VPMUShippedFile * entry = NULL;
+    struct hlist_node *tmp  = NULL;
+    int                bkt  = 0;
+
+    if (vpmu_ship_wq == NULL) return;
+    unregister_kprobe(&vpmu_mmap_kprobe);
+    // Wait for all pending works
+    destroy_workqueue(vpmu_ship_wq);
+    vpmu_ship_wq = NULL;
+
+    hash_for_each_safe(vpmu_shipped_files, bkt, tmp, entry, node)
+    {
+        hash_del(&entry->node);
+        kfree(entry);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef OBJECT_SHIP_H_
+#define OBJECT_SHIP_H_
+#include <linux/fs.h> // struct file
+
+/*
+ * Pass objects (binaries, tables) to VPMU as lists of physical memory ranges.
+ * VPMU reads the ranges from guest physical memory directly, no virtual address
+ * of any process is involved. All functions return 0 on success.
+ */
+int vpmu_ship_file(void *base, unsigned long type, struct file *file, const char *name);
+int vpmu_ship_vmalloc(void *        base,
+                      unsigned long type,
+                      const char *  name,
+                      void *        buf,
+                      size_t        size);
+int vpmu_ship_user(void *             base,
+                   unsigned long      type,
+                   const char *       name,
+                   const void __user *buf,
+                   size_t             size);
+
+/* Ship every executable file mapped in the guest automatically (opt-in) */
+int  vpmu_auto_ship_init(void);
+void vpmu_auto_ship_exit(void);
+
+#endif // OBJECT_SHIP_H_
@@ -0,0 +1,93 @@
+#include "device_file.h"
+#include "object_ship.h"
+#include "offset_table.h"
+#include <linux/kernel.h>   /* printk() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/slab.h>     /* kmalloc(), kfree() */
+#include <linux/stddef.h>   /* offsetof() */
+#include <linux/fs.h>       /* struct file */
+#include <linux/dcache.h>   /* struct dentry */
+#include <linux/sched.h>    /* struct task_struct */
+#include <linux/mm_types.h> /* struct mm_struct, struct vm_area_struct */
+#include <linux/version.h>
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+#include "../vpmu-object.h" /* Layout of the table shared with VPMU */
+
+#define FIELD_SIZE(_type, _member) sizeof(((_type *)0)->_member)
+
+/*
+ * (name, struct, member) of the fields passed to VPMU. The offsets are generated by
+ * the compiler with the headers of the running kernel, so they are always exact.
+ * Fields depending on the configuration or the version are in separate lists.
+ */
+#define KERNEL_OFFSETS(X)                                                                \
+    X(FILE_f_path_dentry, file, f_path.dentry)                                           \
+    X(DENTRY_d_iname, dentry, d_iname)                                                   \
+    X(DENTRY_d_parent, dentry, d_parent)                                                 \
+    X(TASK_STRUCT_pid, task_struct, pid)                                                 \
+    X(TASK_STRUCT_tgid, task_struct, tgid)                                               \
+    X(TASK_STRUCT_comm, task_struct, comm)                                               \
+    X(TASK_STRUCT_mm, task_struct, mm)                                                   \
+    X(TASK_STRUCT_real_parent, task_struct, real_parent)                                 \
+    X(MM_STRUCT_pgd, mm_struct, pgd)                                                     \
+    X(VM_AREA_STRUCT_vm_start, vm_area_struct, vm_start)                                 \
+    X(VM_AREA_STRUCT_vm_end, vm_area_struct, vm_end)                                     \
+    X(VM_AREA_STRUCT_vm_flags, vm_area_struct, vm_flags)                                 \
+    X(VM_AREA_STRUCT_vm_pgoff, vm_area_struct, vm_pgoff)                                 \
+    X(VM_AREA_STRUCT_vm_file, vm_area_struct, vm_file)
+
+#ifdef CONFIG_THREAD_INFO_IN_TASK
+#define THREAD_INFO_OFFSETS(X) X(TASK_STRUCT_thread_info, task_struct, thread_info)
+#else
+#define THREAD_INFO_OFFSETS(X) X(THREAD_INFO_task, thread_info, task)
+#endif
+
+// The list of VMAs is replaced by the maple tree since 6.1
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
+#define VMA_LIST_OFFSETS(X)                                                              \
+    X(MM_STRUCT_mmap, mm_struct, mmap)                                                   \
+    X(VM_AREA_STRUCT_vm_next, vm_area_struct, vm_next)
+#else
+#define VMA_LIST_OFFSETS(X)
+#endif
+
+#define OFFSET_ENTRY(_name, _type, _member)                                              \
+    {VPMU_OFFSET_##_name,                                                                \
+     FIELD_SIZE(struct _type, _member),                                                  \
+     offsetof(struct _type, _member)},
+
+static const VPMUOffsetEntry kernel_offsets[] = {
+  KERNEL_OFFSETS(OFFSET_ENTRY) THREAD_INFO_OFFSETS(OFFSET_ENTRY)
+    VMA_LIST_OFFSETS(OFFSET_ENTRY)};
+
+#undef OFFSET_ENTRY
+
+int vpmu_offset_table_ship(void)
+{
+    VPMUOffsetTable *table  = NULL;
+    size_t           size   = sizeof(VPMUOffsetTable) + sizeof(kernel_offsets);
+    int              retval = 0;
+
+    // Objects must be in kmalloc or vmalloc memory, not in the image of module
+    table = kmalloc(size, GFP_KERNEL);
+    if (table == NULL) return -ENOMEM;
+    table->magic       = VPMU_OFFSET_TABLE_MAGIC;
+    table->version     = VPMU_OFFSET_TABLE_VERSION;
+    table->num_entries = ARRAY_SIZE(kernel_offsets);
+    table->flags       = 0;
+#ifdef CONFIG_THREAD_INFO_IN_TASK
+    table->flags |= VPMU_OFFSET_THREAD_INFO_IN_TASK;
+#endif
+    table->linux_version = LINUX_VERSION_CODE;
+    table->thread_size   = THREAD_SIZE;
+    memcpy(table->entries, kernel_offsets, sizeof(kernel_offsets));
+
+    retval = vpmu_ship_vmalloc(vpmu_base, VPMU_OBJ_OFFSET_TABLE, "offsets", table, size);
+    if (retval == 0) {
+        printk(KERN_DEBUG "VPMU: Shipped %u offsets of kernel structures\n",
+               table->num_entries);
+    }
+    kfree(table);
+    return retval;
+}
@@ -0,0 +1,7 @@
+#ifndef OFFSET_TABLE_H_
+#define OFFSET_TABLE_H_
+
+/* Ship the offsets of kernel structures required by VPMU as one object */
+int vpmu_offset_table_ship(void);
+
+#endif // OFFSET_TABLE_H_
@@ -0,0 +1,248 @@
+#include "device_file.h"
+#include "perf_pmu.h"
+#include <linux/version.h>
+#include <linux/kernel.h>     /* printk() */
+#include <linux/module.h>     /* module_param() */
+#include <linux/errno.h>      /* error codes */
+#include <linux/perf_event.h> /* struct pmu, perf_pmu_register() */
+#include <linux/hrtimer.h>    /* hrtimer stuff */
+#include <linux/cpumask.h>    /* num_possible_cpus() */
+#include <asm/irq_regs.h>     /* get_irq_regs() */
+
+#include "../vpmu-device.h" /* VPMU Configurations */
+
+/* Register the "vpmu" PMU, e.g. perf stat -e vpmu/instructions/ */
+static bool vpmu_perf = false;
+module_param(vpmu_perf, bool, S_IRUGO);
+/* Interval in microseconds of checking the overflow of sampling events */
+static int vpmu_perf_poll_us = 1000;
+module_param(vpmu_perf_poll_us, int, S_IRUGO);
+
+#if defined(CONFIG_PERF_EVENTS) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+typedef int (*PerfEventOverflowFn)(struct perf_event *     event,
+                                   struct perf_sample_data *data,
+                                   struct pt_regs *         regs);
+
+static PerfEventOverflowFn vpmu_perf_event_overflow = NULL;
+static bool                vpmu_perf_registered     = false;
+
+/* The registers are as wide as a word of the guest */
+static inline u64 read_counter(u64 id)
+{
+    u64 value = 0;
+
+#ifndef DRY_RUN
+    VPMU_IO_READ(vpmu_base + VPMU_MMAP_PERF_COUNTER(id), value);
+#endif
+    return value;
+}
+
+/* Accumulate the increment since the last update, return the new value */
+static u64 vpmu_perf_update(struct perf_event *event)
+{
+    struct hw_perf_event *hwc   = &event->hw;
+    int                   shift = 64 - BITS_PER_LONG;
+    u64                   prev  = 0;
+    u64                   now   = 0;
+    s64                   delta = 0;
+
+    // The timer might race with read()
+    do {
+        prev = local64_read(&hwc->prev_count);
+        now  = read_counter(event->attr.config);
+    } while (local64_cmpxchg(&hwc->prev_count, prev, now) != prev);
+
+    // Handle the wrap around of 32 bits registers
+    delta = (now << shift) - (prev << shift);
+    delta >>= shift;
+    local64_add(delta, &event->count);
+    local64_sub(delta, &hwc->period_left);
+    return now;
+}
+
+static enum hrtimer_restart vpmu_perf_timer(struct hrtimer *timer)
+{
+    struct perf_event *     event = container_of(timer, struct perf_event, hw.hrtimer);
+    struct hw_perf_event *  hwc   = &event->hw;
+    struct perf_sample_data data;
+    struct pt_regs *        regs = get_irq_regs();
+
+    if (hwc->state & PERF_HES_STOPPED) return HRTIMER_NORESTART;
+    vpmu_perf_update(event);
+    // One sample per tick, with all the events since the last sample as its period.
+    // Samples are attributed to the context interrupted by the timer
+    if (local64_read(&hwc->period_left) <= 0) {
+        hwc->last_period = hwc->sample_period - local64_read(&hwc->period_left);
+        local64_set(&hwc->period_left, hwc->sample_period);
+        perf_sample_data_init(&data, 0, hwc->last_period);
+        if (regs && vpmu_perf_event_overflow(event, &data, regs)) {
+            hwc->state |= PERF_HES_STOPPED;
+            return HRTIMER_NORESTART;
+        }
+    }
+    hrtimer_forward_now(timer, ns_to_ktime(vpmu_perf_poll_us * NSEC_PER_USEC));
+    return HRTIMER_RESTART;
+}
+
+static void vpmu_perf_start(struct perf_event *event, int flags)
+{
+    struct hw_perf_event *hwc = &event->hw;
+
+    hwc->state = 0;
+    local64_set(&hwc->prev_count, read_counter(event->attr.config));
+    if (is_sampling_event(event)) {
+        if (local64_read(&hwc->period_left) <= 0)
+            local64_set(&hwc->period_left, hwc->sample_period);
+        hrtimer_start(&hwc->hrtimer,
+                      ns_to_ktime(vpmu_perf_poll_us * NSEC_PER_USEC),
+                      HRTIMER_MODE_REL_PINNED);
+    }
+}
+
+static void vpmu_perf_stop(struct perf_event *event, int flags)
+{
+    struct hw_perf_event *hwc = &event->hw;
+
+    if (is_sampling_event(event)) hrtimer_cancel(&hwc->hrtimer);
+    if (!(hwc->state & PERF_HES_UPTODATE)) vpmu_perf_update(event);
+    hwc->state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+/* Called on switching to the task (or cgroup) of the event */
+static int vpmu_perf_add(struct perf_event *event, int flags)
+{
+    event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+    if (flags & PERF_EF_START) vpmu_perf_start(event, PERF_EF_RELOAD);
+    return 0;
+}
+
+/* Called on switching out, the counts in between belong to other tasks */
+static void vpmu_perf_del(struct perf_event *event, int flags)
+{
+    vpmu_perf_stop(event, PERF_EF_UPDATE);
+}
+
+static void vpmu_perf_read(struct perf_event *event)
+{
+    if (!(event->hw.state & PERF_HES_STOPPED)) vpmu_perf_update(event);
+}
+
+static struct pmu vpmu_pmu;
+
+static int vpmu_perf_event_init(struct perf_event *event)
+{
+    struct hw_perf_event *hwc = &event->hw;
+
+    if (event->attr.type != vpmu_pmu.type) return -ENOENT;
+    if (event->attr.config >= VPMU_PERF_MAX_COUNTERS) return -EINVAL;
+    // VPMU counts user and kernel together
+    if (event->attr.exclude_user || event->attr.exclude_kernel) return -EINVAL;
+    if (has_branch_stack(event)) return -EOPNOTSUPP;
+    if (is_sampling_event(event) && vpmu_perf_event_overflow == NULL) return -EOPNOTSUPP;
+    // The period is not adjusted to a frequency, sample with a fixed period (-c)
+    if (event->attr.freq) return -EOPNOTSUPP;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&hwc->hrtimer, vpmu_perf_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+    hrtimer_init(&hwc->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    hwc->hrtimer.function = vpmu_perf_timer;
+#endif
+    local64_set(&hwc->period_left, hwc->sample_period);
+    return 0;
+}
+
+PMU_FORMAT_ATTR(event, "config:0-5");
+
+static struct attribute *vpmu_perf_format_attrs[] = {
+  &format_attr_event.attr, NULL,
+};
+
+static struct attribute_group vpmu_perf_format_group = {
+  .name = "format", .attrs = vpmu_perf_format_attrs,
+};
+
+/* Names of the counters for perf, e.g. vpmu/instructions/ */
+#define VPMU_PERF_EVENT_ATTR(_name, _var, _id)                                           \
+    PMU_EVENT_ATTR_STRING(_name, vpmu_perf_attr_##_var, "event=" __stringify(_id))
+
+VPMU_PERF_EVENT_ATTR(instructions, instructions, VPMU_PERF_INSTRUCTIONS);
+VPMU_PERF_EVENT_ATTR(cycles, cycles, VPMU_PERF_CYCLES);
+VPMU_PERF_EVENT_ATTR(icache-misses, icache_misses, VPMU_PERF_ICACHE_MISSES);
+VPMU_PERF_EVENT_ATTR(dcache-misses, dcache_misses, VPMU_PERF_DCACHE_MISSES);
+VPMU_PERF_EVENT_ATTR(branches, branches, VPMU_PERF_BRANCHES);
+VPMU_PERF_EVENT_ATTR(branch-misses, branch_misses, VPMU_PERF_BRANCH_MISSES);
+
+static struct attribute *vpmu_perf_event_attrs[] = {
+  &vpmu_perf_attr_instructions.attr.attr,
+  &vpmu_perf_attr_cycles.attr.attr,
+  &vpmu_perf_attr_icache_misses.attr.attr,
+  &vpmu_perf_attr_dcache_misses.attr.attr,
+  &vpmu_perf_attr_branches.attr.attr,
+  &vpmu_perf_attr_branch_misses.attr.attr,
+  NULL,
+};
+
+static struct attribute_group vpmu_perf_event_group = {
+  .name = "events", .attrs = vpmu_perf_event_attrs,
+};
+
+static const struct attribute_group *vpmu_perf_attr_groups[] = {
+  &vpmu_perf_format_group, &vpmu_perf_event_group, NULL,
+};
+
+static struct pmu vpmu_pmu = {
+  .module      = THIS_MODULE,
+  .task_ctx_nr = perf_sw_context,
+  .attr_groups = vpmu_perf_attr_groups,
+  .event_init  = vpmu_perf_event_init,
+  .add         = vpmu_perf_add,
+  .del         = vpmu_perf_del,
+  .start       = vpmu_perf_start,
+  .stop        = vpmu_perf_stop,
+  .read        = vpmu_perf_read,
+};
+
+int vpmu_perf_pmu_init(unsigned long overflow)
+{
+    int err = 0;
+
+    if (!vpmu_perf) return 0;
+    if (vpmu_perf_poll_us <= 0) return -EINVAL;
+    // The counters of VPMU are global, each CPU would count the events of all of them
+    if (num_possible_cpus() > 1) {
+        printk(KERN_WARNING "VPMU: perf PMU supports uniprocessor guests only\n");
+        return 0;
+    }
+    vpmu_perf_event_overflow = (PerfEventOverflowFn)overflow;
+    if (overflow == 0)
+        printk(KERN_WARNING "VPMU: perf_event_overflow is not found, no sampling\n");
+
+    err = perf_pmu_register(&vpmu_pmu, "vpmu", -1);
+    if (err) {
+        printk(KERN_WARNING "VPMU: Failed to register the perf PMU (%d)\n", err);
+        return err;
+    }
+    vpmu_perf_registered = true;
+    printk(KERN_DEBUG "VPMU: perf PMU \"vpmu\" is ON\n");
+    return 0;
+}
+
+void vpmu_perf_pmu_exit(void)
+{
+    if (!vpmu_perf_registered) return;
+    perf_pmu_unregister(&vpmu_pmu);
+    vpmu_perf_registered = false;
+}
+
+#else
+int vpmu_perf_pmu_init(unsigned long overflow)
+{
+    if (vpmu_perf)
+        printk(KERN_WARNING "VPMU: perf PMU requires Linux 4.2 or later with "
+                            "CONFIG_PERF_EVENTS\n");
+    return 0;
+}
+
+void vpmu_perf_pmu_exit(void) {}
+#endif
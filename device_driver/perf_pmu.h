@@ -0,0 +1,11 @@
+#ifndef PERF_PMU_H_
+#define PERF_PMU_H_
+
+/* Register the simulated counters of VPMU as the "vpmu" PMU of perf_event.
+ * overflow is the address of perf_event_overflow(), which is not exported to
+ * modules. Sampling events are rejected if it is 0.
+ */
+int  vpmu_perf_pmu_init(unsigned long overflow);
+void vpmu_perf_pmu_exit(void);
+
+#endif // PERF_PMU_H_
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>     // clock_gettime()
+#include <sys/stat.h> // stat()
+
+#include "vpmu-path-lib.h"
+#include "vpmu-control-lib.h"
+
+#define BENCH_MAX_ITERATIONS 100000
+
+typedef struct BenchStage {
+    const char *name;
+    int         iterations;
+    double *    samples; ///< Elapsed time of each iteration in micro-seconds
+    uint64_t    bytes;   ///< Bytes moved per iteration, zero if not applicable
+} BenchStage;
+
+static inline double time_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_stage_init(BenchStage *stage, const char *name, int iterations)
+{
+    stage->name       = name;
+    stage->iterations = iterations;
+    stage->samples    = (double *)calloc(iterations, sizeof(double));
+    stage->bytes      = 0;
+    if (stage->samples == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+}
+
+static void bench_stage_report(BenchStage *stage)
+{
+    int    i   = 0;
+    double sum = 0;
+
+    qsort(stage->samples, stage->iterations, sizeof(double), compare_double);
+    for (i = 0; i < stage->iterations; i++) sum += stage->samples[i];
+
+    double median = stage->samples[stage->iterations / 2];
+    printf("%-28s %8d %12.3f %12.3f %12.3f %12.3f",
+           stage->name,
+           stage->iterations,
+           stage->samples[0],
+           median,
+           sum / stage->iterations,
+           stage->samples[stage->iterations - 1]);
+    if (stage->bytes > 0 && median > 0) {
+        // Bytes per micro-second is equal to MB/s
+        printf(" %10.2f", (double)stage->bytes / median);
+    } else {
+        printf(" %10s", "-");
+    }
+    printf("\n");
+    free(stage->samples);
+    stage->samples = NULL;
+}
+
+static uint64_t file_size(const char *path)
+{
+    struct stat st;
+    if (path == NULL || stat(path, &st) != 0) return 0;
+    return (uint64_t)st.st_size;
+}
+
+static void bench_open_close(BenchStage *stage, const char *dev_path)
+{
+    int i = 0;
+
+    for (i = 0; i < stage->iterations; i++) {
+        double      start   = time_now_us();
+        VPMUHandler handler = vpmu_open(dev_path);
+        vpmu_close(handler);
+        stage->samples[i] = time_now_us() - start;
+    }
+}
+
+static void bench_hw_write(BenchStage *stage, VPMUHandler handler)
+{
+    int i = 0;
+
+    for (i = 0; i < stage->iterations; i++) {
+        double start = time_now_us();
+        HW_W(VPMU_MMAP_SET_TIMING_MODEL, handler.flag_model);
+        stage->samples[i] = time_now_us() - start;
+    }
+}
+
+static void bench_hw_read(BenchStage *stage, VPMUHandler handler)
+{
+    int                i     = 0;
+    volatile uintptr_t value = 0;
+
+    for (i = 0; i < stage->iterations; i++) {
+        double start      = time_now_us();
+        value             = HW_R(VPMU_MMAP_THREAD_SIZE);
+        stage->samples[i] = time_now_us() - start;
+    }
+    (void)value;
+}
+
+static void bench_parse(BenchStage *stage, const char *cmd)
+{
+    int i = 0;
+
+    for (i = 0; i < stage->iterations; i++) {
+        double      start  = time_now_us();
+        VPMUBinary *binary = parse_all_paths_args(cmd);
+        vpmu_update_library_list(binary);
+        stage->samples[i] = time_now_us() - start;
+        free_vpmu_binary(binary);
+    }
+}
+
+static void bench_load_and_send(BenchStage *stage, VPMUHandler handler, const char *cmd)
+{
+    int         i      = 0;
+    int         j      = 0;
+    VPMUBinary *binary = parse_all_paths_args(cmd);
+
+    vpmu_update_library_list(binary);
+    if (binary->path == NULL) {
+        ERR_MSG("Can't find '%s' for benchmarking", binary->argv[0]);
+        free_vpmu_binary(binary);
+        exit(4);
+    }
+    stage->bytes = file_size(binary->path);
+    for (j = 0; binary->libraries[j] != NULL; j++) {
+        stage->bytes += file_size(binary->libraries[j]);
+    }
+
+    for (i = 0; i < stage->iterations; i++) {
+        double start = time_now_us();
+        vpmu_load_and_send_libs(handler, binary);
+        vpmu_load_and_send(handler, binary->path, binary->script_path);
+        stage->samples[i] = time_now_us() - start;
+    }
+    // Do not leave the benchmark binary in the monitoring list of VPMU
+    if (binary->is_script) {
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->script_path);
+    } else {
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
+    }
+    free_vpmu_binary(binary);
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s [options] [COMMAND]\n"                                                    \
+    "Measure the overhead of each setup stage of the VPMU controller.\n"                 \
+    "COMMAND is the binary used for parsing and shipping stages (default: ls)\n"         \
+    "Options:\n"                                                                         \
+    "  --mem         Use /dev/mem instead of /dev/vpmu-device-0 for communication\n"     \
+    "  -n <N>        Number of iterations for each stage (default: 100)\n"               \
+    "  --[MODEL]     [MODEL] could be one of the following\n"                            \
+    "                    inst, cache, branch, pipeline, all_models\n"                    \
+    "  --help        Show this message\n"                                                \
+    "\n"                                                                                 \
+    "All times are reported in micro-seconds, throughput in MB/s (base on median).\n"    \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s -n 50 ls\n"
+
+    printf(HELP_MESG, self, self);
+}
+
+static int parse_options(VPMUHandler *handler, int *iterations, int argc, char **argv)
+{
+    int i = 0; // Declaring i here for C98
+
+    for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "-n")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            *iterations = atoi(argv[++i]);
+            continue;
+        }
+        // Return at first non -- argument
+        if (!startwith(argv[i], "--")) return i;
+        if (arg_is(argv[i], "--help")) {
+            print_help_message(argv[0]);
+            exit(0);
+        } else if (arg_is(argv[i], "--inst")) {
+            handler->flag_model |= VPMU_INSN_COUNT_SIM;
+        } else if (arg_is(argv[i], "--cache")) {
+            handler->flag_model |= VPMU_ICACHE_SIM | VPMU_DCACHE_SIM;
+        } else if (arg_is(argv[i], "--branch")) {
+            handler->flag_model |= VPMU_BRANCH_SIM;
+        } else if (arg_is(argv[i], "--pipeline")) {
+            handler->flag_model |= VPMU_PIPELINE_SIM;
+        } else if (arg_is(argv[i], "--all_models")) {
+            handler->flag_model |= VPMU_INSN_COUNT_SIM | VPMU_ICACHE_SIM | VPMU_DCACHE_SIM
+                                   | VPMU_BRANCH_SIM | VPMU_PIPELINE_SIM;
+        }
+    }
+    return i;
+}
+
+int main(int argc, char **argv)
+{
+    // Initialize handler with zeros
+    VPMUHandler handler = {};
+    // Default device
+    char dev_path[256] = "/dev/vpmu-device-0";
+    // Default command to be parsed and shipped
+    const char *cmd = "ls";
+    // Stages of benchmark
+    BenchStage stage = {};
+    // Declaring i here for C98
+    int i          = 0;
+    int iterations = 100;
+
+    for (i = 0; i < argc; i++) {
+        if (arg_is(argv[i], "--mem")) {
+            strcpy(dev_path, "/dev/mem");
+        }
+    }
+    handler.flag_model = 0;
+    int cmd_idx        = parse_options(&handler, &iterations, argc, argv);
+    if (cmd_idx < argc) cmd = argv[cmd_idx];
+    if (iterations <= 0 || iterations > BENCH_MAX_ITERATIONS) {
+        ERR_MSG("Number of iterations must be in 1..%d", BENCH_MAX_ITERATIONS);
+        exit(4);
+    }
+
+    printf("# vpmu-bench: device '%s', command '%s', %d iterations\n",
+           dev_path,
+           cmd,
+           iterations);
+    printf("%-28s %8s %12s %12s %12s %12s %10s\n",
+           "stage",
+           "iters",
+           "min(us)",
+           "median(us)",
+           "mean(us)",
+           "max(us)",
+           "MB/s");
+
+    bench_stage_init(&stage, "vpmu_open+vpmu_close", iterations);
+    bench_open_close(&stage, dev_path);
+    bench_stage_report(&stage);
+
+    {
+        // Keep the models configured by options while accessing the device
+        uint32_t flag_model = handler.flag_model;
+        handler             = vpmu_open(dev_path);
+        handler.flag_model  = flag_model;
+    }
+
+    bench_stage_init(&stage, "HW_W round-trip", iterations);
+    bench_hw_write(&stage, handler);
+    bench_stage_report(&stage);
+
+    bench_stage_init(&stage, "HW_R round-trip", iterations);
+    bench_hw_read(&stage, handler);
+    bench_stage_report(&stage);
+
+    bench_stage_init(&stage, "parse_args+library_list", iterations);
+    bench_parse(&stage, cmd);
+    bench_stage_report(&stage);
+
+    bench_stage_init(&stage, "vpmu_load_and_send", iterations);
+    bench_load_and_send(&stage, handler, cmd);
+    bench_stage_report(&stage);
+
+    vpmu_close(handler);
+    return 0;
+}
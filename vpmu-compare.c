@@ -0,0 +1,659 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> // INT_MAX
+#include <math.h>   // sqrt(), exp(), log(), lgamma()
+
+#include "vpmu-path-lib.h"
+#include "vpmu-control-lib.h"
+
+// A report is one line per value, runs of the same key are the repeated measurements:
+//   # vpmu-report 1
+//   # run  scope  counter  value
+//   0      total          cpu0_cycles  123456
+//   0      gauge          rob_occupancy  37
+//   0      func:memcpy    cycles       4567
+// The scope is "total" for the counter block, "gauge" for the gauges of the block
+// (VPMU_COUNTER_GAUGE, the value at the end of the run) and "func:NAME" for the
+// functions of --func-profile. The CSV of vpmu-perf -I --csv is read as one run, its
+// counters are summed and its gauge:NAME columns are averaged over the intervals.
+// Gauges are printed but never taken as regressions.
+#define REPORT_MAGIC         "# vpmu-report 1"
+#define REPORT_MAX_THRESHOLD 64
+#define DEFAULT_THRESHOLD    5.0  // Percent
+#define DEFAULT_ALPHA        0.05 // Significance level of the t-test
+
+typedef struct ReportRow {
+    char * scope;
+    char * counter;
+    int    side; ///< 0 for baseline, 1 for candidate
+    int    run;  ///< Unique over all the files of a side
+    double value;
+} ReportRow;
+
+typedef struct ReportSet {
+    ReportRow *rows;
+    size_t     num_rows;
+    size_t     max_rows;
+    int        num_runs[2]; ///< Runs loaded of each side
+} ReportSet;
+
+typedef struct Threshold {
+    const char *counter; ///< Matches counter or *_counter, NULL for the default
+    double      percent;
+} Threshold;
+
+typedef struct CompareConfig {
+    Threshold thresholds[REPORT_MAX_THRESHOLD];
+    int       num_thresholds;
+    double    default_threshold;
+    double    alpha;
+    double    min_value; ///< Ignore the keys with smaller means on both sides
+    bool      print_all;
+} CompareConfig;
+
+/* ================================================================ */
+static void add_row(ReportSet *set,
+                    const char *scope,
+                    const char *counter,
+                    int         side,
+                    int         run,
+                    double      value)
+{
+    ReportRow *row = NULL;
+
+    if (set->num_rows == set->max_rows) {
+        set->max_rows = (set->max_rows) ? set->max_rows * 2 : 1024;
+        set->rows = (ReportRow *)realloc(set->rows, set->max_rows * sizeof(*set->rows));
+        if (set->rows == NULL) {
+            ERR_MSG("Memory error");
+            exit(4);
+        }
+    }
+    row          = &set->rows[set->num_rows++];
+    row->scope   = strdup(scope);
+    row->counter = strdup(counter);
+    row->side    = side;
+    row->run     = run;
+    row->value   = value;
+}
+
+// Columns of vpmu-perf -I --csv which are not counters
+static bool is_derived_column(const char *name)
+{
+    const char *derived[] = {
+      "time_s", "sim_ns", "ipc", "icache_mpki", "dcache_mpki", "branch_miss_rate"};
+    int i = 0;
+
+    for (i = 0; i < sizeof(derived) / sizeof(derived[0]); i++) {
+        if (strcmp(name, derived[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Sum the intervals of each counter column and average the gauge columns as one run
+static void load_perf_csv(ReportSet *set, FILE *fp, char *header, int side)
+{
+    char   line[4096]                    = {};
+    char * names[VPMU_MAX_COUNTERS + 8]  = {};
+    double sums[VPMU_MAX_COUNTERS + 8]   = {};
+    int    counts[VPMU_MAX_COUNTERS + 8] = {};
+    char * token                         = NULL;
+    char * rest                          = NULL;
+    int    num                           = 0;
+    int    i                             = 0;
+
+    // strsep() keeps the empty fields, so the values stay in their columns
+    header[strcspn(header, "\r\n")] = '\0';
+    rest                            = header;
+    while ((token = strsep(&rest, ",")) && num < VPMU_MAX_COUNTERS + 8)
+        names[num++] = strdup(token);
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        rest                        = line;
+        for (i = 0; (token = strsep(&rest, ",")) && i < num; i++) {
+            if (token[0] == '\0') continue;
+            sums[i] += strtod(token, NULL);
+            counts[i]++;
+        }
+    }
+    for (i = 0; i < num; i++) {
+        if (startwith(names[i], "gauge:")) {
+            if (counts[i] > 0)
+                add_row(set,
+                        "gauge",
+                        names[i] + strlen("gauge:"),
+                        side,
+                        set->num_runs[side],
+                        sums[i] / counts[i]);
+        } else if (!is_derived_column(names[i])) {
+            add_row(set, "total", names[i], side, set->num_runs[side], sums[i]);
+        }
+        free(names[i]);
+    }
+    set->num_runs[side]++;
+}
+
+static void load_report(ReportSet *set, const char *path, int side)
+{
+    FILE * fp         = fopen(path, "r");
+    char   line[4096] = {};
+    char   scope[2048], counter[256];
+    int    run = 0, max_run = -1, line_number = 1;
+    double value = 0;
+
+    if (fp == NULL) {
+        ERR_MSG("Open '%s' failed", path);
+        exit(4);
+    }
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        ERR_MSG("'%s' is empty", path);
+        exit(4);
+    }
+    if (strncmp(line, "time_s,", 7) == 0) {
+        load_perf_csv(set, fp, line, side);
+        fclose(fp);
+        return;
+    }
+    if (strncmp(line, REPORT_MAGIC, strlen(REPORT_MAGIC)) != 0) {
+        ERR_MSG("'%s' is neither a VPMU report nor a CSV of vpmu-perf", path);
+        exit(4);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%d\t%2047[^\t]\t%255[^\t]\t%lf", &run, scope, counter, &value)
+              != 4
+            || run < 0) {
+            ERR_MSG("%s:%d: invalid line", path, line_number);
+            exit(4);
+        }
+        add_row(set, scope, counter, side, set->num_runs[side] + run, value);
+        if (run > max_run) max_run = run;
+    }
+    fclose(fp);
+    set->num_runs[side] += max_run + 1;
+}
+
+/* ================================================================ */
+static void write_report_header(FILE *fp)
+{
+    fprintf(fp, REPORT_MAGIC "\n# run\tscope\tcounter\tvalue\n");
+}
+
+// Append the counters of a run, and its functions if the profile is available. Both
+// cover this run only since each run starts with VPMU_MMAP_RESET.
+static void write_run(FILE *fp, int run, const VPMUCounterBlock *block, char *profile)
+{
+    VPMUProfileHeader *header = (VPMUProfileHeader *)profile;
+    const char *       strtab = NULL;
+    const char *       p      = NULL;
+    char               scope[2048];
+    uint32_t           i = 0, c = 0;
+
+    for (i = 0; i < block->num_counters; i++) {
+        fprintf(fp,
+                "%d\t%s\t%s\t%" PRIu64 "\n",
+                run,
+                (block->counters[i].flags & VPMU_COUNTER_GAUGE) ? "gauge" : "total",
+                block->counters[i].name,
+                block->counters[i].value);
+    }
+    if (header == NULL || header->strtab_size == 0) return;
+    strtab = profile + header->total_size - header->strtab_size;
+    p      = profile + sizeof(VPMUProfileHeader);
+    for (c = 0; c < header->num_counters; c++)
+        header->names[c][sizeof(header->names[c]) - 1] = '\0';
+    for (i = 0; i < header->num_functions; i++) {
+        const VPMUProfileFunction *f = (const VPMUProfileFunction *)p;
+
+        if (p + VPMU_PROFILE_FUNCTION_SIZE(header->num_counters) > strtab) break;
+        if (f->name < header->strtab_size && strtab[f->name] != '\0')
+            snprintf(scope, sizeof(scope), "func:%s", strtab + f->name);
+        else
+            snprintf(scope, sizeof(scope), "func:0x%" PRIx64, f->addr);
+        for (c = 0; c < header->num_counters; c++) {
+            fprintf(fp,
+                    "%d\t%s\t%s\t%" PRIu64 "\n",
+                    run,
+                    scope,
+                    header->names[c],
+                    f->values[c]);
+        }
+        p += VPMU_PROFILE_FUNCTION_SIZE(header->num_counters);
+    }
+}
+
+// Run the command runs times under VPMU, each run is reset and read on its own
+static void run_command(VPMUHandler handler,
+                        int         runs,
+                        const char *out_path,
+                        int         argc,
+                        char **     argv)
+{
+    VPMUCounterBlock *block   = (VPMUCounterBlock *)calloc(1, VPMU_COUNTER_BLOCK_SIZE);
+    VPMUBinary *      binary  = parse_all_paths_args(argv[0]);
+    FILE *            fp      = fopen(out_path, "w");
+    char *            profile = NULL;
+    int               i       = 0;
+
+    if (block == NULL || binary == NULL) {
+        ERR_MSG("Memory error or command '%s' not found", argv[0]);
+        exit(4);
+    }
+    if (fp == NULL) {
+        ERR_MSG("Open '%s' failed", out_path);
+        exit(4);
+    }
+    binary->argc = argc;
+    for (i = 1; i < argc; i++) binary->argv[i] = argv[i];
+    vpmu_update_library_list(binary);
+
+    write_report_header(fp);
+    for (i = 0; i < runs; i++) {
+        LOG_MSG("Run %d of %d", i + 1, runs);
+        if (handler.flag_trace) {
+            // Count the process only, it resets the counters before running
+            vpmu_profile_binary(handler, binary);
+        } else {
+            vpmu_reset_counters(handler);
+            vpmu_start_fullsystem_tracing(handler);
+            vpmu_execute_binary(binary);
+            vpmu_end_fullsystem_tracing(handler);
+        }
+        if (vpmu_read_counters(handler, block) < 0) {
+            ERR_MSG("Read counters failed, VPMU or the driver might not support it");
+            exit(4);
+        }
+        if (handler.flag_model & VPMU_FUNC_PROFILE) profile = vpmu_read_profile(handler);
+        write_run(fp, i, block, profile);
+        free(profile);
+        profile = NULL;
+    }
+    fclose(fp);
+    free(block);
+    free_vpmu_binary(binary);
+    LOG_MSG("%d runs written to '%s'", runs, out_path);
+}
+
+/* ================================================================ */
+// Continued fraction of the incomplete beta function (modified Lentz's method)
+static double beta_fraction(double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double       c = 1, d = 1 - (a + b) * x / (a + 1), h = 0, delta = 0, num = 0;
+    int          m = 0;
+
+    if (fabs(d) < tiny) d = tiny;
+    d = 1 / d;
+    h = d;
+    for (m = 1; m <= 200; m++) {
+        num = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d   = 1 + num * d;
+        c   = 1 + num / c;
+        d   = 1 / ((fabs(d) < tiny) ? tiny : d);
+        c   = (fabs(c) < tiny) ? tiny : c;
+        h *= d * c;
+        num   = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d     = 1 + num * d;
+        c     = 1 + num / c;
+        d     = 1 / ((fabs(d) < tiny) ? tiny : d);
+        c     = (fabs(c) < tiny) ? tiny : c;
+        delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1) < 1e-12) break;
+    }
+    return h;
+}
+
+// The regularized incomplete beta function I_x(a, b)
+static double incomplete_beta(double a, double b, double x)
+{
+    double front = 0;
+
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2)) return front * beta_fraction(a, b, x) / a;
+    return 1 - front * beta_fraction(b, a, 1 - x) / b;
+}
+
+static void mean_variance(const double *v, int n, double *mean, double *var)
+{
+    int i = 0;
+
+    *mean = 0;
+    *var  = 0;
+    for (i = 0; i < n; i++) *mean += v[i] / n;
+    for (i = 0; i < n && n > 1; i++) *var += (v[i] - *mean) * (v[i] - *mean) / (n - 1);
+}
+
+// One-sided p-value of Welch's t-test for the mean of y being greater than that of x
+static double welch_p_value(const double *x, int nx, const double *y, int ny)
+{
+    double mx = 0, vx = 0, my = 0, vy = 0;
+    double se2 = 0, t = 0, df = 0, tail = 0;
+
+    mean_variance(x, nx, &mx, &vx);
+    mean_variance(y, ny, &my, &vy);
+    se2 = vx / nx + vy / ny;
+    if (se2 == 0) return (my > mx) ? 0 : 1;
+    t  = (my - mx) / sqrt(se2);
+    df = se2 * se2
+         / ((vx / nx) * (vx / nx) / (nx - 1) + (vy / ny) * (vy / ny) / (ny - 1));
+    // P(T > |t|) of Student's t distribution with df degrees of freedom
+    tail = 0.5 * incomplete_beta(df / 2, 0.5, df / (df + t * t));
+    return (t > 0) ? tail : 1 - tail;
+}
+
+/* ================================================================ */
+// The counter block first, then its gauges, then the functions
+static int scope_rank(const char *scope)
+{
+    if (strcmp(scope, "total") == 0) return 0;
+    if (strcmp(scope, "gauge") == 0) return 1;
+    return 2;
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+    const ReportRow *ra = (const ReportRow *)a;
+    const ReportRow *rb = (const ReportRow *)b;
+    int              r  = 0;
+
+    r = scope_rank(ra->scope) - scope_rank(rb->scope);
+    if (r == 0) r = strcmp(ra->scope, rb->scope);
+    if (r == 0) r = strcmp(ra->counter, rb->counter);
+    if (r == 0) r = ra->side - rb->side;
+    if (r == 0) r = ra->run - rb->run;
+    return r;
+}
+
+static double find_threshold(const CompareConfig *cfg, const char *counter)
+{
+    size_t len = strlen(counter);
+    int    i   = 0;
+
+    for (i = 0; i < cfg->num_thresholds; i++) {
+        const char *name = cfg->thresholds[i].counter;
+        size_t      n    = strlen(name);
+
+        if (strcmp(counter, name) == 0) return cfg->thresholds[i].percent;
+        // e.g. dcache_misses matches cpu0_dcache_misses
+        if (len > n && counter[len - n - 1] == '_'
+            && strcmp(&counter[len - n], name) == 0)
+            return cfg->thresholds[i].percent;
+    }
+    return cfg->default_threshold;
+}
+
+// Print the keys of both sides, return the number of regressions
+static int compare_reports(ReportSet *set, const CompareConfig *cfg)
+{
+    double *values[2]   = {};
+    int     n[2]        = {}, found[2] = {};
+    int     regressions = 0, compared = 0, side = 0;
+    size_t  i = 0, j = 0;
+
+    values[0] = (double *)malloc((set->num_runs[0] + 1) * sizeof(double));
+    values[1] = (double *)malloc((set->num_runs[1] + 1) * sizeof(double));
+    if (values[0] == NULL || values[1] == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    qsort(set->rows, set->num_rows, sizeof(ReportRow), compare_rows);
+    printf("#%-31s %-24s %14s %14s %9s %8s\n",
+           "scope",
+           "counter",
+           "baseline",
+           "candidate",
+           "change",
+           "p-value");
+    for (i = 0; i < set->num_rows; i = j) {
+        const ReportRow *key = &set->rows[i];
+        double           mean[2] = {}, var = 0, change = 0, p = NAN, threshold = 0;
+        bool             regressed = false;
+        bool             gauge     = (strcmp(key->scope, "gauge") == 0);
+
+        n[0] = n[1] = 0;
+        // Gather the rows of the key, values of the same run (e.g. functions of the same
+        // name in two binaries) are added up
+        for (j = i; j < set->num_rows && strcmp(set->rows[j].scope, key->scope) == 0
+                    && strcmp(set->rows[j].counter, key->counter) == 0;
+             j++) {
+            const ReportRow *row = &set->rows[j];
+
+            if (j > i && row->side == set->rows[j - 1].side
+                && row->run == set->rows[j - 1].run)
+                values[row->side][n[row->side] - 1] += row->value;
+            else
+                values[row->side][n[row->side]++] = row->value;
+        }
+        // A counter missing from a run is 0 in that run, e.g. a function not called, and
+        // a key of one side only is 0 on the other side, e.g. a new function. A gauge is
+        // a level, its missing runs are not taken into account.
+        for (side = 0; side < 2; side++) {
+            found[side] = n[side];
+            while (!gauge && n[side] < set->num_runs[side]) values[side][n[side]++] = 0;
+        }
+        if (n[0] > 0) mean_variance(values[0], n[0], &mean[0], &var);
+        if (n[1] > 0) mean_variance(values[1], n[1], &mean[1], &var);
+        if (mean[0] < cfg->min_value && mean[1] < cfg->min_value) continue;
+
+        compared++;
+        threshold = find_threshold(cfg, key->counter);
+        if (mean[0] > 0)
+            change = (mean[1] - mean[0]) / mean[0] * 100;
+        else
+            change = (mean[1] > 0) ? INFINITY : 0; // Any growth from 0 exceeds it
+        if (n[0] > 1 && n[1] > 1) p = welch_p_value(values[0], n[0], values[1], n[1]);
+        // Significant only if the runs tell so, a single run is taken as it is. A gauge
+        // can go either way, only the counters regress by increasing.
+        regressed = !gauge && change > threshold && (isnan(p) || p < cfg->alpha);
+        if (regressed) regressions++;
+        if (!cfg->print_all && !regressed && fabs(change) <= threshold
+            && scope_rank(key->scope) > 1 && found[0] > 0 && found[1] > 0)
+            continue;
+        printf("%-32s %-24s ", key->scope, key->counter);
+        for (side = 0; side < 2; side++) {
+            if (found[side] > 0)
+                printf("%14.0f ", mean[side]);
+            else
+                printf("%14s ", "-");
+        }
+        printf("%+8.2f%% ", change);
+        if (isnan(p))
+            printf("%8s", "-");
+        else
+            printf("%8.4f", p);
+        if (regressed)
+            printf("  \033[1;31mREGRESSION\033[0;00m (> %g%%)", threshold);
+        else if (!gauge && change < -threshold && found[1] > 0)
+            printf("  \033[1;32mimproved\033[0;00m");
+        if (found[0] == 0)
+            printf("  (candidate only)");
+        else if (found[1] == 0)
+            printf("  (baseline only)");
+        printf("\n");
+    }
+    LOG_MSG("%d runs vs %d runs, %d counters compared, %d regressions",
+            set->num_runs[0],
+            set->num_runs[1],
+            compared,
+            regressions);
+    free(values[0]);
+    free(values[1]);
+    return regressions;
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s [options] -b BASELINE... CANDIDATE...\n"                                  \
+    "       %s [options] --run <N> -o <REPORT> [-b BASELINE...] COMMAND [ARGS]\n"        \
+    "Compare the counters of reports and exit with 1 if any counter regressed.\n"        \
+    "Reports are files of this tool or CSV files of vpmu-perf -I --csv.\n"               \
+    "Options:\n"                                                                         \
+    "  -b <FILE>     A report of the baseline, repeat it for more runs\n"                \
+    "  -t <PCT>      Flag an increase above PCT percent (default: 5)\n"                  \
+    "  -t <COUNTER>=<PCT>\n"                                                             \
+    "                Threshold of COUNTER (or *_COUNTER), e.g. -t dcache_misses=10\n"    \
+    "  --alpha <P>   Significance level of Welch's t-test when both sides have more\n"   \
+    "                than one run (default: 0.05)\n"                                     \
+    "  --min <N>     Skip the counters whose means are below N on both sides\n"          \
+    "  --all         Print every counter, not only the totals and the changes\n"         \
+    "  --run <N>     Run the command N times under VPMU and write the report. Compare\n" \
+    "                it with the baseline if -b is given\n"                              \
+    "  -o <FILE>     Report of --run (default: vpmu-report.tsv)\n"                       \
+    "  --[MODEL]     Models of --run: inst, cache, branch, pipeline, all_models\n"       \
+    "  --trace       Count the process only in --run\n"                                  \
+    "  --func-profile <DEPTH>\n"                                                         \
+    "                Compare the functions as well in --run, --trace will be forced\n"   \
+    "  --session <N> Use the N-th independent VPMU session (/dev/vpmu-device-N)\n"       \
+    "  --help        Show this message\n"                                                \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s --all_models --run 5 -o nightly.tsv ./workload\n"                            \
+    "    %s -b last.tsv -t 3 -t dcache_misses=10 nightly.tsv\n"
+
+    printf(HELP_MESG, self, self, self, self);
+}
+
+// Parse the number argument of option, exit if it is not in min..max
+static double
+parse_double_arg(const char *option, const char *str, double min, double max)
+{
+    char * end   = NULL;
+    double value = strtod(str, &end);
+
+    if (end == str || *end != '\0' || isnan(value) || value < min || value > max) {
+        ERR_MSG("%s takes %g..%g, not '%s'", option, min, max, str);
+        exit(4);
+    }
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    VPMUHandler   handler        = {};
+    CompareConfig cfg            = {};
+    ReportSet     set            = {};
+    char          dev_path[256]  = {};
+    const char *  out_path       = "vpmu-report.tsv";
+    const char *  baselines[256] = {};
+    int           num_baselines  = 0;
+    uint32_t      flag_model     = 0;
+    bool          flag_trace     = false;
+    int           runs           = 0;
+    int           session        = 0;
+    uint32_t      depth          = 0;
+    char *        eq             = NULL;
+    // Declaring i here for C98
+    int i = 0;
+
+    cfg.default_threshold = DEFAULT_THRESHOLD;
+    cfg.alpha             = DEFAULT_ALPHA;
+    for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "--help")) {
+            print_help_message(argv[0]);
+            exit(0);
+        } else if (arg_is(argv[i], "-b")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            if (num_baselines == 256) {
+                ERR_MSG("Too many baselines");
+                exit(4);
+            }
+            baselines[num_baselines++] = argv[++i];
+        } else if (arg_is(argv[i], "-t")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            eq = strchr(argv[++i], '=');
+            if (eq == NULL) {
+                cfg.default_threshold = parse_double_arg("-t", argv[i], 0, INFINITY);
+                continue;
+            }
+            if (eq == argv[i]) {
+                ERR_MSG("No counter in '-t %s'", argv[i]);
+                exit(4);
+            }
+            if (cfg.num_thresholds == REPORT_MAX_THRESHOLD) {
+                ERR_MSG("Too many thresholds of -t, at most %d", REPORT_MAX_THRESHOLD);
+                exit(4);
+            }
+            *eq                                        = '\0';
+            cfg.thresholds[cfg.num_thresholds].counter = argv[i];
+            cfg.thresholds[cfg.num_thresholds++].percent =
+              parse_double_arg("-t", eq + 1, 0, INFINITY);
+        } else if (arg_is(argv[i], "--alpha")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.alpha = parse_double_arg("--alpha", argv[++i], 0, 1);
+            if (cfg.alpha == 0) {
+                ERR_MSG("--alpha must be greater than 0");
+                exit(4);
+            }
+        } else if (arg_is(argv[i], "--min")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.min_value = parse_double_arg("--min", argv[++i], 0, INFINITY);
+        } else if (arg_is(argv[i], "--all")) {
+            cfg.print_all = true;
+        } else if (arg_is(argv[i], "--run")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            runs = parse_long_arg("--run", argv[++i], 1, INT_MAX);
+        } else if (arg_is(argv[i], "-o")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            out_path = argv[++i];
+        } else if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            session =
+              parse_long_arg("--session", argv[++i], 0, VPMU_DEVICE_MAX_SESSIONS - 1);
+        } else if (arg_is(argv[i], "--trace")) {
+            flag_trace = true;
+            flag_model |= VPMU_EVENT_TRACE;
+        } else if (arg_is(argv[i], "--func-profile")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            depth =
+              parse_long_arg("--func-profile", argv[++i], 0, VPMU_MAX_PROFILE_DEPTH);
+            flag_trace = true;
+            flag_model |= VPMU_EVENT_TRACE | VPMU_FUNC_PROFILE;
+        } else if (arg_is(argv[i], "--inst")) {
+            flag_model |= VPMU_INSN_COUNT_SIM;
+        } else if (arg_is(argv[i], "--cache")) {
+            flag_model |= VPMU_ICACHE_SIM | VPMU_DCACHE_SIM;
+        } else if (arg_is(argv[i], "--branch")) {
+            flag_model |= VPMU_BRANCH_SIM;
+        } else if (arg_is(argv[i], "--pipeline")) {
+            flag_model |= VPMU_PIPELINE_SIM;
+        } else if (arg_is(argv[i], "--all_models")) {
+            flag_model |= VPMU_INSN_COUNT_SIM | VPMU_ICACHE_SIM | VPMU_DCACHE_SIM
+                                  | VPMU_BRANCH_SIM | VPMU_PIPELINE_SIM;
+        } else if (startwith(argv[i], "-")) {
+            ERR_MSG("Unknown option '%s'", argv[i]);
+            exit(4);
+        } else {
+            break; // Reports to compare, or the command of --run
+        }
+    }
+
+    if (runs > 0) {
+        if (i == argc) {
+            ERR_MSG("No command specified!");
+            exit(4);
+        }
+        snprintf(dev_path, sizeof(dev_path), "/dev/vpmu-device-%d", session);
+        handler               = vpmu_open_session(dev_path, session);
+        handler.flag_model    = flag_model;
+        handler.flag_trace    = flag_trace;
+        handler.profile_depth = depth;
+        run_command(handler, runs, out_path, argc - i, &argv[i]);
+        vpmu_close(handler);
+        if (num_baselines == 0) return 0;
+        load_report(&set, out_path, 1);
+    } else {
+        if (num_baselines == 0 || i == argc) {
+            ERR_MSG("Give the baseline with -b and at least one candidate report");
+            exit(4);
+        }
+        for (; i < argc; i++) load_report(&set, argv[i], 1);
+    }
+    for (i = 0; i < num_baselines; i++) load_report(&set, baselines[i], 0);
+
+    return (compare_reports(&set, &cfg) > 0) ? 1 : 0;
+}
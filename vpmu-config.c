@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>   // strcmp(), strchr()
+#include <strings.h>  // strcasecmp()
+#include <ctype.h>    // isspace(), toupper()
+#include <stddef.h>   // offsetof()
+#include <inttypes.h> // PRIu32
+
+#include "vpmu-control-lib.h" // ERR_MSG(), LOG_MSG()
+#include "vpmu-config.h"      // Main header
+
+typedef struct VPMUConfigKey {
+    const char *name;
+    size_t      offset;  // Offset of the uint32_t field in VPMUModelConfig
+    bool        is_size; // Takes K, M and G suffixes
+} VPMUConfigKey;
+
+#define VPMU_CACHE_KEYS(_prefix, _index)                                                 \
+    {_prefix ".size", offsetof(VPMUModelConfig, caches[_index].size), true},             \
+      {_prefix ".ways", offsetof(VPMUModelConfig, caches[_index].ways), false},          \
+      {_prefix ".line", offsetof(VPMUModelConfig, caches[_index].line_size), true},      \
+      {_prefix ".latency", offsetof(VPMUModelConfig, caches[_index].latency), false}
+
+static const VPMUConfigKey config_keys[] = {
+  VPMU_CACHE_KEYS("l1i", VPMU_CACHE_L1I),
+  VPMU_CACHE_KEYS("l1d", VPMU_CACHE_L1D),
+  VPMU_CACHE_KEYS("l2", VPMU_CACHE_L2),
+  VPMU_CACHE_KEYS("l3", VPMU_CACHE_L3),
+  {"cache.levels", offsetof(VPMUModelConfig, cache_levels), false},
+  {"predictor.entries", offsetof(VPMUModelConfig, predictor_entries), true},
+  {"predictor.history", offsetof(VPMUModelConfig, predictor_history), false},
+  {"btb.entries", offsetof(VPMUModelConfig, btb_entries), true},
+  {"pipeline.fetch_width", offsetof(VPMUModelConfig, fetch_width), false},
+  {"pipeline.issue_width", offsetof(VPMUModelConfig, issue_width), false},
+  {"pipeline.commit_width", offsetof(VPMUModelConfig, commit_width), false},
+  {"pipeline.rob_entries", offsetof(VPMUModelConfig, rob_entries), false},
+  {"pipeline.mispredict_penalty", offsetof(VPMUModelConfig, mispredict_penalty), false},
+  {"cpu.frequency_mhz", offsetof(VPMUModelConfig, frequency_mhz), false},
+};
+
+// Names of VPMU_PREDICTOR_xxx, indexed by the type
+static const char *predictor_names[] = {
+  "default", "static", "bimodal", "gshare", "tournament",
+};
+
+static char *trim(char *str)
+{
+    char *end = NULL;
+
+    while (isspace((unsigned char)*str)) str++;
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) *--end = '\0';
+    return str;
+}
+
+// Parse a number with an optional K, M or G suffix if is_size is set
+static bool parse_value(const char *str, bool is_size, uint32_t *out)
+{
+    char *             end   = NULL;
+    unsigned long long value = strtoull(str, &end, 0);
+
+    if (end == str) return false;
+    if (is_size && *end != '\0') {
+        switch (toupper((unsigned char)*end)) {
+        case 'G':
+            value <<= 10; // Fall through
+        case 'M':
+            value <<= 10; // Fall through
+        case 'K':
+            value <<= 10;
+            end++;
+            break;
+        default:
+            return false;
+        }
+        if (toupper((unsigned char)*end) == 'B') end++;
+    }
+    if (*end != '\0' || value > UINT32_MAX) return false;
+    *out = (uint32_t)value;
+    return true;
+}
+
+static bool parse_line(char *key, char *value, VPMUModelConfig *config)
+{
+    int i = 0;
+
+    if (strcmp(key, "predictor") == 0) {
+        for (i = 0; i < sizeof(predictor_names) / sizeof(predictor_names[0]); i++) {
+            if (strcasecmp(value, predictor_names[i]) == 0) {
+                config->predictor = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    for (i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+        if (strcmp(key, config_keys[i].name) == 0)
+            return parse_value(value,
+                               config_keys[i].is_size,
+                               (uint32_t *)((char *)config + config_keys[i].offset));
+    }
+    return false;
+}
+
+bool vpmu_parse_model_config(const char *path, VPMUModelConfig *config)
+{
+    FILE *fp          = fopen(path, "r");
+    char  line[256]   = {};
+    char *key         = NULL;
+    char *value       = NULL;
+    int   line_number = 0;
+
+    if (fp == NULL) {
+        ERR_MSG("Cannot open model configuration '%s'", path);
+        return false;
+    }
+    memset(config, 0, sizeof(VPMUModelConfig));
+    config->magic   = VPMU_MODEL_CONFIG_MAGIC;
+    config->version = VPMU_MODEL_CONFIG_VERSION;
+    config->size    = sizeof(VPMUModelConfig);
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_number++;
+        if (strchr(line, '#')) *strchr(line, '#') = '\0';
+        key = trim(line);
+        if (*key == '\0') continue;
+        value = strchr(key, '=');
+        if (value) {
+            *value++ = '\0';
+            key      = trim(key);
+            value    = trim(value);
+        }
+        if (value == NULL || !parse_line(key, value, config)) {
+            ERR_MSG("%s:%d: invalid setting '%s'", path, line_number, key);
+            fclose(fp);
+            return false;
+        }
+    }
+    fclose(fp);
+    if (config->cache_levels > 3) {
+        ERR_MSG("%s: cache.levels must be 1 to 3", path);
+        return false;
+    }
+    return true;
+}
+
+// Print the settings which are not 0
+void vpmu_print_model_config(const VPMUModelConfig *config)
+{
+    const uint32_t *field = NULL;
+    int             i     = 0;
+
+    if (config->predictor < sizeof(predictor_names) / sizeof(predictor_names[0])
+        && config->predictor != VPMU_PREDICTOR_DEFAULT)
+        LOG_MSG("  %-28s %s", "predictor", predictor_names[config->predictor]);
+    for (i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+        field = (const uint32_t *)((const char *)config + config_keys[i].offset);
+        if (*field) LOG_MSG("  %-28s %" PRIu32, config_keys[i].name, *field);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef __VPMU_CONFIG_H_
+#define __VPMU_CONFIG_H_
+#pragma once
+
+#include <stdbool.h> // bool
+
+#include "vpmu-object.h" // VPMUModelConfig
+
+// Parse a file of "key = value" lines into config, e.g.
+//   # Comments start with '#'
+//   l1d.size = 32K
+//   l1d.ways = 8
+//   predictor = gshare
+//   pipeline.issue_width = 2
+// Sizes take K, M and G suffixes. Keys not in the file are left 0, which keeps the
+// current value of VPMU. Return false and print the line on errors.
+bool vpmu_parse_model_config(const char *path, VPMUModelConfig *config);
+void vpmu_print_model_config(const VPMUModelConfig *config);
+
+#endif
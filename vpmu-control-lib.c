@@ -1,15 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>   // access()
-#include <ctype.h>    // isspace()
-#include <sys/mman.h> // mmap(), MAP_SHARED
-#include <sys/wait.h> // waitpid()
-#include <fcntl.h>    // open(), close()
-#include <libgen.h>   // basename(), dirname()
+#include <unistd.h>     // access(), sysconf()
+#include <ctype.h>      // isspace()
+#include <sys/mman.h>   // mmap(), MAP_SHARED
+#include <sys/ioctl.h>  // ioctl()
+#include <sys/wait.h>   // waitpid()
+#include <sys/ptrace.h> // ptrace()
+#include <signal.h>     // raise(), kill()
+#include <fcntl.h>      // open(), close()
+#include <libgen.h>     // basename(), dirname()
+#include <poll.h>       // poll()
+#include <errno.h>      // errno
+#include <math.h>       // sqrt(), ceil()
 
 #include "vpmu-control-lib.h" // Main headers
 #include "vpmu-path-lib.h"    // Helpers functions to parse string like shell
 #include "vpmu-elf.h"         // Helpers functions for ELF formats
+#include "vpmu-forkserver.h"  // Protocol of fork server
 
 size_t load_binary(const char *file_path, char **out_buffer)
 {
@@ -50,14 +57,44 @@ bool arg_is_2(const char *args, const char *str1, const char *str2)
     return (strcmp(args, str1) == 0) || (strcmp(args, str2) == 0);
 }
 
+void check_arg_and_exit(int argc, char **argv, int cur_idx, int req_num)
+{
+    if ((cur_idx + req_num) >= argc) {
+        ERR_MSG("# of argument is not enough!");
+        ERR_MSG("This is happened due to %dth argument, '%s'.", cur_idx, argv[cur_idx]);
+        exit(4);
+    }
+}
+
+// Parse the decimal integer argument of option, exit if it is not in min..max
+long parse_long_arg(const char *option, const char *str, long min, long max)
+{
+    char *end   = NULL;
+    long  value = 0;
+
+    errno = 0;
+    value = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || errno != 0 || value < min || value > max) {
+        ERR_MSG("%s takes %ld..%ld, not '%s'", option, min, max, str);
+        exit(4);
+    }
+    return value;
+}
+
 VPMUHandler vpmu_open(const char *dev_path)
+{
+    return vpmu_open_session(dev_path, 0);
+}
+
+// The session only matters to /dev/mem, vpmu-device-N is already the N-th session
+VPMUHandler vpmu_open_session(const char *dev_path, int session)
 {
     VPMUHandler handler = {}; // Zero initialized
-    // Set the offset to VPMU_DEVICE_BASE_ADDR if it is mem
-    off_t offset = startwith(dev_path, "/dev/mem") ? VPMU_DEVICE_BASE_ADDR : 0;
+    // Set the offset to the register window of session if it is mem
+    off_t offset = startwith(dev_path, "/dev/mem") ? VPMU_DEVICE_WINDOW_ADDR(session) : 0;
 
 #ifdef DRY_RUN
-    handler.ptr = (uintptr_t *)malloc(1024);
+    handler.ptr = vpmu_model_open(session);
     (void)offset; // For unused warning
 #else
     handler.fd = open(dev_path, O_RDWR | O_SYNC);
@@ -65,9 +102,16 @@ VPMUHandler vpmu_open(const char *dev_path)
         ERR_MSG("Open '%s' failed", dev_path);
         exit(4);
     }
+    // Older drivers and /dev/mem do not support ioctl, version remains zero
+    if (offset == 0
+        && ioctl(handler.fd, VPMU_IOCTL_GET_VERSION, &handler.ioctl_version) != 0)
+        handler.ioctl_version = 0;
+    DBG_MSG("%-30sioctl version %u\n", "[vpmu_open]", handler.ioctl_version);
+    // The driver writes the registers for us and maps them read-only
     handler.ptr = (uintptr_t *)mmap(NULL,
                                     VPMU_DEVICE_IOMEM_SIZE,
-                                    PROT_READ | PROT_WRITE,
+                                    (handler.ioctl_version) ? PROT_READ
+                                                            : PROT_READ | PROT_WRITE,
                                     MAP_SHARED,
                                     handler.fd,
                                     offset);
@@ -83,7 +127,7 @@ VPMUHandler vpmu_open(const char *dev_path)
 void vpmu_close(VPMUHandler handler)
 {
 #ifdef DRY_RUN
-    free(handler.ptr);
+    vpmu_model_close(handler.ptr);
 #else
     munmap(handler.ptr, VPMU_DEVICE_IOMEM_SIZE);
     close(handler.fd);
@@ -102,29 +146,516 @@ void vpmu_write_value(VPMUHandler handler, uintptr_t index, uintptr_t value)
     HW_W(index, value);
 }
 
+#ifndef DRY_RUN
+// Write a register by the driver, which checks the value, or directly on /dev/mem
+void vpmu_hw_write(VPMUHandler handler, uintptr_t index, uintptr_t value)
+{
+    VPMUCommand cmd = {VPMU_CMD_WRITE, {index, value}};
+
+    if (handler.ioctl_version == 0)
+        handler.ptr[index / sizeof(uintptr_t)] = value;
+    else if (vpmu_submit_commands(handler, &cmd, 1) != 1)
+        ERR_MSG("Write 0x%" PRIxPTR " to register 0x%" PRIxPTR " failed", value, index);
+}
+#endif
+
+// Write the registers of VPMU_CMD_WRITE commands back-to-back in one batch
+static void vpmu_write_registers(VPMUHandler handler, VPMUCommand *cmds, uint32_t num)
+{
+    uint32_t i = 0;
+
+    if (handler.ioctl_version == 0) {
+        for (i = 0; i < num; i++) HW_W(cmds[i].arg[0], cmds[i].arg[1]);
+    } else if (vpmu_submit_commands(handler, cmds, num) != (int)num) {
+        ERR_MSG("Write the registers of VPMU failed");
+    }
+}
+
+// Pass the name of processes to VPMU_MMAP_ADD_PROC_NAME or VPMU_MMAP_REMOVE_PROC_NAME,
+// the driver passes its own copy of the name
+void vpmu_write_name(VPMUHandler handler, uintptr_t index, const char *name)
+{
+    VPMUCommand cmd = {VPMU_CMD_WRITE_NAME, {index, (uint64_t)(uintptr_t)name}};
+
+    if (handler.ioctl_version == 0)
+        HW_W(index, name);
+    else if (vpmu_submit_commands(handler, &cmd, 1) != 1)
+        ERR_MSG("Pass the name '%s' to VPMU failed", name);
+}
+
 void vpmu_print_report(VPMUHandler handler)
 {
     DRY_MSG("--report\n");
     HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
+    if (handler.flag_model & VPMU_SAMPLED_SIM) vpmu_print_sampled_report(handler);
+}
+
+// Fill the writes of the model parameters kept in the handler, return their number.
+// cmds must have room for VPMU_MODEL_CMDS commands.
+#define VPMU_MODEL_CMDS 4
+static uint32_t vpmu_model_commands(VPMUHandler handler, VPMUCommand *cmds)
+{
+    uint32_t n = 0;
+
+    if (handler.flag_model & VPMU_SAMPLED_SIM) {
+        DRY_MSG("sampling %" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n",
+                handler.sample_fast_forward,
+                handler.sample_warmup,
+                handler.sample_detailed);
+        cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE,
+                                  {VPMU_MMAP_SAMPLE_FAST_FORWARD,
+                                   handler.sample_fast_forward}};
+        cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE,
+                                  {VPMU_MMAP_SAMPLE_WARMUP, handler.sample_warmup}};
+        cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE,
+                                  {VPMU_MMAP_SAMPLE_DETAILED, handler.sample_detailed}};
+    }
+    if (handler.flag_model & VPMU_FUNC_PROFILE)
+        cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE,
+                                  {VPMU_MMAP_PROFILE_DEPTH, handler.profile_depth}};
+    return n;
 }
 
 void vpmu_start_fullsystem_tracing(VPMUHandler handler)
 {
+    VPMUCommand cmds[VPMU_MODEL_CMDS + 1] = {};
+    uint32_t    n                         = 0;
+
     DRY_MSG("--start\n");
-    HW_W(VPMU_MMAP_ENABLE, handler.flag_model);
+    // The models are programmed before VPMU starts
+    n         = vpmu_model_commands(handler, cmds);
+    cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE, {VPMU_MMAP_ENABLE, handler.flag_model}};
+    vpmu_write_registers(handler, cmds, n);
 }
 
 void vpmu_end_fullsystem_tracing(VPMUHandler handler)
 {
+    VPMUCommand cmds[] = {{VPMU_CMD_WRITE, {VPMU_MMAP_DISABLE, VPMU_DONT_CARE}},
+                          {VPMU_CMD_WRITE, {VPMU_MMAP_REPORT, VPMU_DONT_CARE}}};
+
     DRY_MSG("--end\n");
-    HW_W(VPMU_MMAP_DISABLE, VPMU_DONT_CARE);
-    HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
+    vpmu_write_registers(handler, cmds, 2);
+    if (handler.flag_model & VPMU_SAMPLED_SIM) vpmu_print_sampled_report(handler);
 }
 
 void vpmu_reset_counters(VPMUHandler handler)
 {
-    HW_W(VPMU_MMAP_SET_TIMING_MODEL, handler.flag_model);
-    HW_W(VPMU_MMAP_RESET, VPMU_DONT_CARE);
+    VPMUCommand cmds[VPMU_MODEL_CMDS + 2] = {};
+    uint32_t    n                         = vpmu_model_commands(handler, cmds);
+
+    cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE,
+                              {VPMU_MMAP_SET_TIMING_MODEL, handler.flag_model}};
+    cmds[n++] = (VPMUCommand){VPMU_CMD_WRITE, {VPMU_MMAP_RESET, VPMU_DONT_CARE}};
+    vpmu_write_registers(handler, cmds, n);
+}
+
+// Return the number of commands completed, or -1 if the ioctl fails
+int vpmu_submit_commands(VPMUHandler handler, VPMUCommand *cmds, uint32_t num_cmds)
+{
+    VPMUCommandBatch batch = {};
+
+    if (handler.ioctl_version == 0) return -1;
+    batch.version  = VPMU_IOCTL_VERSION;
+    batch.num_cmds = num_cmds;
+    batch.cmds     = (uint64_t)(uintptr_t)cmds;
+    if (ioctl(handler.fd, VPMU_IOCTL_SUBMIT, &batch) != 0) {
+        DBG_MSG("%-30sfailed at command %u, error %d\n",
+                "[vpmu_submit_commands]",
+                batch.num_done,
+                batch.error);
+        return -1;
+    }
+    return batch.num_done;
+}
+
+// Let the driver ship the file to VPMU, no need to read the file in user space
+bool vpmu_send_file(VPMUHandler handler, const char *file_path, const char *name)
+{
+    VPMUCommand cmd = {};
+    int         ret = 0;
+
+    if (handler.ioctl_version == 0) return false;
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) return false;
+
+    cmd.op     = VPMU_CMD_SEND_FD;
+    cmd.arg[0] = fd;
+    cmd.arg[1] = (uint64_t)(uintptr_t)name;
+    ret        = vpmu_submit_commands(handler, &cmd, 1);
+    close(fd);
+
+    return (ret == 1);
+}
+
+// Let the driver pin the buffer and pass its physical pages, VPMU never walks the
+// page tables of this process
+bool vpmu_send_buffer(VPMUHandler handler,
+                      const void *buffer,
+                      size_t      size,
+                      const char *name)
+{
+    VPMUCommand cmd = {};
+
+    if (handler.ioctl_version == 0) return false;
+    cmd.op     = VPMU_CMD_SEND_BUFFER;
+    cmd.arg[0] = (uint64_t)(uintptr_t)buffer;
+    cmd.arg[1] = size;
+    cmd.arg[2] = (uint64_t)(uintptr_t)name;
+    return (vpmu_submit_commands(handler, &cmd, 1) == 1);
+}
+
+// Read size bytes of the stream of VPMU at pos, return the number of bytes read
+static ssize_t vpmu_read_stream(VPMUHandler handler, void *buf, size_t size, off_t pos)
+{
+#ifdef DRY_RUN
+    size_t    done  = 0;
+    uintptr_t chunk = 0;
+    uintptr_t got   = 0;
+
+    // Go through the staging area of the model as the driver does
+    while (done < size) {
+        chunk = size - done;
+        if (chunk > VPMU_MMAP_STAGING_SIZE) chunk = VPMU_MMAP_STAGING_SIZE;
+        HW_W(VPMU_MMAP_XFER_OFFSET, pos + done);
+        HW_W(VPMU_MMAP_XFER_READ, chunk);
+        got = HW_R(VPMU_MMAP_XFER_RESULT);
+        memcpy((char *)buf + done, (char *)handler.ptr + VPMU_MMAP_STAGING_BASE, got);
+        done += got;
+        if (got < chunk) break;
+    }
+    return done;
+#else
+    // The streams are file positions of the driver, on /dev/mem they are guest RAM
+    if (handler.ioctl_version == 0) return -1;
+    return pread(handler.fd, buf, size, pos);
+#endif
+}
+
+// Write size bytes to the stream of VPMU at pos, return the number of bytes taken
+static ssize_t vpmu_write_stream(VPMUHandler handler,
+                                 const void *buf,
+                                 size_t      size,
+                                 off_t       pos)
+{
+#ifdef DRY_RUN
+    size_t    done  = 0;
+    uintptr_t chunk = 0;
+    uintptr_t sent  = 0;
+
+    while (done < size) {
+        chunk = size - done;
+        if (chunk > VPMU_MMAP_STAGING_SIZE) chunk = VPMU_MMAP_STAGING_SIZE;
+        memcpy(
+          (char *)handler.ptr + VPMU_MMAP_STAGING_BASE, (const char *)buf + done, chunk);
+        HW_W(VPMU_MMAP_XFER_OFFSET, pos + done);
+        HW_W(VPMU_MMAP_XFER_WRITE, chunk);
+        sent = HW_R(VPMU_MMAP_XFER_RESULT);
+        done += sent;
+        if (sent < chunk) break;
+    }
+    return done;
+#else
+    // The streams are file positions of the driver, on /dev/mem they are guest RAM
+    if (handler.ioctl_version == 0) return -1;
+    return pwrite(handler.fd, buf, size, pos);
+#endif
+}
+
+// Read the snapshot of all counters in one bulk read, return the number of counters
+// or -1 on errors. block must have VPMU_COUNTER_BLOCK_SIZE bytes.
+int vpmu_read_counters(VPMUHandler handler, VPMUCounterBlock *block)
+{
+    ssize_t size = 0;
+
+    size = vpmu_read_stream(
+      handler, block, VPMU_COUNTER_BLOCK_SIZE, VPMU_STREAM_COUNTERS);
+
+    if (size < (ssize_t)sizeof(VPMUCounterBlock)) return -1;
+    if (block->magic != VPMU_COUNTERS_MAGIC || block->version != VPMU_COUNTERS_VERSION
+        || block->num_counters > VPMU_MAX_COUNTERS
+        || size < sizeof(VPMUCounterBlock) + block->num_counters * sizeof(VPMUCounter))
+        return -1;
+    return block->num_counters;
+}
+
+// Upload the parameters of the timing models, VPMU applies them on the next reset
+bool vpmu_upload_model_config(VPMUHandler handler, const VPMUModelConfig *config)
+{
+#ifndef DRY_RUN
+    if (handler.ioctl_version == 0) {
+        ERR_MSG("The model configuration needs vpmu-device, not /dev/mem");
+        return false;
+    }
+#endif
+    if (vpmu_write_stream(handler, config, sizeof(*config), VPMU_STREAM_MODEL_CONFIG)
+        != sizeof(*config)) {
+        ERR_MSG("VPMU does not take the model configuration");
+        return false;
+    }
+    return true;
+}
+
+// Configure the schedule of sampled simulation in instructions, see VPMU_SAMPLED_SIM
+void vpmu_set_sampling(VPMUHandler handler,
+                       uint64_t    fast_forward,
+                       uint64_t    warmup,
+                       uint64_t    detailed)
+{
+    DRY_MSG("sampling %" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n",
+            fast_forward,
+            warmup,
+            detailed);
+    VPMUCommand cmds[] = {{VPMU_CMD_WRITE, {VPMU_MMAP_SAMPLE_FAST_FORWARD, fast_forward}},
+                          {VPMU_CMD_WRITE, {VPMU_MMAP_SAMPLE_WARMUP, warmup}},
+                          {VPMU_CMD_WRITE, {VPMU_MMAP_SAMPLE_DETAILED, detailed}}};
+
+    vpmu_write_registers(handler, cmds, 3);
+}
+
+// Return the number of samples with their rows in *values (free it after use), or -1
+int vpmu_read_samples(VPMUHandler handler, VPMUSampleHeader *header, uint64_t **values)
+{
+    size_t size = 0;
+
+    *values = NULL;
+    if (vpmu_read_stream(handler, header, sizeof(*header), VPMU_STREAM_SAMPLES)
+        != sizeof(*header))
+        return -1;
+    if (header->magic != VPMU_SAMPLES_MAGIC || header->version != VPMU_SAMPLES_VERSION
+        || header->num_counters == 0 || header->num_counters > VPMU_MAX_SAMPLE_COUNTERS)
+        return -1;
+
+    size    = (size_t)header->num_samples * header->num_counters * sizeof(uint64_t);
+    *values = (uint64_t *)malloc(size + 1);
+    if (*values == NULL) return -1;
+    if (vpmu_read_stream(handler, *values, size, VPMU_STREAM_SAMPLES + sizeof(*header))
+        != size) {
+        free(*values);
+        *values = NULL;
+        return -1;
+    }
+    return header->num_samples;
+}
+
+// Read the profile aggregated by VPMU_FUNC_PROFILE, return the whole stream starting
+// with VPMUProfileHeader (free it after use), or NULL if VPMU has none
+void *vpmu_read_profile(VPMUHandler handler)
+{
+    VPMUProfileHeader header = {};
+    char *            buf    = NULL;
+
+    if (vpmu_read_stream(handler, &header, sizeof(header), VPMU_STREAM_PROFILE)
+        != sizeof(header))
+        return NULL;
+    if (header.magic != VPMU_PROFILE_MAGIC || header.version != VPMU_PROFILE_VERSION
+        || header.num_counters > VPMU_MAX_SAMPLE_COUNTERS
+        || header.total_size < sizeof(header) || header.total_size > (1 << 30))
+        return NULL;
+
+    buf = (char *)malloc(header.total_size);
+    if (buf == NULL) return NULL;
+    if (vpmu_read_stream(handler, buf, header.total_size, VPMU_STREAM_PROFILE)
+        != header.total_size) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// Extrapolate the totals of the run from the detailed intervals (SMARTS). A counter is
+// estimated by its mean rate per instruction over the samples times the instructions
+// of the whole run, with the 95% confidence interval of the mean. The last column tells
+// the samples needed for an interval within 3% of the estimate.
+void vpmu_print_sampled_report(VPMUHandler handler)
+{
+    VPMUSampleHeader header   = {};
+    uint64_t *       values   = NULL;
+    uint64_t         detailed = 0;
+    int              n        = vpmu_read_samples(handler, &header, &values);
+    int              i = 0, m = 0;
+    uint32_t         c = 0;
+
+    if (n < 0) {
+        LOG_MSG("No samples of sampled simulation");
+        return;
+    }
+    for (i = 0; i < n; i++) detailed += values[(size_t)i * header.num_counters];
+    LOG_MSG("Sampled simulation: %d samples, %" PRIu64 " of %" PRIu64
+            " instructions in detail",
+            n,
+            detailed,
+            header.total_instructions);
+    LOG_MSG("%-24s %20s %12s %10s", "counter", "estimate", "95% CI", "n for 3%");
+    LOG_MSG("%-24.31s %20" PRIu64 " %12s",
+            header.names[0],
+            header.total_instructions,
+            "exact");
+    for (c = 1; c < header.num_counters; c++) {
+        double mean = 0, var = 0, rate = 0, half = 0;
+
+        // Rates per instruction, rows with no instruction carry no information
+        for (i = 0, m = 0; i < n; i++) {
+            const uint64_t *row = values + (size_t)i * header.num_counters;
+
+            if (row[0] == 0) continue;
+            mean += (double)row[c] / row[0];
+            m++;
+        }
+        if (m == 0) {
+            LOG_MSG("%-24.31s %20s", header.names[c], "n/a");
+            continue;
+        }
+        mean /= m;
+        for (i = 0; i < n; i++) {
+            const uint64_t *row = values + (size_t)i * header.num_counters;
+
+            if (row[0] == 0) continue;
+            rate = (double)row[c] / row[0];
+            var += (rate - mean) * (rate - mean);
+        }
+        if (m < 2 || mean == 0) {
+            LOG_MSG("%-24.31s %20.0f %12s",
+                    header.names[c],
+                    mean * header.total_instructions,
+                    "n/a");
+            continue;
+        }
+        var /= m - 1;
+        half = 1.96 * sqrt(var / m);
+        LOG_MSG("%-24.31s %20.0f %11.2f%% %10.0f",
+                header.names[c],
+                mean * header.total_instructions,
+                100.0 * half / mean,
+                ceil(1.96 * 1.96 * var / (0.03 * mean * 0.03 * mean)));
+    }
+    free(values);
+}
+
+void vpmu_enable_notify(VPMUHandler handler, uint32_t mask)
+{
+    DRY_MSG("notify 0x%x\n", mask);
+    HW_W(VPMU_MMAP_NOTIFY_ENABLE, mask);
+}
+
+// Notify when the counter at index of VPMUCounterBlock reaches value, 0 to disable it
+void vpmu_set_threshold(VPMUHandler handler, uint32_t index, uintptr_t value)
+{
+    DRY_MSG("threshold of counter %u at %" PRIuPTR "\n", index, value);
+    HW_W(VPMU_MMAP_NOTIFY_COUNTER, index);
+    HW_W(VPMU_MMAP_NOTIFY_THRESHOLD, value);
+}
+
+// Notify when the trace ring holds records or more, 0 to disable it
+void vpmu_set_trace_watermark(VPMUHandler handler, uintptr_t records)
+{
+    DRY_MSG("trace watermark at %" PRIuPTR " records\n", records);
+    HW_W(VPMU_MMAP_TRACE_RING_WATERMARK, records);
+}
+
+// Block until VPMU sends notifications or timeout_ms passes (-1 to wait forever).
+// Return the number of records, 0 on timeout, or -1 if notifications are unsupported.
+int vpmu_wait_notify(VPMUHandler       handler,
+                     VPMUEventRecord *records,
+                     uint32_t         max_records,
+                     int              timeout_ms)
+{
+#ifdef DRY_RUN
+    VPMUEventRing *ring   = vpmu_model_notify_ring(handler.ptr);
+    uint32_t       head   = 0;
+    uint32_t       tail   = 0;
+    int            waited = 0;
+    int            n      = 0;
+
+    // Do what the driver does, with a poll of the ring every 1 ms for the interrupt
+    while ((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) == ring->tail) {
+        if (timeout_ms >= 0 && waited++ >= timeout_ms) return 0;
+        usleep(1000);
+    }
+    HW_W(VPMU_MMAP_NOTIFY_STATUS, HW_R(VPMU_MMAP_NOTIFY_STATUS));
+    for (tail = ring->tail; tail != head && n < max_records; tail++, n++)
+        records[n] = ring->records[tail & (ring->num_records - 1)];
+    // Release the slots to VPMU after the records are copied
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    if (ring->dropped) DBG_MSG("%-30s%u dropped\n", "[vpmu_wait_notify]", ring->dropped);
+    return n;
+#else
+    struct pollfd  pfd = {};
+    VPMUNotifyRead req = {};
+    int            ret = 0;
+
+    if (handler.ioctl_version == 0) return -1;
+    pfd.fd     = handler.fd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 || (pfd.revents & POLLERR)) return -1;
+    if (ret == 0) return 0;
+
+    req.max_records = max_records;
+    req.records     = (uint64_t)(uintptr_t)records;
+    if (ioctl(handler.fd, VPMU_IOCTL_READ_NOTIFY, &req) != 0) return -1;
+    if (req.dropped) DBG_MSG("%-30s%u dropped\n", "[vpmu_wait_notify]", req.dropped);
+    return req.num_records;
+#endif
+}
+
+// Map the trace ring of the session, exit on errors. size is the length of the mapping
+VPMUEventRing *vpmu_map_trace_ring(VPMUHandler handler, size_t *size)
+{
+    VPMUEventRing *ring = NULL;
+#ifdef DRY_RUN
+    // The ring lives in the model, where its clock produces the records
+    ring = vpmu_model_trace_ring(handler.ptr, size);
+    return ring;
+#else
+    long page = sysconf(_SC_PAGESIZE);
+
+    // Read the header first for the size of the whole ring
+    ring = (VPMUEventRing *)mmap(
+      NULL, page, PROT_READ, MAP_SHARED, handler.fd, VPMU_DEVICE_TRACE_RING_OFFSET);
+    if (ring == MAP_FAILED) {
+        ERR_MSG("mmap trace ring failed, the driver might be too old");
+        exit(4);
+    }
+    if (ring->magic != VPMU_EVENT_RING_MAGIC
+        || ring->record_size != sizeof(VPMUEventRecord)) {
+        ERR_MSG("Unknown format of trace ring (magic %x, record size %u)",
+                ring->magic,
+                ring->record_size);
+        exit(4);
+    }
+    *size = sizeof(VPMUEventRing) + (size_t)ring->num_records * sizeof(VPMUEventRecord);
+    *size = (*size + page - 1) / page * page;
+    munmap(ring, page);
+
+    ring = (VPMUEventRing *)mmap(NULL,
+                                 *size,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED,
+                                 handler.fd,
+                                 VPMU_DEVICE_TRACE_RING_OFFSET);
+    if (ring == MAP_FAILED) {
+        ERR_MSG("mmap trace ring failed");
+        exit(4);
+    }
+    return ring;
+#endif
+}
+
+void vpmu_unmap_trace_ring(VPMUEventRing *ring, size_t size)
+{
+#ifndef DRY_RUN
+    munmap(ring, size);
+#endif
+}
+
+// Sample the pc every period events of the VPMU_PERF_xxx counter, 0 to disable it
+void vpmu_set_pc_sampling(VPMUHandler handler, uint32_t counter, uintptr_t period)
+{
+    DRY_MSG("pc sampling of counter %u every %" PRIuPTR "\n", counter, period);
+    HW_W(VPMU_MMAP_PC_SAMPLE_COUNTER, counter);
+    HW_W(VPMU_MMAP_PC_SAMPLE_PERIOD, period);
 }
 
 bool is_ascii_file(const char *path)
@@ -237,13 +768,25 @@ void vpmu_load_and_send(VPMUHandler handler,
         DBG_MSG("%-30s%s\n", "[vpmu_load_and_send]", "Find in $PATH");
     }
 
+    // Use the path of script as the name if there is one
+    if (vpmu_send_file(handler, path, (script_path) ? script_path : path)) {
+        DBG_MSG("%-30ssend '%s' through ioctl\n", "[vpmu_load_and_send]", path);
+        return;
+    }
+
     size = load_binary(path, &buffer);
-    if (size > 0) {
+    if (size > 0
+        && vpmu_send_buffer(handler, buffer, size, (script_path) ? script_path : path)) {
+        DBG_MSG("%-30ssend '%s' through pinned pages\n", "[vpmu_load_and_send]", path);
+    } else if (size > 0 && handler.ioctl_version != 0) {
+        ERR_MSG("Send '%s' to VPMU failed", path);
+    } else if (size > 0) {
+        // Old drivers and /dev/mem, VPMU reads the buffer by the virtual address
         if (script_path) {
             // Use script path if there is one
-            HW_W(VPMU_MMAP_ADD_PROC_NAME, script_path);
+            vpmu_write_name(handler, VPMU_MMAP_ADD_PROC_NAME, script_path);
         } else {
-            HW_W(VPMU_MMAP_ADD_PROC_NAME, path);
+            vpmu_write_name(handler, VPMU_MMAP_ADD_PROC_NAME, path);
         }
         // Always pass main (real) binary even it's a script
         HW_W(VPMU_MMAP_SET_PROC_SIZE, size);
@@ -393,6 +936,76 @@ VPMUBinary *parse_all_paths_args(const char *cmd)
     return binary;
 }
 
+// Build a VPMU binary struct from the memory mappings of a running process
+VPMUBinary *parse_pid_maps(pid_t pid)
+{
+    char  path[1024]    = {};
+    char  message[2048] = {}; // No longer than 2048 characters per line
+    FILE *fp            = NULL;
+    int   cnt           = 0;
+    int   i             = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        ERR_MSG("Can't open '%s'", path);
+        return NULL;
+    }
+    // Return value
+    VPMUBinary *binary = (VPMUBinary *)malloc(sizeof(VPMUBinary));
+    // Reset all pointers
+    memset(binary, 0, sizeof(VPMUBinary));
+
+    snprintf(path, sizeof(path), "/proc/%d/exe", (int)pid);
+    binary->path = realpath(path, NULL);
+    if (binary->path == NULL) {
+        ERR_MSG("Can't resolve the binary of process %d", (int)pid);
+        fclose(fp);
+        free_vpmu_binary(binary);
+        return NULL;
+    }
+    {
+        char *basec          = strdup(binary->path);
+        char *dirc           = strdup(binary->path);
+        binary->file_name    = strdup(basename(basec));
+        binary->absolute_dir = strdup(dirname(dirc));
+        free(basec);
+        free(dirc);
+    }
+    binary->argv[0] = strdup(binary->path);
+    binary->argc    = 1;
+
+    DRY_MSG("Found executable mappings in process %d\n", (int)pid);
+    while (fgets(message, sizeof(message), fp) != NULL && cnt < 511) {
+        // Format: 00400000-0040b000 r-xp 00000000 08:01 1234    /usr/bin/cat
+        char perms[8]     = {};
+        int  path_offset  = 0;
+        bool is_duplicate = false;
+
+        if (sscanf(message, "%*s %7s %*s %*s %*s %n", perms, &path_offset) < 1) continue;
+        if (perms[2] != 'x' || message[path_offset] != '/') continue;
+        emplace_trim(&message[path_offset]);
+        // The file is no longer the same one mapped by the process
+        if (endwith(&message[path_offset], "(deleted)")) continue;
+        if (strcmp(&message[path_offset], binary->path) == 0) continue;
+        for (i = 0; i < cnt; i++) {
+            if (strcmp(binary->libraries[i], &message[path_offset]) == 0) {
+                is_duplicate = true;
+                break;
+            }
+        }
+        if (is_duplicate) continue;
+        binary->libraries[cnt] = strdup(&message[path_offset]);
+        DRY_MSG("    %d) %s\n", cnt, binary->libraries[cnt]);
+        cnt++;
+    }
+    binary->libraries[cnt] = NULL; // Terminate the list
+    fclose(fp);
+
+    DRY_MSG("Binary Path      : '%s'\n", binary->path);
+    return binary;
+}
+
 void free_vpmu_binary(VPMUBinary *bin)
 {
     int i = 0;
@@ -408,9 +1021,14 @@ void free_vpmu_binary(VPMUBinary *bin)
     if (bin) free(bin);
 }
 
-void vpmu_execute_binary(VPMUBinary *binary)
+// Fork and exec the binary, return the pid of the child or -1
+pid_t vpmu_spawn_binary(VPMUBinary *binary)
 {
-    if (binary == NULL || binary->path == NULL || strlen(binary->path) == 0) {
+    if (binary == NULL) {
+        ERR_MSG("Error, no command to execute");
+        exit(4);
+    }
+    if (binary->path == NULL || strlen(binary->path) == 0) {
         ERR_MSG("Error, command '%s' not found", binary->argv[0]);
         exit(4);
     }
@@ -418,10 +1036,7 @@ void vpmu_execute_binary(VPMUBinary *binary)
     pid_t pid = fork();
     if (pid == -1) {
         ERR_MSG("Error, failed to fork()");
-    } else if (pid > 0) {
-        int status;
-        waitpid(pid, &status, 0);
-    } else {
+    } else if (pid == 0) {
         LOG_MSG("Executing '%s'", binary->path);
         // we are the child
         if (binary->is_script) {
@@ -431,6 +1046,335 @@ void vpmu_execute_binary(VPMUBinary *binary)
         }
         _exit(EXIT_FAILURE); // exec never returns
     }
+    return pid;
+}
+
+void vpmu_execute_binary(VPMUBinary *binary)
+{
+    pid_t pid = vpmu_spawn_binary(binary);
+
+    if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+    }
+}
+
+#define VPMU_FOLLOW_MAX_IMAGES 4096
+
+// The list of files shipped to VPMU while following the process tree
+typedef struct ShippedList {
+    char *paths[VPMU_FOLLOW_MAX_IMAGES];
+    int   num;
+} ShippedList;
+
+// Return true if the path is newly added, false if it has been shipped already
+static bool shipped_list_add(ShippedList *list, const char *path)
+{
+    int i = 0;
+
+    for (i = 0; i < list->num; i++) {
+        if (strcmp(list->paths[i], path) == 0) return false;
+    }
+    // Ship it anyway when the list is full, it's only a little slower
+    if (list->num < VPMU_FOLLOW_MAX_IMAGES) list->paths[list->num++] = strdup(path);
+    return true;
+}
+
+#define VPMU_FOLLOW_MAX_TRACEES 4096
+
+// The tracees of the process tree whose first stop has been seen
+typedef struct TraceeList {
+    pid_t tids[VPMU_FOLLOW_MAX_TRACEES];
+    int   num;
+} TraceeList;
+
+// Return true if the tracee is new (or the list is full), false if it is known
+static bool tracee_list_add(TraceeList *list, pid_t tid)
+{
+    int i = 0;
+
+    for (i = 0; i < list->num; i++) {
+        if (list->tids[i] == tid) return false;
+    }
+    if (list->num < VPMU_FOLLOW_MAX_TRACEES) list->tids[list->num++] = tid;
+    return true;
+}
+
+// Forget the tracee, its tid might be reused by a new one
+static void tracee_list_remove(TraceeList *list, pid_t tid)
+{
+    int i = 0;
+
+    for (i = 0; i < list->num; i++) {
+        if (list->tids[i] == tid) {
+            list->tids[i] = list->tids[--list->num];
+            return;
+        }
+    }
+}
+
+// Ship the image (and its libraries) just exec'ed by the traced process to VPMU
+static void follow_ship_image(VPMUHandler  handler,
+                              ShippedList *shipped,
+                              ShippedList *images,
+                              pid_t        pid)
+{
+    char path[1024] = {};
+    int  j          = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/exe", (int)pid);
+    char *image = realpath(path, NULL);
+    if (image == NULL) return;
+    if (!shipped_list_add(shipped, image)) {
+        free(image);
+        return;
+    }
+    shipped_list_add(images, image);
+
+    VPMUBinary *binary = parse_all_paths_args(image);
+    vpmu_update_library_list(binary);
+    for (j = 0; binary->libraries[j] != NULL; j++) {
+        char *lib = binary->libraries[j];
+        // Skip libraries that are still just a name (not found)
+        if (lib[0] != '/' && lib[0] != '.') continue;
+        if (shipped_list_add(shipped, lib)) vpmu_load_and_send(handler, lib, NULL);
+    }
+    // Send the main program to VPMU (this must be the last one)
+    vpmu_load_and_send(handler, image, NULL);
+    LOG_MSG("Following: '%s' (pid %d)", image, (int)pid);
+    free_vpmu_binary(binary);
+    free(image);
+}
+
+void vpmu_execute_binary_follow(VPMUHandler handler, VPMUBinary *binary)
+{
+    ShippedList shipped = {}; // All the files shipped
+    ShippedList images  = {}; // The images exec'ed by descendants
+    TraceeList  tracees = {}; // The threads of the process tree
+    int         status  = 0;
+    int         i       = 0;
+    long        options = PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK
+                          | PTRACE_O_TRACECLONE;
+
+    if (binary == NULL) {
+        ERR_MSG("Error, no command to execute");
+        exit(4);
+    }
+    if (binary->path == NULL || strlen(binary->path) == 0) {
+        ERR_MSG("Error, command '%s' not found", binary->argv[0]);
+        exit(4);
+    }
+#ifdef PTRACE_O_EXITKILL
+    // Do not leave the tracees running when the controller is killed
+    options |= PTRACE_O_EXITKILL;
+#endif
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        ERR_MSG("Error, failed to fork()");
+        return;
+    } else if (pid == 0) {
+        LOG_MSG("Executing '%s' (following exec)", binary->path);
+        // we are the child, stop here until the tracer seizes us
+        raise(SIGSTOP);
+        if (binary->is_script) {
+            execvp(binary->script_path, binary->argv);
+        } else {
+            execvp(binary->path, binary->argv);
+        }
+        _exit(EXIT_FAILURE); // exec never returns
+    }
+
+    // The main binary and its libraries are shipped by the caller
+    {
+        char *real_path = realpath(binary->path, NULL);
+        shipped_list_add(&shipped, real_path ? real_path : binary->path);
+        free(real_path);
+    }
+    for (i = 0; binary->libraries[i] != NULL; i++) {
+        shipped_list_add(&shipped, binary->libraries[i]);
+    }
+
+    // Seized (not PTRACE_TRACEME) tracees report their group-stops and the first stop
+    // of the new tracees as PTRACE_EVENT_STOP, which tells them from a SIGSTOP sent
+    if (waitpid(pid, &status, WUNTRACED) < 0 || !WIFSTOPPED(status)
+        || ptrace(PTRACE_SEIZE, pid, NULL, (void *)options) < 0) {
+        ERR_MSG("Error, failed to trace '%s'", binary->path);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return;
+    }
+    tracee_list_add(&tracees, pid);
+    kill(pid, SIGCONT);
+
+    // Wait until all the processes in the tree exit (ECHILD)
+    while (1) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) break;
+        if (!WIFSTOPPED(status)) {
+            tracee_list_remove(&tracees, tid); // Exited or killed
+            continue;
+        }
+
+        int           sig     = WSTOPSIG(status);
+        int           event   = (unsigned int)status >> 16;
+        long          deliver = 0;
+        unsigned long former  = 0;
+        if (event == PTRACE_EVENT_STOP) {
+            if (tracee_list_add(&tracees, tid)) {
+                // The first stop of a tracee attached by fork/vfork/clone
+            } else if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN
+                       || sig == SIGTTOU) {
+                // Group-stop, stay stopped until SIGCONT as without the tracer
+                ptrace(PTRACE_LISTEN, tid, NULL, NULL);
+                continue;
+            }
+        } else if (sig == SIGTRAP && event == PTRACE_EVENT_EXEC) {
+            // A thread other than the leader takes the tid of the leader on exec
+            if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &former) == 0 && former != tid)
+                tracee_list_remove(&tracees, former);
+            // The new image is loaded but not yet run
+            follow_ship_image(handler, &shipped, &images, tid);
+        } else if (sig == SIGTRAP && event != 0) {
+            // Fork/vfork/clone events, the new tracee is attached automatically
+        } else {
+            // Signal-delivery-stop, including SIGSTOP sent to the tracee
+            deliver = sig;
+        }
+        ptrace(PTRACE_CONT, tid, NULL, (void *)deliver);
+    }
+
+    // Stop monitoring the images found while following
+    for (i = 0; i < images.num; i++) {
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, images.paths[i]);
+        free(images.paths[i]);
+    }
+    for (i = 0; i < shipped.num; i++) {
+        free(shipped.paths[i]);
+    }
+}
+
+// Find the fork server library which has the same architecture as the controller
+static char *locate_forkserver_lib(void)
+{
+    char   self[1024]    = {};
+    char   pattern[2048] = {};
+    char * out_path      = NULL;
+    glob_t glob_result   = {};
+    size_t i             = 0;
+
+    if (getenv(VPMU_FORKSRV_LIB_ENV) != NULL) return strdup(getenv(VPMU_FORKSRV_LIB_ENV));
+    if (readlink("/proc/self/exe", self, sizeof(self) - 1) < 0) return NULL;
+
+    int   machine = get_elf_machine(self);
+    char *dirc    = strdup(self);
+    snprintf(pattern, sizeof(pattern), "%s/%s", dirname(dirc), VPMU_FORKSRV_LIB_PATTERN);
+    free(dirc);
+
+    if (glob(pattern, 0, NULL, &glob_result) == 0) {
+        for (i = 0; i < glob_result.gl_pathc; i++) {
+            if (get_elf_machine(glob_result.gl_pathv[i]) == machine) {
+                out_path = strdup(glob_result.gl_pathv[i]);
+                break;
+            }
+        }
+    }
+    globfree(&glob_result);
+
+    DBG_MSG("%-30s'%s'\n", "[locate_forkserver_lib]", out_path);
+    return out_path;
+}
+
+void vpmu_forkserver_binary(VPMUHandler handler, VPMUBinary *binary)
+{
+    int      ctl_pipe[2] = {};
+    int      st_pipe[2]  = {};
+    uint32_t msg         = 0;
+    int      status      = 0;
+    pid_t    child       = 0;
+    int      i           = 0;
+
+    if (binary == NULL) {
+        ERR_MSG("Error, no command to execute");
+        exit(4);
+    }
+    if (binary->path == NULL || strlen(binary->path) == 0) {
+        ERR_MSG("Error, command '%s' not found", binary->argv[0]);
+        exit(4);
+    }
+
+    char *lib_path = locate_forkserver_lib();
+    if (lib_path == NULL) {
+        ERR_MSG("Can't find fork server library, please set $%s", VPMU_FORKSRV_LIB_ENV);
+        return;
+    }
+    if (pipe(ctl_pipe) != 0 || pipe(st_pipe) != 0) {
+        ERR_MSG("Error, failed to create pipes for fork server");
+        free(lib_path);
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        ERR_MSG("Error, failed to fork()");
+        free(lib_path);
+        return;
+    } else if (pid == 0) {
+        // we are the child, move the pipes to where the fork server expects them
+        dup2(ctl_pipe[0], VPMU_FORKSRV_FD);
+        dup2(st_pipe[1], VPMU_FORKSRV_STATUS_FD);
+        close(ctl_pipe[0]);
+        close(ctl_pipe[1]);
+        close(st_pipe[0]);
+        close(st_pipe[1]);
+        setenv("LD_PRELOAD", lib_path, 1);
+        LOG_MSG("Executing '%s' with fork server", binary->path);
+        if (binary->is_script) {
+            execvp(binary->script_path, binary->argv);
+        } else {
+            execvp(binary->path, binary->argv);
+        }
+        _exit(EXIT_FAILURE); // exec never returns
+    }
+    close(ctl_pipe[0]);
+    close(st_pipe[1]);
+    free(lib_path);
+
+    if (read(st_pipe[0], &msg, sizeof(msg)) != sizeof(msg) || msg != VPMU_FORKSRV_HELLO) {
+        ERR_MSG("Fork server of '%s' failed to start (static binary?)", binary->path);
+        goto out;
+    }
+
+    for (i = 0; i < handler.forkserver_runs; i++) {
+        if (handler.flag_trace)
+            vpmu_reset_counters(handler);
+        else
+            vpmu_start_fullsystem_tracing(handler);
+
+        msg = VPMU_FORKSRV_RUN;
+        if (write(ctl_pipe[1], &msg, sizeof(msg)) != sizeof(msg)
+            || read(st_pipe[0], &child, sizeof(child)) != sizeof(child)
+            || read(st_pipe[0], &status, sizeof(status)) != sizeof(status)) {
+            ERR_MSG("Fork server of '%s' terminated unexpectedly", binary->path);
+            break;
+        }
+
+        if (handler.flag_trace)
+            HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
+        else
+            vpmu_end_fullsystem_tracing(handler);
+        DBG_MSG("%-30srun %d, pid %d, status %d\n",
+                "[vpmu_forkserver_binary]",
+                i,
+                (int)child,
+                status);
+    }
+
+out:
+    // Closing the control pipe terminates the fork server
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    waitpid(pid, &status, 0);
 }
 
 void vpmu_monitor_binary(VPMUHandler handler, VPMUBinary *binary)
@@ -446,7 +1390,7 @@ void vpmu_monitor_binary(VPMUHandler handler, VPMUBinary *binary)
             LOG_MSG("Monitoring: '%s'", binary->path);
     } else {
         // Just tell VPMU to monitor the process with the name
-        HW_W(VPMU_MMAP_ADD_PROC_NAME, binary->argv[0]);
+        vpmu_write_name(handler, VPMU_MMAP_ADD_PROC_NAME, binary->argv[0]);
         LOG_MSG("Monitoring: '%s'", binary->argv[0]);
     }
     vpmu_reset_counters(handler);
@@ -457,14 +1401,14 @@ void vpmu_stop_monitoring_binary(VPMUHandler handler, VPMUBinary *binary)
 {
     if (binary->path) {
         if (binary->is_script) {
-            HW_W(VPMU_MMAP_REMOVE_PROC_NAME, binary->script_path);
+            vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->script_path);
             LOG_MSG("Stop Monitoring: '%s'", binary->script_path);
         } else {
-            HW_W(VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
+            vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
             LOG_MSG("Stop Monitoring: '%s'", binary->path);
         }
     } else {
-        HW_W(VPMU_MMAP_REMOVE_PROC_NAME, binary->argv[0]);
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->argv[0]);
         LOG_MSG("Stop Monitoring: '%s'", binary->argv[0]);
     }
 }
@@ -484,10 +1428,19 @@ void vpmu_profile_binary(VPMUHandler handler, VPMUBinary *binary)
         vpmu_load_and_send(handler, binary->path, NULL);
     }
 
+    if (handler.forkserver_runs > 0) {
+        // Counters are reset and reported around each run by the fork server
+        vpmu_forkserver_binary(handler, binary);
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
+        return;
+    }
     vpmu_reset_counters(handler);
-    vpmu_execute_binary(binary);
+    if (handler.flag_follow)
+        vpmu_execute_binary_follow(handler, binary);
+    else
+        vpmu_execute_binary(binary);
 
-    HW_W(VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
+    vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary->path);
     HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
 }
 
@@ -508,8 +1461,90 @@ void vpmu_do_exec(VPMUHandler handler, const char *cmd_str)
         vpmu_stop_monitoring_binary(handler, binary);
     } else if (handler.flag_trace) {
         vpmu_profile_binary(handler, binary);
+    } else if (handler.forkserver_runs > 0) {
+        vpmu_forkserver_binary(handler, binary);
     } else {
         vpmu_execute_binary(binary);
     }
     free_vpmu_binary(binary);
 }
+
+void vpmu_attach_pid(VPMUHandler handler, pid_t pid)
+{
+    VPMUBinary *binary = parse_pid_maps(pid);
+    if (binary == NULL) return;
+
+    // Send the libraries and plugins mapped by the process to VPMU
+    vpmu_load_and_send_libs(handler, binary);
+    // Send the main program to VPMU (this must be the last one)
+    vpmu_load_and_send(handler, binary->path, NULL);
+    HW_W(VPMU_MMAP_ATTACH_PID, pid);
+    vpmu_reset_counters(handler);
+    LOG_MSG("Attached: '%s' (pid %d)", binary->path, (int)pid);
+    LOG_MSG("Please use controller to print report when need");
+    free_vpmu_binary(binary);
+}
+
+void vpmu_detach_pid(VPMUHandler handler, pid_t pid)
+{
+    char  path[1024]  = {};
+    char *binary_path = NULL;
+
+    HW_W(VPMU_MMAP_DETACH_PID, pid);
+    // The process might have exited already, remove its name only when it is known
+    snprintf(path, sizeof(path), "/proc/%d/exe", (int)pid);
+    binary_path = realpath(path, NULL);
+    if (binary_path) {
+        vpmu_write_name(handler, VPMU_MMAP_REMOVE_PROC_NAME, binary_path);
+        free(binary_path);
+    }
+    HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
+    LOG_MSG("Detached: pid %d", (int)pid);
+}
+
+// Count every process in the cgroup (v2) as one unit, the driver tracks fork and exit
+void vpmu_attach_cgroup(VPMUHandler handler, const char *cgroup_path)
+{
+    VPMUCommand cmd = {};
+    int         fd  = open(cgroup_path, O_RDONLY | O_DIRECTORY);
+
+    if (fd < 0) {
+        ERR_MSG("Open cgroup '%s' failed", cgroup_path);
+        exit(4);
+    }
+    DRY_MSG("attach cgroup '%s'\n", cgroup_path);
+    cmd.op     = VPMU_CMD_ATTACH_CGROUP;
+    cmd.arg[0] = fd;
+#ifdef DRY_RUN
+    (void)cmd; // For unused warning
+#else
+    if (vpmu_submit_commands(handler, &cmd, 1) != 1) {
+        ERR_MSG("Attach cgroup '%s' failed, it must be a cgroup v2 directory and the "
+                "driver must support it",
+                cgroup_path);
+        exit(4);
+    }
+#endif
+    close(fd);
+    vpmu_reset_counters(handler);
+    LOG_MSG("Attached: cgroup '%s'", cgroup_path);
+    LOG_MSG("Please use controller to print report when need");
+}
+
+void vpmu_detach_cgroup(VPMUHandler handler, const char *cgroup_path)
+{
+    VPMUCommand cmd = {};
+
+    DRY_MSG("detach cgroup '%s'\n", cgroup_path);
+    cmd.op = VPMU_CMD_DETACH_CGROUP;
+#ifdef DRY_RUN
+    (void)cmd; // For unused warning
+#else
+    if (vpmu_submit_commands(handler, &cmd, 1) != 1) {
+        ERR_MSG("Session does not watch cgroup '%s'", cgroup_path);
+        exit(4);
+    }
+#endif
+    HW_W(VPMU_MMAP_REPORT, VPMU_DONT_CARE);
+    LOG_MSG("Detached: cgroup '%s'", cgroup_path);
+}
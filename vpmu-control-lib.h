@@ -7,6 +7,9 @@
 #include <stdbool.h>   // bool, true, false
 
 #include "vpmu-device.h" // HW address mapping of VPMU
+#include "vpmu-ioctl.h"  // ioctl interface of vpmu-device driver
+#include "vpmu-object.h" // Layouts of the data read from VPMU
+#include "vpmu-event.h"  // Records of notifications
 
 #ifdef DRY_RUN
 #pragma message "DRY_RUN is defined. Compiled with dry run!!"
@@ -27,8 +30,16 @@
     } while (0)
 #endif
 
-#define HW_W(ADDR, VAL) handler.ptr[ADDR / sizeof(uintptr_t)] = (uintptr_t)VAL
+#ifdef DRY_RUN
+// Registers are emulated by the software model of VPMU, see vpmu-model.h
+#include "vpmu-model.h"
+#define HW_W(ADDR, VAL) vpmu_model_write(handler.ptr, ADDR, (uintptr_t)(VAL))
+#define HW_R(ADDR) vpmu_model_read(handler.ptr, ADDR)
+#else
+// vpmu-device maps the registers read-only, writes go through its ioctl
+#define HW_W(ADDR, VAL) vpmu_hw_write(handler, ADDR, (uintptr_t)(VAL))
 #define HW_R(ADDR) (uintptr_t) handler.ptr[ADDR / sizeof(uintptr_t)]
+#endif
 
 #define VPMU_DONT_CARE 0 ///< This is more descriptive when passing value to VPMU
 
@@ -36,7 +47,11 @@ typedef struct VPMUHandler {
     int        fd;
     uintptr_t *ptr;
     uint32_t   flag_model;
-    bool       flag_jit, flag_trace, flag_monitor, flag_remove;
+    bool       flag_jit, flag_trace, flag_monitor, flag_remove, flag_follow;
+    int        forkserver_runs; ///< Number of runs through fork server, 0 to disable
+    uint32_t   ioctl_version;   ///< ioctl ABI version of the driver, 0 if unsupported
+    uint64_t   sample_fast_forward, sample_warmup, sample_detailed; ///< VPMU_SAMPLED_SIM
+    uint32_t   profile_depth; ///< Frames of the call stacks of VPMU_FUNC_PROFILE
 } VPMUHandler;
 
 typedef struct VPMUBinary {
@@ -55,15 +70,47 @@ typedef struct VPMUBinary {
 size_t load_binary(const char *file_path, char **out_buffer);
 bool arg_is(const char *args, const char *str);
 bool arg_is_2(const char *args, const char *str1, const char *str2);
+void check_arg_and_exit(int argc, char **argv, int cur_idx, int req_num);
+long parse_long_arg(const char *option, const char *str, long min, long max);
 
 VPMUHandler vpmu_open(const char *dev_path);
+VPMUHandler vpmu_open_session(const char *dev_path, int session);
 void vpmu_close(VPMUHandler handler);
 uintptr_t vpmu_read_value(VPMUHandler handler, uintptr_t index);
 void vpmu_write_value(VPMUHandler handler, uintptr_t index, uintptr_t value);
+#ifndef DRY_RUN
+void vpmu_hw_write(VPMUHandler handler, uintptr_t index, uintptr_t value);
+#endif
+void vpmu_write_name(VPMUHandler handler, uintptr_t index, const char *name);
 void vpmu_print_report(VPMUHandler handler);
 void vpmu_start_fullsystem_tracing(VPMUHandler handler);
 void vpmu_end_fullsystem_tracing(VPMUHandler handler);
 void vpmu_reset_counters(VPMUHandler handler);
+int vpmu_submit_commands(VPMUHandler handler, VPMUCommand *cmds, uint32_t num_cmds);
+bool vpmu_send_file(VPMUHandler handler, const char *file_path, const char *name);
+bool vpmu_send_buffer(VPMUHandler handler,
+                      const void *buffer,
+                      size_t      size,
+                      const char *name);
+int vpmu_read_counters(VPMUHandler handler, VPMUCounterBlock *block);
+bool vpmu_upload_model_config(VPMUHandler handler, const VPMUModelConfig *config);
+void vpmu_set_sampling(VPMUHandler handler,
+                       uint64_t    fast_forward,
+                       uint64_t    warmup,
+                       uint64_t    detailed);
+int vpmu_read_samples(VPMUHandler handler, VPMUSampleHeader *header, uint64_t **values);
+void vpmu_print_sampled_report(VPMUHandler handler);
+void *vpmu_read_profile(VPMUHandler handler);
+void vpmu_enable_notify(VPMUHandler handler, uint32_t mask);
+void vpmu_set_threshold(VPMUHandler handler, uint32_t index, uintptr_t value);
+void vpmu_set_trace_watermark(VPMUHandler handler, uintptr_t records);
+int vpmu_wait_notify(VPMUHandler       handler,
+                     VPMUEventRecord *records,
+                     uint32_t         max_records,
+                     int              timeout_ms);
+VPMUEventRing *vpmu_map_trace_ring(VPMUHandler handler, size_t *size);
+void vpmu_unmap_trace_ring(VPMUEventRing *ring, size_t size);
+void vpmu_set_pc_sampling(VPMUHandler handler, uint32_t counter, uintptr_t period);
 
 bool is_ascii_file(const char *path);
 char *read_first_line(const char *path);
@@ -75,12 +122,20 @@ void vpmu_load_and_send(VPMUHandler handler,
 void vpmu_load_and_send_libs(VPMUHandler handler, VPMUBinary *binary);
 
 VPMUBinary *parse_all_paths_args(const char *cmd);
+VPMUBinary *parse_pid_maps(pid_t pid);
 void free_vpmu_binary(VPMUBinary *bin);
 
+pid_t vpmu_spawn_binary(VPMUBinary *binary);
 void vpmu_execute_binary(VPMUBinary *binary);
+void vpmu_execute_binary_follow(VPMUHandler handler, VPMUBinary *binary);
+void vpmu_forkserver_binary(VPMUHandler handler, VPMUBinary *binary);
 void vpmu_monitor_binary(VPMUHandler handler, VPMUBinary *binary);
 void vpmu_stop_monitoring_binary(VPMUHandler handler, VPMUBinary *binary);
 void vpmu_profile_binary(VPMUHandler handler, VPMUBinary *binary);
 void vpmu_do_exec(VPMUHandler handler, const char *cmd_str);
+void vpmu_attach_pid(VPMUHandler handler, pid_t pid);
+void vpmu_detach_pid(VPMUHandler handler, pid_t pid);
+void vpmu_attach_cgroup(VPMUHandler handler, const char *cgroup_path);
+void vpmu_detach_cgroup(VPMUHandler handler, const char *cgroup_path);
 
 #endif
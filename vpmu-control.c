@@ -1,18 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h> // INT_MAX
 
 #include "vpmu-control-lib.h"
+#include "vpmu-config.h"
 
-static void check_arg_and_exit(int argc, char **argv, int cur_idx, int req_num)
-{
-    if ((cur_idx + req_num) >= argc) {
-        ERR_MSG("# of argument is not enough!");
-        ERR_MSG("This is happened due to %dth argument, '%s'.", cur_idx, argv[cur_idx]);
-        exit(4);
-    }
-}
-
-static void parse_options(VPMUHandler *handler, int argc, char **argv)
+static void
+parse_options(VPMUHandler *handler, const char **model_config, int argc, char **argv)
 {
     int i = 0; // Declaring i here for C98
 
@@ -33,6 +27,20 @@ static void parse_options(VPMUHandler *handler, int argc, char **argv)
         } else if (arg_is(argv[i], "--remove")) {
             DRY_MSG("enable monitoring\n");
             handler->flag_remove = true;
+        } else if (arg_is(argv[i], "--pid") || arg_is(argv[i], "--cgroup")) {
+            DRY_MSG("enable trace\n");
+            handler->flag_trace = true;
+            handler->flag_model |= VPMU_EVENT_TRACE;
+        } else if (arg_is(argv[i], "--follow")) {
+            DRY_MSG("enable following exec\n");
+            handler->flag_follow = true;
+            handler->flag_trace  = true;
+            handler->flag_model |= VPMU_EVENT_TRACE;
+        } else if (arg_is(argv[i], "--forkserver")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            handler->forkserver_runs =
+              parse_long_arg("--forkserver", argv[++i], 1, INT_MAX);
+            DRY_MSG("enable fork server with %d runs\n", handler->forkserver_runs);
         } else if (arg_is(argv[i], "--phase")) {
             DRY_MSG("enable phase\n");
             DRY_MSG("enable trace\n");
@@ -47,6 +55,30 @@ static void parse_options(VPMUHandler *handler, int argc, char **argv)
             handler->flag_model |= VPMU_BRANCH_SIM;
         } else if (arg_is(argv[i], "--pipeline")) {
             handler->flag_model |= VPMU_PIPELINE_SIM;
+        } else if (arg_is(argv[i], "--sample")) {
+            check_arg_and_exit(argc, argv, i, 3);
+            handler->sample_fast_forward = strtoull(argv[++i], NULL, 0);
+            handler->sample_warmup       = strtoull(argv[++i], NULL, 0);
+            handler->sample_detailed     = strtoull(argv[++i], NULL, 0);
+            if (handler->sample_detailed == 0) {
+                ERR_MSG("The detailed interval of --sample must not be 0");
+                exit(4);
+            }
+            handler->flag_model |= VPMU_SAMPLED_SIM;
+        } else if (arg_is(argv[i], "--func-profile")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            handler->profile_depth = atoi(argv[++i]);
+            if (handler->profile_depth > VPMU_MAX_PROFILE_DEPTH) {
+                ERR_MSG("Depth of --func-profile must be 0..%d", VPMU_MAX_PROFILE_DEPTH);
+                exit(4);
+            }
+            DRY_MSG("enable function profile with depth %u\n", handler->profile_depth);
+            DRY_MSG("enable trace\n");
+            handler->flag_trace = true;
+            handler->flag_model |= VPMU_EVENT_TRACE | VPMU_FUNC_PROFILE;
+        } else if (arg_is(argv[i], "--model-config")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            *model_config = argv[++i];
         } else if (arg_is(argv[i], "--all_models")) {
             handler->flag_model |= VPMU_INSN_COUNT_SIM | VPMU_ICACHE_SIM | VPMU_DCACHE_SIM
                                    | VPMU_BRANCH_SIM | VPMU_PIPELINE_SIM;
@@ -60,6 +92,7 @@ void print_help_message(const char *self)
     "Usage: %s [options] {actions...}\n"                                                 \
     "Options:\n"                                                                         \
     "  --mem         Use /dev/mem instead of /dev/vpmu-device-0 for communication\n"     \
+    "  --session <N> Use the N-th independent VPMU session (/dev/vpmu-device-N)\n"       \
     ""                                                                                   \
     "  --jit         Enable just-in-time model selection on performance simulation\n"    \
     "  --trace       Enable VPMU event tracing and function tracking ability\n"          \
@@ -67,9 +100,29 @@ void print_help_message(const char *self)
     "  --phase       Enable VPMU phase detection, --trace will be forced to set\n"       \
     "  --[MODEL]     [MODEL] could be one of the following\n"                            \
     "                    inst, cache, branch, pipeline, all_models\n"                    \
+    "  --sample <FF> <WARMUP> <DETAILED>\n"                                              \
+    "                Sampled simulation, repeat: count FF instructions only, warm\n"     \
+    "                caches and branch predictors for WARMUP instructions, then\n"       \
+    "                simulate DETAILED in detail. Reports extrapolate the totals\n"      \
+    "                with 95%% confidence bounds\n"                                      \
+    "  --func-profile <DEPTH>\n"                                                         \
+    "                Count per function, or per call stack of up to DEPTH frames\n"      \
+    "                if DEPTH > 0. --trace will be forced to set. Read the result\n"     \
+    "                with vpmu-profile\n"                                                \
+    "  --model-config <FILE>\n"                                                          \
+    "                Upload the parameters of the timing models (cache geometry,\n"      \
+    "                branch predictor, pipeline widths) in FILE of \"key = value\"\n"    \
+    "                lines. VPMU applies them on the next reset (--reset, -e, --pid)\n"  \
     "  --monitor     Enable VPMU event tracing and set the binary without\n"             \
     "                executing them when using -e action\n"                              \
     "  --remove      Remove binary (specified by -e option) from monitoring list\n"      \
+    "  --follow      Trace the process tree and pass every image exec'ed by the\n"       \
+    "                descendants (and their libraries) to VPMU before it runs.\n"        \
+    "                --trace will be forced to set\n"                                    \
+    "  --forkserver <N>\n"                                                               \
+    "                Run the program N times through a fork server. The binary and\n"    \
+    "                libraries are shipped once and each run is forked right before\n"   \
+    "                main(). Counters are reset and reported around each run\n"          \
     "  --help        Show this message\n"                                                \
     "\n\n"                                                                               \
     "Actions:\n"                                                                         \
@@ -80,19 +133,69 @@ void print_help_message(const char *self)
     "                If \"--trace\" is set, \"--start\" do nothing\n"                    \
     "  --end         End/Stop VPMU profiling and report the results\n"                   \
     "                If \"--trace\" is set, \"--end\" do nothing\n"                      \
+    "  --reset       Reset the counters and apply the uploaded model configuration\n"    \
     "  --report      Simply report the current results. It can be used while profiling " \
     "\n"                                                                                 \
     "  -e, --exec    Run the program/executable.\n"                                      \
     "                If \"--trace\" is set, the controller will also pass some of the "  \
     "sections\n"                                                                         \
     "                (i.e. symbol table, dynamic libraries) of target binary to VPMU.\n" \
+    "  --pid <PID>   Attach to a running process. All executable files mapped\n"         \
+    "                by the process are passed to VPMU and it starts counting.\n"        \
+    "                If \"--remove\" is set, detach from the process and report.\n"      \
+    "  --cgroup <PATH>\n"                                                                \
+    "                Count every process in the cgroup (v2) at PATH as one unit.\n"      \
+    "                Processes forked into it later are counted as well.\n"              \
+    "                If \"--remove\" is set, stop counting the cgroup and report.\n"     \
+    "  --threshold <counter> <value>\n"                                                  \
+    "                Notify when the counter (index in counter block) reaches value\n"   \
+    "  --watermark <N>\n"                                                                \
+    "                Notify when the trace ring holds N records or more\n"               \
+    "  --wait <N>    Block until N notifications of VPMU (phase changes, thresholds,\n"  \
+    "                trace watermarks) arrive and print them (needs vpmu_irq)\n"         \
     "\n"                                                                                 \
     "Example:\n"                                                                         \
     "    %s --all_models --start --exec \"ls -la\" --end\n"                              \
     "    %s --all_models --phase -e \"ls -la\"\n"                                        \
-    "    %s --all_models --monitor -e ls\n"
+    "    %s --all_models --monitor -e ls\n"                                              \
+    "    %s --all_models --pid 1234\n"                                                   \
+    "    %s --all_models --cgroup /sys/fs/cgroup/system.slice/nginx.service\n"           \
+    "    %s --all_models --phase --start --wait 10 --end\n"                              \
+    "    %s --all_models --sample 1000000 20000 10000 --start -e ./workload --end\n"     \
+    "    %s --all_models --model-config big-l2.cfg --reset --start --end\n"
+
+    printf(HELP_MESG, self, self, self, self, self, self, self, self, self);
+}
+
+// Print the notifications of VPMU without polling its registers
+static void wait_notifications(VPMUHandler handler, int num)
+{
+    VPMUEventRecord records[64] = {};
+    int             i = 0, n = 0;
+
+    vpmu_enable_notify(handler, VPMU_NOTIFY_ALL);
+    while (num > 0) {
+        n = vpmu_wait_notify(handler, records, sizeof(records) / sizeof(records[0]), -1);
+        if (n < 0) {
+            ERR_MSG("Notifications are not supported, is vpmu_irq of the driver set?");
+            exit(4);
+        }
+        for (i = 0; i < n && num > 0; i++, num--) {
+            const VPMUEventRecord *r = &records[i];
 
-    printf(HELP_MESG, self, self, self, self);
+            if (r->event == VPMU_EVENT_PHASE)
+                printf("%" PRIu64 " phase %" PRIu64 "\n", r->timestamp, r->addr);
+            else if (r->event == VPMU_EVENT_THRESHOLD)
+                printf("%" PRIu64 " threshold counter %u value %" PRIu64 "\n",
+                       r->timestamp,
+                       r->flags,
+                       r->addr);
+            else if (r->event == VPMU_EVENT_TRACE_WATERMARK)
+                printf("%" PRIu64 " trace %" PRIu64 " records\n", r->timestamp, r->addr);
+        }
+        fflush(stdout);
+    }
+    vpmu_enable_notify(handler, 0);
 }
 
 int main(int argc, char **argv)
@@ -101,6 +204,10 @@ int main(int argc, char **argv)
     VPMUHandler handler = {};
     // Default device
     char dev_path[256] = "/dev/vpmu-device-0";
+    // The session (register window) of VPMU to use
+    int session = 0;
+    // The file of --model-config, uploaded before the actions
+    const char *model_config = NULL;
     // Declaring i here for C98
     int i = 0;
 
@@ -110,6 +217,17 @@ int main(int argc, char **argv)
         exit(-1);
     }
 
+    for (i = 0; i < argc; i++) {
+        if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            session = atoi(argv[++i]);
+            if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) {
+                ERR_MSG("Session must be in 0..%d", VPMU_DEVICE_MAX_SESSIONS - 1);
+                exit(4);
+            }
+        }
+    }
+    snprintf(dev_path, sizeof(dev_path), "/dev/vpmu-device-%d", session);
     for (i = 0; i < argc; i++) {
         if (arg_is(argv[i], "--mem")) {
             strcpy(dev_path, "/dev/mem");
@@ -120,10 +238,17 @@ int main(int argc, char **argv)
     }
     // After parsing the real path of vpmu-device and help message,
     // we can do the initialization now.
-    handler = vpmu_open(dev_path);
+    handler = vpmu_open_session(dev_path, session);
 
     // First Parse Settings/Configurations
-    parse_options(&handler, argc, argv);
+    parse_options(&handler, &model_config, argc, argv);
+    if (model_config) {
+        VPMUModelConfig config = {};
+        if (!vpmu_parse_model_config(model_config, &config)) exit(4);
+        if (!vpmu_upload_model_config(handler, &config)) exit(4);
+        LOG_MSG("Model configuration '%s' is applied on the next reset", model_config);
+        vpmu_print_model_config(&config);
+    }
 
     // Then parse all the action arguments
     for (i = 0; i < argc; i++) {
@@ -143,11 +268,37 @@ int main(int argc, char **argv)
         } else if (arg_is(argv[i], "--end")) {
             // Only do this when it's not in trace mode
             if (handler.flag_trace == false) vpmu_end_fullsystem_tracing(handler);
+        } else if (arg_is(argv[i], "--reset")) {
+            vpmu_reset_counters(handler);
         } else if (arg_is(argv[i], "--report")) {
             vpmu_print_report(handler);
         } else if (arg_is_2(argv[i], "--exec", "-e")) {
             check_arg_and_exit(argc, argv, i, 1);
             vpmu_do_exec(handler, argv[++i]);
+        } else if (arg_is(argv[i], "--pid")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            pid_t pid = atoi(argv[++i]);
+            if (handler.flag_remove)
+                vpmu_detach_pid(handler, pid);
+            else
+                vpmu_attach_pid(handler, pid);
+        } else if (arg_is(argv[i], "--cgroup")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            if (handler.flag_remove)
+                vpmu_detach_cgroup(handler, argv[++i]);
+            else
+                vpmu_attach_cgroup(handler, argv[++i]);
+        } else if (arg_is(argv[i], "--threshold")) {
+            check_arg_and_exit(argc, argv, i, 2);
+            uint32_t  index = atoi(argv[++i]);
+            uintptr_t value = atoll(argv[++i]);
+            vpmu_set_threshold(handler, index, value);
+        } else if (arg_is(argv[i], "--watermark")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            vpmu_set_trace_watermark(handler, atoll(argv[++i]));
+        } else if (arg_is(argv[i], "--wait")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            wait_notifications(handler, atoi(argv[++i]));
         }
     }
 
@@ -6,6 +6,11 @@
 #define VPMU_DEVICE_NAME            "VPMU"
 #define VPMU_DEVICE_BASE_ADDR       0xf1000000
 #define VPMU_DEVICE_IOMEM_SIZE      0x2000
+#define VPMU_DEVICE_MAX_SESSIONS    16
+// Each session (minor device) has its own register window, counters and models
+#define VPMU_DEVICE_WINDOW_ADDR(n)  (VPMU_DEVICE_BASE_ADDR + (n) * VPMU_DEVICE_IOMEM_SIZE)
+// mmap() offset of the trace ring on vpmu-device-N, offset 0 is the register window
+#define VPMU_DEVICE_TRACE_RING_OFFSET 0x100000
 
 #define VPMU_MMAP_ENABLE            0x0000
 #define VPMU_MMAP_DISABLE           0x0008
@@ -17,6 +22,25 @@
 #define VPMU_MMAP_REMOVE_PROC_NAME  0x0048
 #define VPMU_MMAP_SET_PROC_SIZE     0x0050
 #define VPMU_MMAP_SET_PROC_BIN      0x0058
+#define VPMU_MMAP_ATTACH_PID        0x0060
+#define VPMU_MMAP_DETACH_PID        0x0068
+#define VPMU_MMAP_XFER_OFFSET       0x0070
+#define VPMU_MMAP_XFER_READ         0x0078
+#define VPMU_MMAP_XFER_WRITE        0x0080
+#define VPMU_MMAP_XFER_RESULT       0x0088
+// Objects passed by lists of physical memory ranges, VPMU copies each range on PLEN
+#define VPMU_MMAP_OBJ_BEGIN         0x0090
+#define VPMU_MMAP_OBJ_SIZE          0x0098
+#define VPMU_MMAP_OBJ_NAME          0x00a0
+#define VPMU_MMAP_OBJ_PADDR         0x00a8
+#define VPMU_MMAP_OBJ_PLEN          0x00b0
+#define VPMU_MMAP_OBJ_COMMIT        0x00b8
+// Event ring filled by the guest kernel (see vpmu-event.h), writing size enables it
+#define VPMU_MMAP_EVENT_RING_ADDR   0x00c0
+#define VPMU_MMAP_EVENT_RING_SIZE   0x00c8
+#define VPMU_MMAP_EVENT_RING_KICK   0x00d0
+#define VPMU_MMAP_TRACE_RING_ADDR   0x00d8
+#define VPMU_MMAP_TRACE_RING_SIZE   0x00e0
 // ... reserved
 #define VPMU_MMAP_OFFSET_FILE_f_path_dentry      0x0100
 #define VPMU_MMAP_OFFSET_DENTRY_d_iname          0x0108
@@ -24,10 +48,69 @@
 #define VPMU_MMAP_OFFSET_THREAD_INFO_task        0x0118
 #define VPMU_MMAP_OFFSET_TASK_STRUCT_pid         0x0120
 // ... reserved
+// Notifications (see vpmu-event.h). VPMU pushes records to the notify ring and raises
+// the interrupt of the driver while VPMU_MMAP_NOTIFY_STATUS is non-zero
+#define VPMU_MMAP_NOTIFY_RING_ADDR               0x0180
+#define VPMU_MMAP_NOTIFY_RING_SIZE               0x0188
+#define VPMU_MMAP_NOTIFY_ENABLE                  0x0190 // Mask of VPMU_NOTIFY_xxx
+#define VPMU_MMAP_NOTIFY_STATUS                  0x0198 // Read pending, write to ack
+#define VPMU_MMAP_NOTIFY_COUNTER                 0x01a0 // Index in VPMUCounterBlock
+#define VPMU_MMAP_NOTIFY_THRESHOLD               0x01a8 // Threshold of the counter
+#define VPMU_MMAP_TRACE_RING_WATERMARK           0x01b0 // Records in the trace ring
+// Schedule of sampled simulation (VPMU_SAMPLED_SIM) in guest instructions. Each period
+// fast-forwards with the instruction counter only, warms caches and branch predictors
+// up, then simulates every model in detail. Samples go to VPMU_STREAM_SAMPLES
+#define VPMU_MMAP_SAMPLE_FAST_FORWARD            0x01b8
+#define VPMU_MMAP_SAMPLE_WARMUP                  0x01c0
+#define VPMU_MMAP_SAMPLE_DETAILED                0x01c8
+// Frames of the call stacks aggregated by VPMU_FUNC_PROFILE, 0 for functions only
+#define VPMU_MMAP_PROFILE_DEPTH                  0x01d0
+// Sample the pc every PERIOD events of the VPMU_PERF_xxx counter, 0 to disable. VPMU
+// pushes VPMU_EVENT_SAMPLE records to the trace ring, mixed in time order with the
+// records of the event ring (VPMU_MMAP_EVENT_RING_ADDR) forwarded as they are drained
+#define VPMU_MMAP_PC_SAMPLE_COUNTER              0x01d8
+#define VPMU_MMAP_PC_SAMPLE_PERIOD               0x01e0
+// ... reserved
 #define VPMU_MMAP_OFFSET_LINUX_VERSION           0x0200
 #define VPMU_MMAP_OFFSET_KERNEL_SYM_NAME         0x0208
 #define VPMU_MMAP_OFFSET_KERNEL_SYM_ADDR         0x0210
 #define VPMU_MMAP_THREAD_SIZE                    0x0218
+// ... reserved
+// Read-only mirrors of the counters for the perf PMU, indexed by VPMU_PERF_xxx
+#define VPMU_MMAP_PERF_COUNTER(n)                (0x0800 + (n) * 8)
+// ... reserved
+// Staging area of bulk transfers, backed by RAM in VPMU (no trap on each access).
+// Fill it and ring VPMU_MMAP_XFER_WRITE with the size, or ring VPMU_MMAP_XFER_READ
+// with the size and read it back. VPMU_MMAP_XFER_RESULT tells the size transferred.
+#define VPMU_MMAP_STAGING_BASE                   0x1000
+#define VPMU_MMAP_STAGING_SIZE                   0x1000
+
+// Offsets of the data streams of VPMU, i.e. the file position of read()/write()
+#define VPMU_STREAM_COUNTERS        0x40000000 // VPMUCounterBlock, see vpmu-object.h
+#define VPMU_STREAM_SAMPLES         0x50000000 // VPMUSampleHeader, see vpmu-object.h
+#define VPMU_STREAM_MODEL_CONFIG    0x60000000 // VPMUModelConfig, write only
+#define VPMU_STREAM_PROFILE         0x70000000 // VPMUProfileHeader, see vpmu-object.h
+
+// Object types (VPMU_MMAP_OBJ_BEGIN)
+#define VPMU_OBJ_BINARY             0x1 // Executable image, for symbols only
+#define VPMU_OBJ_KERNEL_SYMTAB      0x2 // Kernel text symbols, see vpmu-object.h
+#define VPMU_OBJ_OFFSET_TABLE       0x3 // Offsets of kernel structures, see vpmu-object.h
+#define VPMU_OBJ_PROC_BINARY        0x4 // Binary of the last VPMU_MMAP_ADD_PROC_NAME
+
+// Sources of notifications (VPMU_MMAP_NOTIFY_ENABLE)
+#define VPMU_NOTIFY_PHASE           0x1 << 0
+#define VPMU_NOTIFY_THRESHOLD       0x1 << 1
+#define VPMU_NOTIFY_TRACE_WATERMARK 0x1 << 2
+#define VPMU_NOTIFY_ALL             0x7
+
+// Counters of the "vpmu" perf PMU (perf_event_attr.config), see VPMU_MMAP_PERF_COUNTER
+#define VPMU_PERF_INSTRUCTIONS      0x0
+#define VPMU_PERF_CYCLES            0x1 // Cycles of the pipeline model
+#define VPMU_PERF_ICACHE_MISSES     0x2
+#define VPMU_PERF_DCACHE_MISSES     0x3
+#define VPMU_PERF_BRANCHES          0x4
+#define VPMU_PERF_BRANCH_MISSES     0x5
+#define VPMU_PERF_MAX_COUNTERS      64
 
 // Mode selector
 #define VPMU_INSN_COUNT_SIM         0x1 << 0
@@ -40,6 +123,8 @@
 #define VPMU_WHOLE_SYSTEM           0x1 << 7
 #define VPMU_PHASEDET               0x1 << 8
 #define VPMU_VMS_SIM                0x1 << 9
+#define VPMU_SAMPLED_SIM            0x1 << 10
+#define VPMU_FUNC_PROFILE           0x1 << 11
 
 #define vpmu_model_has(model, vpmu) (vpmu.timing_model & (model))
 
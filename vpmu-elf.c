@@ -110,6 +110,21 @@ int get_elf_word_size(int fd)
     return 0;
 }
 
+int get_elf_machine(const char *file_path)
+{
+    Elf64_Ehdr eh; // e_machine is at the same offset in both ELF32 and ELF64
+
+    if (file_path == NULL) return -1;
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    bool ret = read_elf64_header(fd, &eh);
+    close(fd);
+    // Check magic words, return -1 when fail
+    if (!ret || !is_ELF(&eh)) return -1;
+    return eh.e_machine;
+}
+
 bool is_dynamic_binary(const char *file_path)
 {
     if (file_path == NULL) return false;
@@ -12,6 +12,7 @@ Elf32_Phdr *read_elf32_program_header(int32_t fd, const Elf32_Ehdr elf_header);
 bool is_elf64_dynamic(Elf64_Ehdr elf_header, Elf64_Phdr *program_header);
 bool is_elf32_dynamic(Elf32_Ehdr elf_header, Elf32_Phdr *program_header);
 int get_elf_word_size(int fd);
+int get_elf_machine(const char *file_path);
 
 bool is_dynamic_binary(const char *file_path);
 
@@ -0,0 +1,71 @@
+#ifndef __VPMU_EVENT_H_
+#define __VPMU_EVENT_H_
+// This header is shared by the device driver, user space programs and VPMU
+
+#ifdef __KERNEL__
+#include <linux/types.h> // uint32_t, uint64_t
+#else
+#include <stdint.h> // uint32_t, uint64_t
+#endif
+
+#define VPMU_EVENT_RING_MAGIC   0x56455652 // "VEVR"
+#define VPMU_EVENT_RING_VERSION 1
+
+// Types of events
+#define VPMU_EVENT_SWITCH 0x1 // Context switch to pid/tid, addr is tid of previous task
+#define VPMU_EVENT_FORK   0x2 // pid/tid is the parent, addr is tid of the child
+#define VPMU_EVENT_EXIT   0x3 // pid/tid exits
+#define VPMU_EVENT_EXEC   0x4 // pid/tid executes a new image
+#define VPMU_EVENT_MMAP   0x5 // Mapping [addr, addr + len) with vm_flags in flags
+#define VPMU_EVENT_SAMPLE 0x6 // VPMU sampled the pc in addr, see VPMU_MMAP_PC_SAMPLE_xxx
+#define VPMU_EVENT_NAME   0x7 // Name of the previous EXEC/MMAP record of the thread
+// Flags of VPMU_EVENT_FORK
+#define VPMU_EVENT_FORK_THREAD   0x1 // The child is a thread of the parent
+// Flags of VPMU_EVENT_SAMPLE, the low 16 bits are the VPMU_PERF_xxx counter and len is
+// the sampling period
+#define VPMU_EVENT_SAMPLE_KERNEL 0x80000000 // The pc is in kernel mode
+// VPMU_EVENT_NAME follows the EXEC (task comm) and the file backed executable MMAP
+// records right away. The first one (flags 0) has the length of the name in len and
+// the file offset of the mapping in addr. The following ones (flags 1, 2, ...) carry
+// 16 bytes of the name each in addr and len, in the order of the bytes in memory.
+#define VPMU_EVENT_NAME_MAX      256 // Longer names are truncated
+// Notifications from VPMU, timestamp is the simulated time in nanoseconds
+#define VPMU_EVENT_PHASE           0x10 // Phase changed to addr, len is the phase length
+#define VPMU_EVENT_THRESHOLD       0x11 // Counter at index flags reached addr
+#define VPMU_EVENT_TRACE_WATERMARK 0x12 // Trace ring holds addr records
+
+typedef struct VPMUEventRecord {
+    uint64_t timestamp; // Nanoseconds of the local clock
+    uint32_t pid;       // Process id (tgid)
+    uint32_t tid;       // Thread id
+    uint32_t event;     // VPMU_EVENT_xxx
+    uint32_t flags;     // Event specific flags
+    uint64_t addr;      // Event specific address
+    uint64_t len;       // Event specific length
+} VPMUEventRecord;
+
+/*
+ * A single-producer/single-consumer ring in guest memory.
+ * head and tail are free-running counters, the slot is (counter % num_records).
+ * The producer writes a record and then publishes head (release). The consumer reads
+ * head (acquire), copies the records and then publishes tail (release).
+ * head and tail are 32 bits for being atomic on 32 bits guests.
+ * The same layout is used in both directions: the event ring is produced by the guest
+ * kernel for VPMU, the trace ring is produced by VPMU for a user space consumer, the
+ * notify ring is produced by VPMU for the driver.
+ */
+typedef struct VPMUEventRing {
+    uint32_t magic;       // VPMU_EVENT_RING_MAGIC
+    uint32_t version;     // VPMU_EVENT_RING_VERSION
+    uint32_t record_size; // sizeof(VPMUEventRecord)
+    uint32_t num_records; // Capacity, always a power of 2
+    uint32_t reserved0[12];
+    uint32_t head;    // Written by producer only
+    uint32_t dropped; // Records dropped by producer since the ring was full
+    uint32_t reserved1[14];
+    uint32_t tail; // Written by consumer only
+    uint32_t reserved2[15];
+    VPMUEventRecord records[];
+} VPMUEventRing;
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h> // sigaction()
+#include <time.h>   // clock_gettime(), nanosleep()
+#include <errno.h>  // errno
+
+#include "vpmu-path-lib.h"
+#include "vpmu-control-lib.h"
+
+typedef struct ExporterConfig {
+    const char *prom_path; ///< Prometheus text file, rewritten atomically on each sample
+    const char *tsv_path;  ///< Time-series file, appended on each sample
+    double      interval;  ///< Seconds between samples
+    long        count;     ///< Number of samples, 0 for running until signaled
+    int         session;
+} ExporterConfig;
+
+static volatile sig_atomic_t exporter_stop = 0;
+
+static void handle_stop_signal(int sig)
+{
+    exporter_stop = 1;
+}
+
+static inline uint64_t time_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Prometheus metric names are [a-zA-Z_:][a-zA-Z0-9_:]*
+static void metric_name(char *out, size_t size, const char *name)
+{
+    size_t i = 0;
+    size_t n = snprintf(out, size, "vpmu_");
+
+    for (i = 0; name[i] != '\0' && n + 1 < size; i++, n++) {
+        out[n] = (isalnum((unsigned char)name[i])) ? name[i] : '_';
+    }
+    out[n] = '\0';
+}
+
+// The metric of a counter, "cpu0_cycles" is vpmu_cycles_total with the cpu "0". Return
+// the name of the family, i.e. the counter name without the cpu prefix.
+static const char *counter_metric(const VPMUCounter *c,
+                                  char *             name,
+                                  size_t             size,
+                                  char *             cpu,
+                                  size_t             cpu_size)
+{
+    const char *family = c->name;
+    size_t      digits = 0;
+
+    cpu[0] = '\0';
+    if (strncmp(c->name, "cpu", 3) == 0) {
+        digits = strspn(c->name + 3, "0123456789");
+        if (digits > 0 && digits < cpu_size && c->name[3 + digits] == '_') {
+            snprintf(cpu, cpu_size, "%.*s", (int)digits, c->name + 3);
+            family = c->name + 4 + digits;
+        }
+    }
+    metric_name(name, size, family);
+    // Monotonic counters are named *_total by the conventions of Prometheus
+    if (!(c->flags & VPMU_COUNTER_GAUGE))
+        strncat(name, "_total", size - strlen(name) - 1);
+    return family;
+}
+
+static void write_prometheus(const ExporterConfig *cfg,
+                             const VPMUCounterBlock *block,
+                             uint64_t                now_ms)
+{
+    char        tmp_path[4096]                = {};
+    char        names[VPMU_MAX_COUNTERS][128] = {};
+    char        cpus[VPMU_MAX_COUNTERS][16]   = {};
+    const char *families[VPMU_MAX_COUNTERS]   = {};
+    bool        written[VPMU_MAX_COUNTERS]    = {};
+    FILE *      fp                            = NULL;
+    int         i = 0, j = 0;
+
+    // node-exporter might read the file at any time, never show a partial file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cfg->prom_path, getpid());
+    fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        ERR_MSG("Open '%s' failed", tmp_path);
+        exit(4);
+    }
+    for (i = 0; i < block->num_counters && i < VPMU_MAX_COUNTERS; i++) {
+        families[i] = counter_metric(&block->counters[i],
+                                     names[i],
+                                     sizeof(names[i]),
+                                     cpus[i],
+                                     sizeof(cpus[i]));
+    }
+    // One HELP and TYPE for each family, followed by the counters of every cpu
+    for (i = 0; i < block->num_counters && i < VPMU_MAX_COUNTERS; i++) {
+        if (written[i]) continue;
+        fprintf(fp, "# HELP %s The %s of VPMU\n", names[i], families[i]);
+        fprintf(fp,
+                "# TYPE %s %s\n",
+                names[i],
+                (block->counters[i].flags & VPMU_COUNTER_GAUGE) ? "gauge" : "counter");
+        for (j = i; j < block->num_counters && j < VPMU_MAX_COUNTERS; j++) {
+            if (written[j] || strcmp(names[j], names[i]) != 0) continue;
+            written[j] = true;
+            if (cpus[j][0] != '\0')
+                fprintf(fp, "%s{cpu=\"%s\",", names[j], cpus[j]);
+            else
+                fprintf(fp, "%s{", names[j]);
+            fprintf(fp,
+                    "session=\"%d\"} %" PRIu64 "\n",
+                    cfg->session,
+                    block->counters[j].value);
+        }
+    }
+    fprintf(fp, "# HELP vpmu_simulated_time_seconds Simulated time of VPMU\n");
+    fprintf(fp, "# TYPE vpmu_simulated_time_seconds gauge\n");
+    fprintf(fp,
+            "vpmu_simulated_time_seconds{session=\"%d\"} %.9f\n",
+            cfg->session,
+            block->timestamp / 1e9);
+    fprintf(fp,
+            "# HELP vpmu_exporter_last_sample_timestamp_seconds "
+            "Wall clock time of the last sample\n");
+    fprintf(fp, "# TYPE vpmu_exporter_last_sample_timestamp_seconds gauge\n");
+    fprintf(fp,
+            "vpmu_exporter_last_sample_timestamp_seconds{session=\"%d\"} %.3f\n",
+            cfg->session,
+            now_ms / 1e3);
+    if (fclose(fp) != 0 || rename(tmp_path, cfg->prom_path) != 0) {
+        ERR_MSG("Write '%s' failed", cfg->prom_path);
+        unlink(tmp_path);
+        exit(4);
+    }
+}
+
+// One line per counter: wall clock (ms), simulated time (ns), sequence, name, value
+static void write_tsv(FILE *fp, const VPMUCounterBlock *block, uint64_t now_ms)
+{
+    int i = 0;
+
+    for (i = 0; i < block->num_counters; i++) {
+        fprintf(fp,
+                "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%" PRIu64 "\n",
+                now_ms,
+                block->timestamp,
+                block->sequence,
+                block->counters[i].name,
+                block->counters[i].value);
+    }
+    // Keep the file consistent at line boundaries if the exporter is killed
+    fflush(fp);
+}
+
+static void sleep_sec(double sec)
+{
+    struct timespec ts = {};
+
+    ts.tv_sec  = (time_t)sec;
+    ts.tv_nsec = (long)((sec - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR && !exporter_stop)
+        ;
+}
+
+static void run_exporter(VPMUHandler handler, const ExporterConfig *cfg)
+{
+    VPMUCounterBlock *block   = (VPMUCounterBlock *)malloc(VPMU_COUNTER_BLOCK_SIZE);
+    FILE *            tsv     = NULL;
+    long              samples = 0;
+
+    if (block == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    if (cfg->tsv_path) {
+        tsv = fopen(cfg->tsv_path, "a");
+        if (tsv == NULL) {
+            ERR_MSG("Open '%s' failed", cfg->tsv_path);
+            exit(4);
+        }
+        if (ftell(tsv) == 0) fprintf(tsv, "#wall_ms\tsim_ns\tsequence\tcounter\tvalue\n");
+    }
+
+    while (!exporter_stop && (cfg->count == 0 || samples < cfg->count)) {
+        uint64_t now_ms = time_now_ms();
+
+        if (vpmu_read_counters(handler, block) < 0) {
+            ERR_MSG("Read counters failed, VPMU or the driver might not support it");
+            exit(4);
+        }
+        if (cfg->prom_path) write_prometheus(cfg, block, now_ms);
+        if (tsv) write_tsv(tsv, block, now_ms);
+        samples++;
+        if (cfg->count == 0 || samples < cfg->count) sleep_sec(cfg->interval);
+    }
+
+    if (tsv) fclose(tsv);
+    free(block);
+    LOG_MSG("%ld samples exported", samples);
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s [options]\n"                                                              \
+    "Sample the counters of VPMU periodically and export them to local files.\n"         \
+    "Options:\n"                                                                         \
+    "  --prom <FILE>      Write FILE in Prometheus text format for node-exporter\n"      \
+    "  --tsv <FILE>       Append samples to FILE as tab-separated values\n"              \
+    "  -i <SEC>           Seconds between samples (default: 10)\n"                       \
+    "  -n <N>             Stop after N samples (default: run until Ctrl-C)\n"            \
+    "  --session <N>      Sample the session of /dev/vpmu-device-N (default: 0)\n"       \
+    "  --help             Show this message\n"                                           \
+    "\n"                                                                                 \
+    "Each sample costs one read() of the counter block, no register access.\n"           \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s --prom /var/lib/node_exporter/vpmu.prom -i 5\n"                              \
+    "    %s --tsv vpmu.tsv -i 1 -n 3600\n"
+
+    printf(HELP_MESG, self, self, self);
+}
+
+int main(int argc, char **argv)
+{
+    VPMUHandler      handler       = {};
+    ExporterConfig   cfg           = {};
+    char             dev_path[256] = {};
+    struct sigaction act           = {};
+    // Declaring i here for C98
+    int i = 0;
+
+    cfg.interval = 10;
+    for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "--help")) {
+            print_help_message(argv[0]);
+            exit(0);
+        } else if (arg_is(argv[i], "--prom")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.prom_path = argv[++i];
+        } else if (arg_is(argv[i], "--tsv")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.tsv_path = argv[++i];
+        } else if (arg_is(argv[i], "-i")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.interval = atof(argv[++i]);
+        } else if (arg_is(argv[i], "-n")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.count = atol(argv[++i]);
+        } else if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg.session = atoi(argv[++i]);
+        } else {
+            ERR_MSG("Unknown option '%s'", argv[i]);
+            exit(4);
+        }
+    }
+
+    if (cfg.prom_path == NULL && cfg.tsv_path == NULL) {
+        ERR_MSG("Nothing to export, use --prom and/or --tsv");
+        exit(4);
+    }
+    if (cfg.interval <= 0 || cfg.count < 0) {
+        ERR_MSG("Interval must be positive and the number of samples non-negative");
+        exit(4);
+    }
+    if (cfg.session < 0 || cfg.session >= VPMU_DEVICE_MAX_SESSIONS) {
+        ERR_MSG("Session must be in 0..%d", VPMU_DEVICE_MAX_SESSIONS - 1);
+        exit(4);
+    }
+    sprintf(dev_path, "/dev/vpmu-device-%d", cfg.session);
+
+    act.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    handler = vpmu_open(dev_path);
+    run_exporter(handler, &cfg);
+    vpmu_close(handler);
+    return 0;
+}
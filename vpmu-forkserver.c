@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <stdint.h>   // uint32_t
+#include <unistd.h>   // read(), write(), fork()
+#include <sys/wait.h> // waitpid()
+
+#include "vpmu-forkserver.h"
+
+// This library is injected into the target through LD_PRELOAD by the controller.
+// Its constructor runs after the dynamic linker has loaded and relocated all the
+// libraries, i.e. right before main() of the target. From there on, it serves the
+// requests of controller and every child starts from this pre-initialized image.
+__attribute__((constructor)) static void vpmu_forkserver_init(void)
+{
+    uint32_t msg    = VPMU_FORKSRV_HELLO;
+    int      status = 0;
+    pid_t    pid    = 0;
+
+    // Do not propagate the fork server to the descendants of target
+    unsetenv("LD_PRELOAD");
+    // Not launched by the controller, run the program as usual
+    if (write(VPMU_FORKSRV_STATUS_FD, &msg, sizeof(msg)) != sizeof(msg)) return;
+
+    while (1) {
+        // The controller closes the pipe when there is no more runs
+        if (read(VPMU_FORKSRV_FD, &msg, sizeof(msg)) != sizeof(msg)) _exit(0);
+
+        pid = fork();
+        if (pid < 0) _exit(1);
+        if (pid == 0) {
+            // We are the child, close the pipes and go to main()
+            close(VPMU_FORKSRV_FD);
+            close(VPMU_FORKSRV_STATUS_FD);
+            return;
+        }
+        if (write(VPMU_FORKSRV_STATUS_FD, &pid, sizeof(pid)) != sizeof(pid)) _exit(1);
+        if (waitpid(pid, &status, 0) < 0) _exit(1);
+        if (write(VPMU_FORKSRV_STATUS_FD, &status, sizeof(status)) != sizeof(status))
+            _exit(1);
+    }
+}
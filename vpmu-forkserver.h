@@ -0,0 +1,18 @@
+#ifndef __VPMU_FORKSERVER_H_
+#define __VPMU_FORKSERVER_H_
+
+// The fork server is a preloaded library (vpmu-forkserver-xxx.so) which stops the
+// target right before main() and forks a fresh child on every request of the
+// controller. The controller talks to it through two pipes with fixed numbers.
+#define VPMU_FORKSRV_FD        198 ///< Control pipe, controller -> server
+#define VPMU_FORKSRV_STATUS_FD 199 ///< Status pipe, server -> controller
+
+#define VPMU_FORKSRV_HELLO     0x56504d55 ///< "VPMU", sent once the server is ready
+#define VPMU_FORKSRV_RUN       0x1        ///< Ask the server to fork a new child
+
+// The name pattern used for searching the preload library next to the controller
+#define VPMU_FORKSRV_LIB_PATTERN "vpmu-forkserver-*.so"
+// Environment variable overriding the path to the preload library
+#define VPMU_FORKSRV_LIB_ENV "VPMU_FORKSERVER_LIB"
+
+#endif
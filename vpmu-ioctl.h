@@ -0,0 +1,53 @@
+#ifndef __VPMU_IOCTL_H_
+#define __VPMU_IOCTL_H_
+// This header is shared by the device driver and user space programs
+
+#ifdef __KERNEL__
+#include <linux/types.h> // uint32_t, uint64_t
+#include <linux/ioctl.h> // _IOR(), _IOWR()
+#else
+#include <stdint.h>    // uint32_t, uint64_t
+#include <sys/ioctl.h> // _IOR(), _IOWR()
+#endif
+
+#define VPMU_IOCTL_VERSION       1
+#define VPMU_IOCTL_MAGIC         0x7A // The same as VPMU_DEVICE_MAJOR_NUM
+#define VPMU_IOCTL_MAX_CMDS      256
+#define VPMU_IOCTL_MAX_FILE_SIZE (256 << 20) // 256 MB
+
+// Command opcodes of a batch
+#define VPMU_CMD_WRITE         0x1 ///< Write arg[1] to the register at offset arg[0]
+#define VPMU_CMD_READ          0x2 ///< Read the register at offset arg[0] into arg[1]
+#define VPMU_CMD_SEND_FD       0x3 ///< Ship the file of fd arg[0] named by arg[1]
+#define VPMU_CMD_ATTACH_CGROUP 0x4 ///< Count the processes in cgroup dir fd arg[0]
+#define VPMU_CMD_DETACH_CGROUP 0x5 ///< Stop counting the cgroup of this session
+#define VPMU_CMD_SEND_BUFFER   0x6 ///< Ship arg[1] bytes at arg[0] named by arg[2]
+#define VPMU_CMD_WRITE_NAME    0x7 ///< Write the name at arg[1] to ADD/REMOVE_PROC_NAME
+
+typedef struct VPMUCommand {
+    uint64_t op;
+    uint64_t arg[3];
+} VPMUCommand;
+
+typedef struct VPMUCommandBatch {
+    uint32_t version;  ///< Must be VPMU_IOCTL_VERSION
+    uint32_t num_cmds; ///< Number of commands in the array
+    uint64_t cmds;     ///< User pointer to an array of VPMUCommand
+    uint32_t num_done; ///< Output: number of commands completed successfully
+    int32_t  error;    ///< Output: the error code of the first failed command
+} VPMUCommandBatch;
+
+typedef struct VPMUNotifyRead {
+    uint32_t max_records; ///< Capacity of the array
+    uint32_t num_records; ///< Output: number of records copied
+    uint64_t records;     ///< User pointer to an array of VPMUEventRecord
+    uint32_t dropped;     ///< Output: records dropped by VPMU since the ring was full
+    uint32_t reserved;
+} VPMUNotifyRead;
+
+#define VPMU_IOCTL_GET_VERSION _IOR(VPMU_IOCTL_MAGIC, 0, uint32_t)
+#define VPMU_IOCTL_SUBMIT      _IOWR(VPMU_IOCTL_MAGIC, 1, VPMUCommandBatch)
+// Block until notifications arrive (unless O_NONBLOCK) and copy them out
+#define VPMU_IOCTL_READ_NOTIFY _IOWR(VPMU_IOCTL_MAGIC, 2, VPMUNotifyRead)
+
+#endif
@@ -0,0 +1,900 @@
+#ifdef DRY_RUN
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // bool
+#include <string.h>    // memset(), strncpy()
+#include <stddef.h>    // offsetof()
+#include <stdarg.h>    // va_list
+#include <inttypes.h>  // PRIxPTR
+#include <time.h>      // clock_gettime()
+#include <unistd.h>    // ftruncate()
+#include <fcntl.h>     // open()
+#include <sys/mman.h>  // mmap()
+#include <sys/stat.h>  // fstat()
+#include <pthread.h>   // pthread_create()
+
+#include "vpmu-model.h"
+#include "vpmu-device.h" // Register map of VPMU
+#include "vpmu-object.h" // VPMUCounterBlock
+#include "vpmu-event.h"  // VPMUEventRing
+#include "vpmu-config.h" // vpmu_print_model_config()
+
+#define VPMU_MODEL_MAGIC     0x4c444f4d // "MODL"
+#define VPMU_MODEL_VERSION   3
+#define VPMU_MODEL_MAX_NAMES 64
+#define VPMU_MODEL_MAX_PIDS  64
+#define VPMU_MODEL_NAME_LEN  256
+// Sampled simulation pretends every run is this many periods long
+#define VPMU_MODEL_SAMPLES   64
+// The clock of the model ticks every 1 ms of the host, one tick is 100 steps of the
+// counters for the pc sampling
+#define VPMU_MODEL_TICK_NS        1000000
+#define VPMU_MODEL_TICK_STEPS     100
+#define VPMU_MODEL_SCAN_TICKS     10  // Look for new tasks every 10 ticks
+#define VPMU_MODEL_TICK_SAMPLES   256 // Samples of a tick at most, the rest is lost
+#define VPMU_MODEL_MAX_TASKS      16
+#define VPMU_MODEL_TRACE_RECORDS  4096
+#define VPMU_MODEL_NOTIFY_RECORDS 256
+#define VPMU_MODEL_PHASE_TICKS    100 // A phase change every 100 ticks with VPMU_PHASEDET
+#define VPMU_MODEL_RING_SIZE(n)   (sizeof(VPMUEventRing) + (n) * sizeof(VPMUEventRecord))
+
+// The counters of the model, indexed by VPMU_PERF_xxx. Each snapshot of the counter
+// block advances the counters by step while profiling is enabled.
+static const struct {
+    const char *name;
+    uint64_t    step;
+} model_counters[] = {
+  {"instructions", 1000},
+  {"cycles", 1500},
+  {"icache_misses", 10},
+  {"dcache_misses", 40},
+  {"branches", 200},
+  {"branch_misses", 8},
+};
+#define VPMU_MODEL_NUM_COUNTERS (sizeof(model_counters) / sizeof(model_counters[0]))
+#define VPMU_MODEL_SAMPLES_SIZE                                                          \
+    (sizeof(VPMUSampleHeader)                                                            \
+     + VPMU_MODEL_SAMPLES * VPMU_MODEL_NUM_COUNTERS * sizeof(uint64_t))
+
+// A made-up program for VPMU_FUNC_PROFILE: its functions and the call paths taken, from
+// the root, with the share (permille) of the run spent in each leaf
+static const struct {
+    const char *name;
+    uint64_t    addr;
+    int         in_libc;
+} model_functions[] = {
+  {"main", 0x400500, 0},
+  {"parse_input", 0x400800, 0},
+  {"compute_kernel", 0x401000, 0},
+  {"hash_lookup", 0x400c00, 0},
+  {"memcpy", 0x7f0000021000, 1},
+};
+static const struct {
+    int path[4]; // Indexes of model_functions, -1 terminated
+    int permille;
+} model_stacks[] = {
+  {{0, -1}, 50},
+  {{0, 1, -1}, 150},
+  {{0, 1, 4, -1}, 100},
+  {{0, 2, -1}, 400},
+  {{0, 2, 3, -1}, 200},
+  {{0, 2, 4, -1}, 100},
+};
+#define VPMU_MODEL_NUM_FUNCTIONS (sizeof(model_functions) / sizeof(model_functions[0]))
+#define VPMU_MODEL_NUM_STACKS    (sizeof(model_stacks) / sizeof(model_stacks[0]))
+#define VPMU_MODEL_PROFILE_SIZE  0x2000
+
+// Everything lives in the shared memory file
+typedef struct VPMUModel {
+    uint32_t        magic;
+    uint32_t        version;
+    uint64_t        enabled;
+    uint64_t        timing_model;
+    uint64_t        counters[VPMU_MODEL_NUM_COUNTERS];
+    uint64_t        snapshots; // Sequence number of the counter block
+    uint64_t        num_reports;
+    uint64_t        num_binaries;
+    uint64_t        binary_bytes;
+    uintptr_t       proc_size; // Size of the binary of the next SET_PROC_BIN
+    char            proc_name[VPMU_MODEL_NAME_LEN];
+    char            monitored[VPMU_MODEL_MAX_NAMES][VPMU_MODEL_NAME_LEN];
+    uint64_t        pids[VPMU_MODEL_MAX_PIDS];
+    uint64_t        num_configs;
+    uint64_t        has_pending; // A configuration is written and waits for a reset
+    VPMUModelConfig config;
+    VPMUModelConfig pending;
+    uint64_t        sample_events; // Events of the pc sampling counter not sampled yet
+    uint64_t        sim_ns;        // Simulated time, one tick is 1 ms
+    uint64_t        phase;         // The current phase of VPMU_PHASEDET
+    uint64_t        threshold_hit; // The threshold has been notified
+    uint64_t        watermark_hit; // The watermark has been notified
+    // The notify ring (VPMU_MMAP_NOTIFY_RING_ADDR), drained by the library as the driver
+    uint64_t        notify_ring[VPMU_MODEL_RING_SIZE(VPMU_MODEL_NOTIFY_RECORDS) / 8];
+    // The trace ring (VPMU_MMAP_TRACE_RING_ADDR), mapped by the library from here
+    uint64_t        trace_ring[VPMU_MODEL_RING_SIZE(VPMU_MODEL_TRACE_RECORDS) / 8];
+    // The register window, including the staging area
+    uintptr_t       regs[VPMU_DEVICE_IOMEM_SIZE / sizeof(uintptr_t)];
+} VPMUModel;
+
+static FILE *model_transcript = NULL;
+
+// A task of the guest as seen by the model, i.e. a child process of the host process
+typedef struct ModelTask {
+    pid_t    pid;
+    char     exe[VPMU_MODEL_NAME_LEN]; // Image, a new one means the task exec'ed
+    uint64_t text_start;               // The executable mapping of the image
+    uint64_t text_len;
+} ModelTask;
+
+// The clock of the model runs in a thread of the process enabling VPMU, as VPMU runs
+// beside the guest. It produces the records of the rings. The counters still advance
+// on each snapshot only.
+static struct {
+    pthread_t    thread;
+    VPMUModel *  model;
+    volatile int running;
+    uint64_t     ticks;
+    ModelTask    tasks[VPMU_MODEL_MAX_TASKS];
+    int          num_tasks;
+} model_clock;
+
+static inline VPMUModel *model_of(uintptr_t *regs)
+{
+    return (VPMUModel *)((char *)regs - offsetof(VPMUModel, regs));
+}
+
+static inline uint64_t model_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// One line per access or event: time (ns), R/W/#event, register, value
+static void model_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (model_transcript == NULL) return;
+    fprintf(model_transcript, "%" PRIu64 "\t", model_time_ns());
+    va_start(ap, fmt);
+    vfprintf(model_transcript, fmt, ap);
+    va_end(ap);
+    fputc('\n', model_transcript);
+}
+
+// FNV-1a, enough for telling whether the same bytes were shipped
+static uint32_t model_checksum(const void *buf, size_t size)
+{
+    const unsigned char *p    = (const unsigned char *)buf;
+    uint32_t             hash = 2166136261u;
+    size_t               i    = 0;
+
+    for (i = 0; i < size; i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+// Find the slot of name in the list, or an empty one if name is NULL
+static int model_find_name(VPMUModel *m, const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < VPMU_MODEL_MAX_NAMES; i++) {
+        if (name == NULL && m->monitored[i][0] == '\0') return i;
+        if (name && strncmp(m->monitored[i], name, VPMU_MODEL_NAME_LEN) == 0) return i;
+    }
+    return -1;
+}
+
+static int model_find_pid(VPMUModel *m, uint64_t pid)
+{
+    int i = 0;
+
+    for (i = 0; i < VPMU_MODEL_MAX_PIDS; i++) {
+        if (m->pids[i] == pid) return i;
+    }
+    return -1;
+}
+
+// Bigger caches and predictors miss less, just enough to tell configurations apart
+static uint64_t model_step(VPMUModel *m, int index)
+{
+    const VPMUModelConfig *c    = &m->config;
+    uint64_t               step = model_counters[index].step;
+
+    if (index == VPMU_PERF_ICACHE_MISSES && c->caches[VPMU_CACHE_L1I].size)
+        step = step * 32768 / c->caches[VPMU_CACHE_L1I].size;
+    if (index == VPMU_PERF_DCACHE_MISSES && c->caches[VPMU_CACHE_L1D].size)
+        step = step * 32768 / c->caches[VPMU_CACHE_L1D].size;
+    if (index == VPMU_PERF_BRANCH_MISSES && c->predictor_entries)
+        step = step * 4096 / c->predictor_entries;
+    return step;
+}
+
+// Take VPMUModelConfig from the staging area, return the number of bytes taken
+static uintptr_t model_config_write(VPMUModel *m, uintptr_t count)
+{
+    const VPMUModelConfig *config =
+      (const VPMUModelConfig *)&m->regs[VPMU_MMAP_STAGING_BASE / sizeof(uintptr_t)];
+
+    if (count < offsetof(VPMUModelConfig, caches) || count > VPMU_MMAP_STAGING_SIZE
+        || config->magic != VPMU_MODEL_CONFIG_MAGIC
+        || config->version != VPMU_MODEL_CONFIG_VERSION || config->size > count)
+        return 0;
+    // Fields unknown to the writer are left 0
+    memset(&m->pending, 0, sizeof(m->pending));
+    memcpy(&m->pending,
+           config,
+           (config->size < sizeof(m->pending)) ? config->size : sizeof(m->pending));
+    m->has_pending = 1;
+    model_log("#config\tpending");
+    return count;
+}
+
+static void model_report(VPMUModel *m)
+{
+    int i = 0;
+
+    m->num_reports++;
+    printf("[vpmu-model]  Report #%" PRIu64 " (timing model 0x%" PRIx64 ")\n",
+           m->num_reports,
+           m->timing_model);
+    if (m->num_configs) {
+        printf("[vpmu-model]  Model configuration #%" PRIu64 "\n", m->num_configs);
+        vpmu_print_model_config(&m->config);
+    }
+    for (i = 0; i < VPMU_MODEL_NUM_COUNTERS; i++) {
+        printf("[vpmu-model]    %-16s %" PRIu64 "\n",
+               model_counters[i].name,
+               m->counters[i]);
+    }
+    model_log("#report\t%" PRIu64, m->num_reports);
+}
+
+// Build the sample stream of sampled simulation, return its size
+static size_t model_samples(VPMUModel *m, void *buf)
+{
+    VPMUSampleHeader *header = (VPMUSampleHeader *)buf;
+    uint64_t *        row    = (uint64_t *)(header + 1);
+    uint64_t          hash   = 0;
+    int               i = 0, c = 0;
+
+    memset(header, 0, sizeof(*header));
+    header->magic        = VPMU_SAMPLES_MAGIC;
+    header->version      = VPMU_SAMPLES_VERSION;
+    header->num_counters = VPMU_MODEL_NUM_COUNTERS;
+    header->num_samples  = VPMU_MODEL_SAMPLES;
+    header->fast_forward = m->regs[VPMU_MMAP_SAMPLE_FAST_FORWARD / sizeof(uintptr_t)];
+    header->warmup       = m->regs[VPMU_MMAP_SAMPLE_WARMUP / sizeof(uintptr_t)];
+    header->detailed     = m->regs[VPMU_MMAP_SAMPLE_DETAILED / sizeof(uintptr_t)];
+    header->total_instructions =
+      VPMU_MODEL_SAMPLES * (header->fast_forward + header->warmup + header->detailed);
+    for (c = 0; c < VPMU_MODEL_NUM_COUNTERS; c++)
+        strncpy(header->names[c], model_counters[c].name, sizeof(header->names[c]) - 1);
+
+    // The rates of the steps, off by up to 10% in each interval
+    for (i = 0; i < VPMU_MODEL_SAMPLES; i++, row += VPMU_MODEL_NUM_COUNTERS) {
+        row[0] = header->detailed;
+        for (c = 1; c < VPMU_MODEL_NUM_COUNTERS; c++) {
+            hash   = ((uint64_t)(i + 1) * 2654435761u) ^ ((uint64_t)c * 40503u);
+            row[c] = model_step(m, c) * header->detailed
+                     * (1000 + (int64_t)(hash % 201) - 100)
+                     / (model_counters[0].step * 1000);
+        }
+    }
+    return (char *)row - (char *)buf;
+}
+
+// Build the profile stream of VPMU_FUNC_PROFILE, return its size. The run is 1000
+// steps of the counters.
+static size_t model_profile(VPMUModel *m, void *buf)
+{
+    VPMUProfileHeader *header      = (VPMUProfileHeader *)buf;
+    char *             p           = (char *)(header + 1);
+    const char *       binary      = (m->proc_name[0]) ? m->proc_name : "a.out";
+    uint64_t           depth       = m->regs[VPMU_MMAP_PROFILE_DEPTH / sizeof(uintptr_t)];
+    char               strtab[512] = {};
+    uint32_t           names[VPMU_MODEL_NUM_FUNCTIONS] = {};
+    uint32_t           binaries[2]                     = {};
+    uint32_t           strtab_size = 1; // Offset 0 is ""
+    int                i = 0, c = 0, f = 0, n = 0;
+
+    memset(header, 0, sizeof(*header));
+    header->magic         = VPMU_PROFILE_MAGIC;
+    header->version       = VPMU_PROFILE_VERSION;
+    header->num_counters  = VPMU_MODEL_NUM_COUNTERS;
+    header->num_functions = VPMU_MODEL_NUM_FUNCTIONS;
+    header->num_stacks    = (depth) ? VPMU_MODEL_NUM_STACKS : 0;
+    for (c = 0; c < VPMU_MODEL_NUM_COUNTERS; c++)
+        strncpy(header->names[c], model_counters[c].name, sizeof(header->names[c]) - 1);
+
+    // The string table holds each name once
+    binaries[0] = strtab_size;
+    strtab_size += snprintf(strtab + strtab_size, 128, "%.126s", binary) + 1;
+    binaries[1] = strtab_size;
+    strtab_size += sprintf(strtab + strtab_size, "libc.so.6") + 1;
+    for (f = 0; f < VPMU_MODEL_NUM_FUNCTIONS; f++) {
+        names[f] = strtab_size;
+        strtab_size += sprintf(strtab + strtab_size, "%s", model_functions[f].name) + 1;
+    }
+
+    // The self counts of a function are the sum of the stacks where it is the leaf
+    for (f = 0; f < VPMU_MODEL_NUM_FUNCTIONS; f++) {
+        VPMUProfileFunction *func = (VPMUProfileFunction *)p;
+
+        func->addr   = model_functions[f].addr;
+        func->name   = names[f];
+        func->binary = binaries[model_functions[f].in_libc];
+        for (c = 0; c < VPMU_MODEL_NUM_COUNTERS; c++) func->values[c] = 0;
+        for (i = 0; i < VPMU_MODEL_NUM_STACKS; i++) {
+            for (n = 0; model_stacks[i].path[n + 1] >= 0; n++)
+                ;
+            if (model_stacks[i].path[n] != f) continue;
+            for (c = 0; c < VPMU_MODEL_NUM_COUNTERS; c++)
+                func->values[c] += model_step(m, c) * model_stacks[i].permille;
+        }
+        p += VPMU_PROFILE_FUNCTION_SIZE(VPMU_MODEL_NUM_COUNTERS);
+    }
+    for (i = 0; i < header->num_stacks; i++) {
+        VPMUProfileStack *stack = (VPMUProfileStack *)p;
+
+        for (n = 0; model_stacks[i].path[n] >= 0; n++)
+            ;
+        // Deeper stacks are cut at the root side
+        stack->depth    = (n < depth) ? n : depth;
+        stack->reserved = 0;
+        for (c = 0; c < VPMU_MODEL_NUM_COUNTERS; c++)
+            stack->values[c] = model_step(m, c) * model_stacks[i].permille;
+        for (f = 0; f < stack->depth; f++)
+            stack->values[VPMU_MODEL_NUM_COUNTERS + f] =
+              model_functions[model_stacks[i].path[n - 1 - f]].addr;
+        p += VPMU_PROFILE_STACK_SIZE(VPMU_MODEL_NUM_COUNTERS, stack->depth);
+    }
+    memcpy(p, strtab, strtab_size);
+    p += strtab_size;
+    header->strtab_size = strtab_size;
+    header->total_size  = p - (char *)buf;
+    return header->total_size;
+}
+
+// Fill the staging area with the stream at pos, return the number of bytes
+static uintptr_t model_xfer_read(VPMUModel *m, uint64_t pos, uintptr_t count)
+{
+    VPMUCounterBlock *block = (VPMUCounterBlock *)&m->regs[VPMU_MMAP_STAGING_BASE
+                                                           / sizeof(uintptr_t)];
+    static char samples[VPMU_MODEL_SAMPLES_SIZE];
+    static char profile[VPMU_MODEL_PROFILE_SIZE];
+    size_t      size = 0;
+    int         i    = 0;
+
+    if (count > VPMU_MMAP_STAGING_SIZE) count = VPMU_MMAP_STAGING_SIZE;
+    if (pos >= VPMU_STREAM_PROFILE && (m->timing_model & VPMU_FUNC_PROFILE)) {
+        size = model_profile(m, profile);
+        if (pos - VPMU_STREAM_PROFILE >= size) return 0;
+        if (count > size - (pos - VPMU_STREAM_PROFILE))
+            count = size - (pos - VPMU_STREAM_PROFILE);
+        memcpy(block, profile + (pos - VPMU_STREAM_PROFILE), count);
+        return count;
+    }
+    if (pos >= VPMU_STREAM_SAMPLES && (m->timing_model & VPMU_SAMPLED_SIM)) {
+        size = model_samples(m, samples);
+        if (pos - VPMU_STREAM_SAMPLES >= size) return 0;
+        if (count > size - (pos - VPMU_STREAM_SAMPLES))
+            count = size - (pos - VPMU_STREAM_SAMPLES);
+        memcpy(block, samples + (pos - VPMU_STREAM_SAMPLES), count);
+        return count;
+    }
+    // Only the counter block and the samples are modeled, other streams are empty
+    if (pos != VPMU_STREAM_COUNTERS) return 0;
+
+    if (m->enabled) {
+        for (i = 0; i < VPMU_MODEL_NUM_COUNTERS; i++)
+            m->counters[i] += model_step(m, i);
+    }
+    memset(block, 0, VPMU_COUNTER_BLOCK_SIZE);
+    block->magic        = VPMU_COUNTERS_MAGIC;
+    block->version      = VPMU_COUNTERS_VERSION;
+    block->num_counters = VPMU_MODEL_NUM_COUNTERS;
+    block->sequence     = ++m->snapshots;
+    block->timestamp    = m->counters[VPMU_PERF_CYCLES]; // 1 GHz
+    for (i = 0; i < VPMU_MODEL_NUM_COUNTERS; i++) {
+        strncpy(block->counters[i].name,
+                model_counters[i].name,
+                sizeof(block->counters[i].name) - 1);
+        block->counters[i].value = m->counters[i];
+    }
+    return (count < VPMU_COUNTER_BLOCK_SIZE) ? count : VPMU_COUNTER_BLOCK_SIZE;
+}
+
+static inline VPMUEventRing *model_trace_ring(VPMUModel *m)
+{
+    return (VPMUEventRing *)m->trace_ring;
+}
+
+static inline VPMUEventRing *model_notify_ring(VPMUModel *m)
+{
+    return (VPMUEventRing *)m->notify_ring;
+}
+
+static void model_ring_init(VPMUEventRing *ring, uint32_t num_records)
+{
+    if (ring->magic == VPMU_EVENT_RING_MAGIC) return;
+    memset(ring, 0, VPMU_MODEL_RING_SIZE(num_records));
+    ring->magic       = VPMU_EVENT_RING_MAGIC;
+    ring->version     = VPMU_EVENT_RING_VERSION;
+    ring->record_size = sizeof(VPMUEventRecord);
+    ring->num_records = num_records;
+}
+
+// The producer side of VPMUEventRing, drop the record if the ring is full
+static void model_ring_push(VPMUEventRing *ring, const VPMUEventRecord *record)
+{
+    uint32_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->num_records) {
+        ring->dropped++;
+        return;
+    }
+    ring->records[head & (ring->num_records - 1)] = *record;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Push the record and its VPMU_EVENT_NAME records, the same as record_event_name() of
+// the driver
+static void model_ring_push_named(VPMUEventRing *        ring,
+                                  const VPMUEventRecord *record,
+                                  const char *           name,
+                                  uint64_t               pgoff)
+{
+    VPMUEventRecord chunk     = *record;
+    char            bytes[16] = {};
+    size_t          len       = strnlen(name, VPMU_EVENT_NAME_MAX);
+    size_t          i         = 0;
+
+    model_ring_push(ring, record);
+    chunk.event = VPMU_EVENT_NAME;
+    chunk.flags = 0;
+    chunk.addr  = pgoff;
+    chunk.len   = len;
+    model_ring_push(ring, &chunk);
+    for (i = 0; i < len; i += sizeof(bytes)) {
+        memset(bytes, 0, sizeof(bytes));
+        memcpy(bytes, name + i, (len - i < sizeof(bytes)) ? len - i : sizeof(bytes));
+        memcpy(&chunk.addr, bytes, 8);
+        memcpy(&chunk.len, bytes + 8, 8);
+        chunk.flags = i / sizeof(bytes) + 1;
+        model_ring_push(ring, &chunk);
+    }
+}
+
+// The EXEC record of the task and the MMAP records of its executable file mappings
+static void model_task_exec(VPMUModel *m, ModelTask *task)
+{
+    VPMUEventRecord record = {};
+    char            path[64], line[512], perms[8], name[VPMU_MODEL_NAME_LEN];
+    uint64_t        start = 0, end = 0, pgoff = 0;
+    FILE *          fp    = NULL;
+
+    record.timestamp = model_time_ns();
+    record.pid       = task->pid;
+    record.tid       = task->pid;
+    record.event     = VPMU_EVENT_EXEC;
+    snprintf(path, sizeof(path), "/proc/%d/comm", (int)task->pid);
+    fp = fopen(path, "r");
+    if (fp == NULL || fgets(name, sizeof(name), fp) == NULL) snprintf(name, 2, "?");
+    if (fp) fclose(fp);
+    name[strcspn(name, "\n")] = '\0';
+    model_ring_push_named(model_trace_ring(m), &record, name, 0);
+
+    task->text_start = 0;
+    task->text_len   = 0;
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)task->pid);
+    fp = fopen(path, "r");
+    while (fp && fgets(line, sizeof(line), fp)) {
+        name[0] = '\0';
+        if (sscanf(line,
+                   "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %*s %*s %255[^\n]",
+                   &start,
+                   &end,
+                   perms,
+                   &pgoff,
+                   name)
+              < 5
+            || perms[2] != 'x' || name[0] != '/')
+            continue;
+        record.event = VPMU_EVENT_MMAP;
+        record.flags = 0x4; // VM_EXEC
+        record.addr  = start;
+        record.len   = end - start;
+        model_ring_push_named(model_trace_ring(m), &record, name, pgoff);
+        // Samples hit the text of the image, or of the first library
+        if (task->text_len == 0 || strcmp(name, task->exe) == 0) {
+            task->text_start = start;
+            task->text_len   = end - start;
+        }
+    }
+    if (fp) fclose(fp);
+    model_log("#exec\t%d\t%s", (int)task->pid, task->exe);
+}
+
+// Emulate the event ring of the guest kernel with the child processes of this process:
+// FORK and EXEC records for the new ones, EXEC again when the image changes, and EXIT
+// records for the ones gone
+static void model_scan_tasks(VPMUModel *m)
+{
+    VPMUEventRecord record = {};
+    ModelTask *     task   = NULL;
+    char            path[64], exe[VPMU_MODEL_NAME_LEN];
+    bool            alive[VPMU_MODEL_MAX_TASKS] = {};
+    int             pid = 0, i = 0;
+    ssize_t         len = 0;
+    FILE *          fp  = NULL;
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", getpid(), getpid());
+    fp = fopen(path, "r");
+    while (fp && fscanf(fp, "%d", &pid) == 1) {
+        snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+        len = readlink(path, exe, sizeof(exe) - 1);
+        if (len <= 0) continue; // A zombie
+        exe[len] = '\0';
+        for (i = 0; i < model_clock.num_tasks && model_clock.tasks[i].pid != pid; i++)
+            ;
+        task = &model_clock.tasks[i];
+        if (i == model_clock.num_tasks) {
+            if (i == VPMU_MODEL_MAX_TASKS) continue;
+            memset(task, 0, sizeof(*task));
+            task->pid = pid;
+            model_clock.num_tasks++;
+            record.timestamp = model_time_ns();
+            record.pid       = getpid();
+            record.tid       = getpid();
+            record.event     = VPMU_EVENT_FORK;
+            record.addr      = pid;
+            model_ring_push(model_trace_ring(m), &record);
+        }
+        alive[i] = true;
+        if (strcmp(task->exe, exe) == 0) continue;
+        strcpy(task->exe, exe);
+        model_task_exec(m, task);
+    }
+    if (fp) fclose(fp);
+
+    for (i = model_clock.num_tasks - 1; i >= 0; i--) {
+        if (alive[i]) continue;
+        memset(&record, 0, sizeof(record));
+        record.timestamp = model_time_ns();
+        record.pid       = model_clock.tasks[i].pid;
+        record.tid       = model_clock.tasks[i].pid;
+        record.event     = VPMU_EVENT_EXIT;
+        model_ring_push(model_trace_ring(m), &record);
+        model_clock.tasks[i] = model_clock.tasks[--model_clock.num_tasks];
+    }
+}
+
+// Push a VPMU_EVENT_SAMPLE record every VPMU_MMAP_PC_SAMPLE_PERIOD events of the counter
+static void model_pc_samples(VPMUModel *m)
+{
+    uintptr_t       counter = m->regs[VPMU_MMAP_PC_SAMPLE_COUNTER / sizeof(uintptr_t)];
+    uintptr_t       period  = m->regs[VPMU_MMAP_PC_SAMPLE_PERIOD / sizeof(uintptr_t)];
+    VPMUEventRecord record  = {};
+    ModelTask *     task    = NULL;
+    uint64_t        n       = 0;
+
+    if (period == 0 || counter >= VPMU_MODEL_NUM_COUNTERS) return;
+    m->sample_events += model_step(m, counter) * VPMU_MODEL_TICK_STEPS;
+    record.timestamp = model_time_ns();
+    record.event     = VPMU_EVENT_SAMPLE;
+    record.len       = period;
+    for (n = 0; m->sample_events >= period; n++, m->sample_events -= period) {
+        if (n == VPMU_MODEL_TICK_SAMPLES) {
+            m->sample_events = 0;
+            break;
+        }
+        // The tasks take turns, a few hot spots in the text and one in ten in the kernel
+        task = NULL;
+        if (model_clock.num_tasks) task = &model_clock.tasks[n % model_clock.num_tasks];
+        record.pid   = (task) ? task->pid : 0;
+        record.tid   = record.pid;
+        record.flags = counter;
+        if (task == NULL || task->text_len == 0 || n % 10 == 9) {
+            record.flags |= VPMU_EVENT_SAMPLE_KERNEL;
+            record.addr = 0xffffffff81000000ULL + (n % 64) * 16;
+        } else {
+            record.addr = task->text_start
+                          + ((n % 3) * 0x400 + (n % 17) * 4) % task->text_len;
+        }
+        record.timestamp += 1000;
+        model_ring_push(model_trace_ring(m), &record);
+    }
+}
+
+// The tasks are followed while tracing or sampling the pc
+static inline bool model_follows_tasks(VPMUModel *m)
+{
+    return (m->timing_model & VPMU_EVENT_TRACE)
+           || m->regs[VPMU_MMAP_PC_SAMPLE_PERIOD / sizeof(uintptr_t)] != 0;
+}
+
+// Push a notification of the source if it is enabled, and raise the status
+static bool model_notify(VPMUModel *m, uint32_t source, VPMUEventRecord *record)
+{
+    if (!(m->regs[VPMU_MMAP_NOTIFY_ENABLE / sizeof(uintptr_t)] & source)) return false;
+    record->timestamp = m->sim_ns;
+    model_ring_push(model_notify_ring(m), record);
+    __atomic_or_fetch(
+      &m->regs[VPMU_MMAP_NOTIFY_STATUS / sizeof(uintptr_t)], source, __ATOMIC_RELEASE);
+    model_log("#notify\t0x%x\t0x%" PRIx64, record->event, record->addr);
+    return true;
+}
+
+// Phase changes, the threshold of a counter and the watermark of the trace ring
+static void model_notifications(VPMUModel *m)
+{
+    const uintptr_t *regs      = m->regs;
+    uintptr_t        counter   = regs[VPMU_MMAP_NOTIFY_COUNTER / sizeof(uintptr_t)];
+    uintptr_t        threshold = regs[VPMU_MMAP_NOTIFY_THRESHOLD / sizeof(uintptr_t)];
+    uintptr_t        watermark = regs[VPMU_MMAP_TRACE_RING_WATERMARK / sizeof(uintptr_t)];
+    VPMUEventRing *  trace     = model_trace_ring(m);
+    uint32_t         used      = trace->head - trace->tail;
+    VPMUEventRecord  record    = {};
+
+    if ((m->timing_model & VPMU_PHASEDET) && model_clock.ticks
+        && model_clock.ticks % VPMU_MODEL_PHASE_TICKS == 0) {
+        record.event = VPMU_EVENT_PHASE;
+        record.addr  = ++m->phase;
+        record.len   = VPMU_MODEL_PHASE_TICKS * VPMU_MODEL_TICK_NS;
+        model_notify(m, VPMU_NOTIFY_PHASE, &record);
+    }
+    // The counters advance on snapshots, a reader of the counter block makes it fire
+    if (threshold && counter < VPMU_MODEL_NUM_COUNTERS && !m->threshold_hit
+        && m->counters[counter] >= threshold) {
+        record.event     = VPMU_EVENT_THRESHOLD;
+        record.flags     = counter;
+        record.addr      = m->counters[counter];
+        record.len       = 0;
+        m->threshold_hit = model_notify(m, VPMU_NOTIFY_THRESHOLD, &record);
+    }
+    // Once each time the ring fills up to the watermark
+    if (watermark && used < watermark) m->watermark_hit = 0;
+    if (watermark && used >= watermark && !m->watermark_hit) {
+        record.event     = VPMU_EVENT_TRACE_WATERMARK;
+        record.flags     = 0;
+        record.addr      = used;
+        record.len       = 0;
+        m->watermark_hit = model_notify(m, VPMU_NOTIFY_TRACE_WATERMARK, &record);
+    }
+}
+
+static void model_tick(VPMUModel *m)
+{
+    if (model_follows_tasks(m) && model_clock.ticks % VPMU_MODEL_SCAN_TICKS == 0)
+        model_scan_tasks(m);
+    if (m->enabled) model_pc_samples(m);
+    m->sim_ns += VPMU_MODEL_TICK_NS;
+    model_notifications(m);
+    model_clock.ticks++;
+}
+
+static void *model_clock_main(void *arg)
+{
+    struct timespec tick = {0, VPMU_MODEL_TICK_NS};
+
+    while (model_clock.running) {
+        model_tick(model_clock.model);
+        nanosleep(&tick, NULL);
+    }
+    return NULL;
+}
+
+static void model_clock_start(VPMUModel *m)
+{
+    if (model_clock.running) return;
+    model_clock.model     = m;
+    model_clock.running   = 1;
+    model_clock.ticks     = 0;
+    model_clock.num_tasks = 0;
+    if (pthread_create(&model_clock.thread, NULL, model_clock_main, NULL) != 0) {
+        fprintf(stderr, "[vpmu-model]  Failed to start the clock\n");
+        exit(4);
+    }
+}
+
+// Stop the clock, the records produced so far stay in the rings
+static void model_clock_stop(void)
+{
+    if (!model_clock.running) return;
+    model_clock.running = 0;
+    pthread_join(model_clock.thread, NULL);
+    // The tasks exited meanwhile
+    if (model_follows_tasks(model_clock.model)) model_scan_tasks(model_clock.model);
+}
+
+uintptr_t *vpmu_model_open(int session)
+{
+    char        path[256] = {};
+    const char *env       = getenv("VPMU_MODEL_FILE");
+    VPMUModel * m         = NULL;
+    struct stat st        = {};
+    int         fd        = -1;
+
+    if (env)
+        snprintf(path, sizeof(path), "%s", env);
+    else
+        snprintf(path, sizeof(path), "/dev/shm/vpmu-model-%d", session);
+
+    fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size < sizeof(VPMUModel))
+        ftruncate(fd, sizeof(VPMUModel));
+    if (fd >= 0)
+        m = (VPMUModel *)mmap(
+          NULL, sizeof(VPMUModel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // Fall back to a private model if the file is not available
+    if (m == NULL || m == MAP_FAILED)
+        m = (VPMUModel *)mmap(NULL,
+                              sizeof(VPMUModel),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS,
+                              -1,
+                              0);
+    if (fd >= 0) close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr, "[vpmu-model]  Failed to map the model\n");
+        exit(4);
+    }
+    if (m->magic != VPMU_MODEL_MAGIC || m->version != VPMU_MODEL_VERSION) {
+        memset(m, 0, sizeof(VPMUModel));
+        m->magic   = VPMU_MODEL_MAGIC;
+        m->version = VPMU_MODEL_VERSION;
+    }
+    model_ring_init(model_trace_ring(m), VPMU_MODEL_TRACE_RECORDS);
+    model_ring_init(model_notify_ring(m), VPMU_MODEL_NOTIFY_RECORDS);
+
+    env = getenv("VPMU_MODEL_TRANSCRIPT");
+    if (env && model_transcript == NULL) {
+        model_transcript = fopen(env, "a");
+        model_log("#open\tsession %d pid %d", session, (int)getpid());
+    }
+    return m->regs;
+}
+
+void vpmu_model_close(uintptr_t *regs)
+{
+    if (model_clock.model == model_of(regs)) model_clock_stop();
+    if (model_transcript) {
+        model_log("#close");
+        fclose(model_transcript);
+        model_transcript = NULL;
+    }
+    munmap(model_of(regs), sizeof(VPMUModel));
+}
+
+void vpmu_model_write(uintptr_t *regs, uintptr_t addr, uintptr_t value)
+{
+    VPMUModel *m    = model_of(regs);
+    void *     ptr  = (void *)value; // Pointers of this process are valid in the model
+    int        slot = 0;
+
+    model_log("W\t0x%04" PRIxPTR "\t0x%" PRIxPTR, addr, value);
+    if (addr >= VPMU_DEVICE_IOMEM_SIZE) {
+        fprintf(stderr, "[vpmu-model]  Write out of the window: 0x%" PRIxPTR "\n", addr);
+        exit(4);
+    }
+    // The status is raised by the clock and acknowledged by writes
+    if (addr != VPMU_MMAP_NOTIFY_STATUS) regs[addr / sizeof(uintptr_t)] = value;
+
+    switch (addr) {
+    case VPMU_MMAP_ENABLE:
+        m->enabled      = 1;
+        m->timing_model = value;
+        model_clock_start(m);
+        break;
+    case VPMU_MMAP_DISABLE:
+        m->enabled = 0;
+        // Tracing goes on till the session is closed
+        if (model_clock.model == m && !(m->timing_model & VPMU_EVENT_TRACE))
+            model_clock_stop();
+        break;
+    case VPMU_MMAP_REPORT:
+        model_report(m);
+        break;
+    case VPMU_MMAP_RESET:
+        memset(m->counters, 0, sizeof(m->counters));
+        if (m->has_pending) {
+            m->config      = m->pending;
+            m->has_pending = 0;
+            m->num_configs++;
+            model_log("#config\tapplied %" PRIu64, m->num_configs);
+        }
+        break;
+    case VPMU_MMAP_SET_TIMING_MODEL:
+        m->timing_model = value;
+        // Tracing starts with the monitored processes, not with VPMU_MMAP_ENABLE
+        if (value & VPMU_EVENT_TRACE) model_clock_start(m);
+        break;
+    case VPMU_MMAP_ADD_PROC_NAME:
+        if (ptr == NULL) break;
+        strncpy(m->proc_name, (const char *)ptr, VPMU_MODEL_NAME_LEN - 1);
+        if (model_find_name(m, m->proc_name) >= 0) break;
+        slot = model_find_name(m, NULL);
+        if (slot >= 0) strcpy(m->monitored[slot], m->proc_name);
+        model_log("#monitor\t%s", m->proc_name);
+        break;
+    case VPMU_MMAP_REMOVE_PROC_NAME:
+        if (ptr == NULL) break;
+        slot = model_find_name(m, (const char *)ptr);
+        if (slot >= 0) m->monitored[slot][0] = '\0';
+        model_log("#remove\t%s", (const char *)ptr);
+        break;
+    case VPMU_MMAP_SET_PROC_SIZE:
+        m->proc_size = value;
+        break;
+    case VPMU_MMAP_SET_PROC_BIN:
+        if (ptr == NULL) break;
+        m->num_binaries++;
+        m->binary_bytes += m->proc_size;
+        model_log("#binary\t%s\t%" PRIuPTR "\t%08x",
+                  m->proc_name,
+                  m->proc_size,
+                  model_checksum(ptr, m->proc_size));
+        break;
+    case VPMU_MMAP_ATTACH_PID:
+        if (model_find_pid(m, value) >= 0) break;
+        slot = model_find_pid(m, 0);
+        if (slot >= 0) m->pids[slot] = value;
+        break;
+    case VPMU_MMAP_NOTIFY_STATUS:
+        __atomic_and_fetch(&regs[addr / sizeof(uintptr_t)], ~value, __ATOMIC_ACQ_REL);
+        break;
+    case VPMU_MMAP_NOTIFY_COUNTER:
+    case VPMU_MMAP_NOTIFY_THRESHOLD:
+        m->threshold_hit = 0;
+        break;
+    case VPMU_MMAP_DETACH_PID:
+        slot = model_find_pid(m, value);
+        if (slot >= 0) m->pids[slot] = 0;
+        break;
+    case VPMU_MMAP_XFER_READ:
+        regs[VPMU_MMAP_XFER_RESULT / sizeof(uintptr_t)] =
+          model_xfer_read(m, regs[VPMU_MMAP_XFER_OFFSET / sizeof(uintptr_t)], value);
+        break;
+    case VPMU_MMAP_XFER_WRITE:
+        // Every other stream written is accepted and dropped
+        if (regs[VPMU_MMAP_XFER_OFFSET / sizeof(uintptr_t)] == VPMU_STREAM_MODEL_CONFIG)
+            value = model_config_write(m, value);
+        regs[VPMU_MMAP_XFER_RESULT / sizeof(uintptr_t)] = value;
+        break;
+    default:
+        // The rest are plain registers
+        break;
+    }
+}
+
+VPMUEventRing *vpmu_model_trace_ring(uintptr_t *regs, size_t *size)
+{
+    *size = VPMU_MODEL_RING_SIZE(VPMU_MODEL_TRACE_RECORDS);
+    return model_trace_ring(model_of(regs));
+}
+
+VPMUEventRing *vpmu_model_notify_ring(uintptr_t *regs)
+{
+    return model_notify_ring(model_of(regs));
+}
+
+uintptr_t vpmu_model_read(uintptr_t *regs, uintptr_t addr)
+{
+    VPMUModel *m     = model_of(regs);
+    uintptr_t  value = 0;
+
+    if (addr >= VPMU_DEVICE_IOMEM_SIZE) {
+        fprintf(stderr, "[vpmu-model]  Read out of the window: 0x%" PRIxPTR "\n", addr);
+        exit(4);
+    }
+    if (addr >= VPMU_MMAP_PERF_COUNTER(0)
+        && addr < VPMU_MMAP_PERF_COUNTER(VPMU_MODEL_NUM_COUNTERS))
+        value = m->counters[(addr - VPMU_MMAP_PERF_COUNTER(0)) / 8];
+    else
+        value = regs[addr / sizeof(uintptr_t)];
+    model_log("R\t0x%04" PRIxPTR "\t0x%" PRIxPTR, addr, value);
+    return value;
+}
+#endif
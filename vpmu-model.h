@@ -0,0 +1,28 @@
+#ifndef __VPMU_MODEL_H_
+#define __VPMU_MODEL_H_
+// A user space stand-in of VPMU for DRY_RUN builds. It implements the register map in
+// vpmu-device.h over a shared memory file so that the controller and the library can be
+// tested and benchmarked on a plain Linux host. The state is shared by every process
+// opening the same session, e.g. vpmu-control --start and then vpmu-exporter.
+// The rings are produced by a clock thread of the process writing VPMU_MMAP_ENABLE,
+// with the child processes of that process as the tasks of the guest.
+//
+// Environment variables:
+//   VPMU_MODEL_FILE        State file (default: /dev/shm/vpmu-model-<session>)
+//   VPMU_MODEL_TRANSCRIPT  Append a timestamped transcript of every access to the file
+#include <stdint.h> // uintptr_t
+#include <stddef.h> // size_t
+
+#include "vpmu-event.h" // VPMUEventRing
+
+// Returns the register window of the session
+uintptr_t *vpmu_model_open(int session);
+void vpmu_model_close(uintptr_t *regs);
+void vpmu_model_write(uintptr_t *regs, uintptr_t addr, uintptr_t value);
+uintptr_t vpmu_model_read(uintptr_t *regs, uintptr_t addr);
+// The trace ring of the session, produced while VPMU is enabled in this process
+VPMUEventRing *vpmu_model_trace_ring(uintptr_t *regs, size_t *size);
+// The notify ring of the session, VPMU_MMAP_NOTIFY_STATUS tells it has new records
+VPMUEventRing *vpmu_model_notify_ring(uintptr_t *regs);
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef __VPMU_OBJECT_H_
+#define __VPMU_OBJECT_H_
+// Layouts of the objects passed to VPMU and the data streams read from VPMU,
+// shared by the device driver, user space programs and VPMU.
+// All fields are little endian as the guest.
+
+#ifdef __KERNEL__
+#include <linux/types.h> // uint32_t, uint64_t
+#else
+#include <stdint.h> // uint32_t, uint64_t
+#endif
+
+#define VPMU_SYMTAB_MAGIC   0x4d595356 // "VSYM"
+#define VPMU_SYMTAB_VERSION 1
+
+typedef struct VPMUSymbol {
+    uint64_t addr; // Start address
+    uint32_t size; // Bytes to the next symbol (or the end of kernel text)
+    uint32_t name; // Offset of the NUL-terminated name in the string table
+} VPMUSymbol;
+
+/*
+ * VPMU_OBJ_KERNEL_SYMTAB
+ * The header is followed by VPMUSymbol[num_symbols] sorted by addr, and then the
+ * string table of strtab_size bytes.
+ */
+typedef struct VPMUSymbolTable {
+    uint32_t   magic;       // VPMU_SYMTAB_MAGIC
+    uint32_t   version;     // VPMU_SYMTAB_VERSION
+    uint32_t   num_symbols; // Number of symbols
+    uint32_t   strtab_size; // Bytes of the string table
+    VPMUSymbol symbols[];
+} VPMUSymbolTable;
+
+#define VPMU_OFFSET_TABLE_MAGIC   0x5346464f // "OFFS"
+#define VPMU_OFFSET_TABLE_VERSION 1
+
+// Flags of VPMUOffsetTable
+#define VPMU_OFFSET_THREAD_INFO_IN_TASK 0x1 // thread_info is embedded in task_struct
+
+// Fields of kernel structures, (name, id). Append new ones, never renumber them.
+#define VPMU_OFFSET_IDS(X)                                                               \
+    X(FILE_f_path_dentry, 1)                                                             \
+    X(DENTRY_d_iname, 2)                                                                 \
+    X(DENTRY_d_parent, 3)                                                                \
+    X(THREAD_INFO_task, 4)                                                               \
+    X(TASK_STRUCT_pid, 5)                                                                \
+    X(TASK_STRUCT_tgid, 6)                                                               \
+    X(TASK_STRUCT_comm, 7)                                                               \
+    X(TASK_STRUCT_mm, 8)                                                                 \
+    X(TASK_STRUCT_real_parent, 9)                                                        \
+    X(TASK_STRUCT_thread_info, 10)                                                       \
+    X(MM_STRUCT_mmap, 11)                                                                \
+    X(MM_STRUCT_pgd, 12)                                                                 \
+    X(VM_AREA_STRUCT_vm_start, 13)                                                       \
+    X(VM_AREA_STRUCT_vm_end, 14)                                                         \
+    X(VM_AREA_STRUCT_vm_next, 15)                                                        \
+    X(VM_AREA_STRUCT_vm_flags, 16)                                                       \
+    X(VM_AREA_STRUCT_vm_pgoff, 17)                                                       \
+    X(VM_AREA_STRUCT_vm_file, 18)
+
+#define VPMU_OFFSET_ENUM(_name, _id) VPMU_OFFSET_##_name = _id,
+enum { VPMU_OFFSET_IDS(VPMU_OFFSET_ENUM) };
+#undef VPMU_OFFSET_ENUM
+
+typedef struct VPMUOffsetEntry {
+    uint32_t id;     // VPMU_OFFSET_xxx
+    uint32_t size;   // Size of the field in bytes
+    uint64_t offset; // Offset of the field in its structure
+} VPMUOffsetEntry;
+
+/*
+ * VPMU_OBJ_OFFSET_TABLE
+ * Fields which do not exist in the running kernel are not in the table.
+ */
+typedef struct VPMUOffsetTable {
+    uint32_t        magic;         // VPMU_OFFSET_TABLE_MAGIC
+    uint32_t        version;       // VPMU_OFFSET_TABLE_VERSION
+    uint32_t        num_entries;   // Number of entries
+    uint32_t        flags;         // VPMU_OFFSET_xxx flags
+    uint64_t        linux_version; // LINUX_VERSION_CODE
+    uint64_t        thread_size;   // THREAD_SIZE
+    VPMUOffsetEntry entries[];
+} VPMUOffsetTable;
+
+#define VPMU_COUNTERS_MAGIC   0x544e4356 // "VCNT"
+#define VPMU_COUNTERS_VERSION 1
+#define VPMU_MAX_COUNTERS     63
+
+// Flags of VPMUCounter
+#define VPMU_COUNTER_GAUGE 0x1 // The value can go down, otherwise it only increases
+
+typedef struct VPMUCounter {
+    char     name[48]; // NUL-terminated, e.g. "cpu0_instructions"
+    uint32_t flags;    // VPMU_COUNTER_xxx flags
+    uint32_t reserved;
+    uint64_t value;
+} VPMUCounter;
+
+/*
+ * VPMU_STREAM_COUNTERS
+ * A snapshot of all counters, it fits the staging area and is read in one transfer.
+ */
+typedef struct VPMUCounterBlock {
+    uint32_t    magic;        // VPMU_COUNTERS_MAGIC
+    uint32_t    version;      // VPMU_COUNTERS_VERSION
+    uint32_t    num_counters; // Number of counters, at most VPMU_MAX_COUNTERS
+    uint32_t    reserved;
+    uint64_t    timestamp; // Nanoseconds of simulated time of the snapshot
+    uint64_t    sequence;  // Increased by one on each snapshot
+    VPMUCounter counters[];
+} VPMUCounterBlock;
+
+#define VPMU_COUNTER_BLOCK_SIZE                                                          \
+    (sizeof(VPMUCounterBlock) + VPMU_MAX_COUNTERS * sizeof(VPMUCounter))
+
+#define VPMU_SAMPLES_MAGIC       0x504d5356 // "VSMP"
+#define VPMU_SAMPLES_VERSION     1
+#define VPMU_MAX_SAMPLE_COUNTERS 16
+
+/*
+ * VPMU_STREAM_SAMPLES
+ * The header is followed by num_samples rows of num_counters uint64_t, one row for
+ * each detailed interval. Column 0 is always the instructions of the interval.
+ */
+typedef struct VPMUSampleHeader {
+    uint32_t magic;              // VPMU_SAMPLES_MAGIC
+    uint32_t version;            // VPMU_SAMPLES_VERSION
+    uint32_t num_counters;       // Columns of a row, at most VPMU_MAX_SAMPLE_COUNTERS
+    uint32_t num_samples;        // Rows following the header
+    uint64_t total_instructions; // Instructions of the whole run, counted in every phase
+    uint64_t fast_forward;       // The schedule (VPMU_MMAP_SAMPLE_xxx) of the samples
+    uint64_t warmup;
+    uint64_t detailed;
+    char     names[VPMU_MAX_SAMPLE_COUNTERS][32]; // Names of the columns
+} VPMUSampleHeader;
+
+#define VPMU_PROFILE_MAGIC       0x46525056 // "VPRF"
+#define VPMU_PROFILE_VERSION     1
+#define VPMU_MAX_PROFILE_DEPTH   64
+
+/*
+ * VPMU_STREAM_PROFILE
+ * Counters aggregated by function (and call stack) in VPMU, so the size depends on
+ * the code run rather than the length of the run. The header is followed by
+ * VPMUProfileFunction[num_functions], VPMUProfileStack[num_stacks] and the string
+ * table of strtab_size bytes. Records are variable-sized, see the size macros below.
+ * VPMU_MMAP_RESET clears the tables together with the counters, so the stream covers
+ * the run since the last reset.
+ */
+typedef struct VPMUProfileHeader {
+    uint32_t magic;         // VPMU_PROFILE_MAGIC
+    uint32_t version;       // VPMU_PROFILE_VERSION
+    uint32_t num_counters;  // Values of each record, at most VPMU_MAX_SAMPLE_COUNTERS
+    uint32_t num_functions; // Records of functions
+    uint32_t num_stacks;    // Records of call stacks, 0 if VPMU_MMAP_PROFILE_DEPTH is 0
+    uint32_t strtab_size;   // Bytes of the string table
+    uint64_t total_size;    // Bytes of the whole stream, including the header
+    uint64_t dropped;       // Events not attributed because the tables were full
+    char     names[VPMU_MAX_SAMPLE_COUNTERS][32]; // Names of the counters
+} VPMUProfileHeader;
+
+typedef struct VPMUProfileFunction {
+    uint64_t addr;     // Start address of the function
+    uint32_t name;     // Offset of the name in the string table
+    uint32_t binary;   // Offset of the name of the binary in the string table
+    uint64_t values[]; // Exclusive (self) counts of each counter
+} VPMUProfileFunction;
+
+typedef struct VPMUProfileStack {
+    uint32_t depth; // Frames of the stack, at most VPMU_MAX_PROFILE_DEPTH
+    uint32_t reserved;
+    uint64_t values[]; // Counts of each counter, then addr of the frames from the leaf
+} VPMUProfileStack;
+
+#define VPMU_PROFILE_FUNCTION_SIZE(num_counters)                                         \
+    (sizeof(VPMUProfileFunction) + (num_counters) * sizeof(uint64_t))
+#define VPMU_PROFILE_STACK_SIZE(num_counters, depth)                                     \
+    (sizeof(VPMUProfileStack) + ((num_counters) + (depth)) * sizeof(uint64_t))
+
+#define VPMU_MODEL_CONFIG_MAGIC   0x47464356 // "VCFG"
+#define VPMU_MODEL_CONFIG_VERSION 1
+
+// Index of VPMUModelConfig.caches
+#define VPMU_CACHE_L1I            0
+#define VPMU_CACHE_L1D            1
+#define VPMU_CACHE_L2             2
+#define VPMU_CACHE_L3             3
+#define VPMU_MAX_CACHES           4
+
+// Types of VPMUModelConfig.predictor
+#define VPMU_PREDICTOR_DEFAULT    0
+#define VPMU_PREDICTOR_STATIC     1 // Backward taken, forward not taken
+#define VPMU_PREDICTOR_BIMODAL    2
+#define VPMU_PREDICTOR_GSHARE     3
+#define VPMU_PREDICTOR_TOURNAMENT 4
+
+typedef struct VPMUCacheConfig {
+    uint32_t size;      // Bytes
+    uint32_t ways;      // Associativity
+    uint32_t line_size; // Bytes
+    uint32_t latency;   // Cycles of a hit
+} VPMUCacheConfig;
+
+/*
+ * VPMU_STREAM_MODEL_CONFIG
+ * Parameters of the timing models, VPMU applies them on the next VPMU_MMAP_RESET.
+ * A field of 0 keeps the current value. Fields are only appended to the end, size
+ * tells how many of them the writer knows.
+ */
+typedef struct VPMUModelConfig {
+    uint32_t        magic;        // VPMU_MODEL_CONFIG_MAGIC
+    uint32_t        version;      // VPMU_MODEL_CONFIG_VERSION
+    uint32_t        size;         // sizeof(VPMUModelConfig) of the writer
+    uint32_t        cache_levels; // Levels of data caches, i.e. 1 to 3
+    VPMUCacheConfig caches[VPMU_MAX_CACHES];
+    uint32_t        predictor;          // VPMU_PREDICTOR_xxx
+    uint32_t        predictor_entries;  // Entries of the pattern history table
+    uint32_t        predictor_history;  // Bits of the global history
+    uint32_t        btb_entries;        // Entries of the branch target buffer
+    uint32_t        fetch_width;        // Instructions per cycle of each stage
+    uint32_t        issue_width;
+    uint32_t        commit_width;
+    uint32_t        rob_entries;        // Entries of the reorder buffer
+    uint32_t        mispredict_penalty; // Cycles
+    uint32_t        frequency_mhz;      // Clock of the simulated core
+} VPMUModelConfig;
+
+#endif
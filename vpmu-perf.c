@@ -1,15 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>           // INT_MAX
+#include <signal.h>           // sigaction()
+#include <time.h>             // clock_nanosleep(), nanosleep()
+#include <errno.h>            // errno
+#include <sys/wait.h>         // waitpid()
+#include <linux/perf_event.h> // struct perf_event_attr, PERF_RECORD_xxx
 
 #include "vpmu-path-lib.h"
 #include "vpmu-control-lib.h"
 
+typedef struct IntervalConfig {
+    long  interval_ms; ///< Print the counts every interval_ms, 0 for the whole run only
+    bool  csv;         ///< Print comma-separated values instead of a table
+    FILE *out;         ///< Where the intervals go, stderr by default like perf stat
+} IntervalConfig;
+
 void print_help_message(const char *self)
 {
 #define HELP_MESG                                                                        \
     "Usage: %s [options] COMMAND [ARGS]\n"                                               \
+    "       %s [options] record [-e EVENT] [-c PERIOD] [-o FILE] COMMAND [ARGS]\n"       \
     "Options:\n"                                                                         \
     "  --mem         Use /dev/mem instead of /dev/vpmu-device-0 for communication\n"     \
+    "  --session <N> Use the N-th independent VPMU session (/dev/vpmu-device-N)\n"       \
     ""                                                                                   \
     "  --jit         Enable just-in-time model selection on performance simulation\n"    \
     "  --trace       Enable VPMU event tracing and function tracking ability\n"          \
@@ -20,25 +34,69 @@ void print_help_message(const char *self)
     "  --monitor     Enable VPMU event tracing and set the binary without\n"             \
     "                executing them when using -e action\n"                              \
     "  --remove      Remove binary (specified by -e option) from monitoring list\n"      \
+    "  --follow      Trace the process tree and pass every image exec'ed by the\n"       \
+    "                descendants (and their libraries) to VPMU before it runs.\n"        \
+    "                --trace will be forced to set\n"                                    \
+    "  --forkserver <N>\n"                                                               \
+    "                Run the program N times through a fork server. The binary and\n"    \
+    "                libraries are shipped once and each run is forked right before\n"   \
+    "                main(). Counters are reset and reported around each run\n"          \
+    "  -I <MS>       Print the counts of every MS milliseconds while the command\n"      \
+    "                runs: instructions, IPC, cache misses per 1000 instructions\n"      \
+    "                (MPKI) and branch miss rate. Not with --trace or --forkserver\n"    \
+    "  --csv         Print the intervals of -I as CSV with every counter\n"              \
+    "  -o <FILE>     Write the intervals of -I to FILE instead of stderr\n"              \
     "  --help        Show this message\n"                                                \
+    "\n"                                                                                 \
+    "record samples the pc every PERIOD events of VPMU and writes them to FILE\n"        \
+    "(default: perf.data) for perf report and perf script. The comm and mmap records\n"  \
+    "need the event ring of the driver (vpmu_event_ring_pages).\n"                       \
+    "  -e <EVENT>    cycles (default), instructions, L1-icache-load-misses,\n"           \
+    "                L1-dcache-load-misses, branches or branch-misses\n"                 \
+    "  -c <PERIOD>   Events between two samples (default: 100000)\n"                     \
+    "  -o <FILE>     Output file (default: perf.data)\n"                                 \
     "\n\n"                                                                               \
     "Example:\n"                                                                         \
     "    %s --all_models ls -al\n"                                                       \
-    "    %s --all_models --monitor ls -al\n"
+    "    %s --all_models --monitor ls -al\n"                                             \
+    "    %s --all_models -I 1000 --csv -o intervals.csv ./server\n"                      \
+    "    %s --all_models record -e L1-dcache-load-misses -c 10000 ./workload\n"
 
-    printf(HELP_MESG, self, self, self);
+    printf(HELP_MESG, self, self, self, self, self, self);
 }
 
-static int parse_options(VPMUHandler *handler, int argc, char **argv)
+static int
+parse_options(VPMUHandler *handler, IntervalConfig *cfg, int argc, char **argv)
 {
     int i = 0; // Declaring i here for C98
 
     for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "-I")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg->interval_ms = atol(argv[++i]);
+            if (cfg->interval_ms <= 0) {
+                ERR_MSG("Interval of -I must be positive");
+                exit(4);
+            }
+            continue;
+        } else if (arg_is(argv[i], "-o")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            cfg->out = fopen(argv[++i], "w");
+            if (cfg->out == NULL) {
+                ERR_MSG("Open '%s' failed", argv[i]);
+                exit(4);
+            }
+            continue;
+        }
         // Return at first non -- argument
         if (!startwith(argv[i], "--")) return i;
         if (arg_is(argv[i], "--help")) {
             print_help_message(argv[0]);
             exit(0);
+        } else if (arg_is(argv[i], "--session")) {
+            i++; // Parsed in main()
+        } else if (arg_is(argv[i], "--csv")) {
+            cfg->csv = true;
         } else if (arg_is(argv[i], "--jit")) {
             DRY_MSG("enable jit\n");
             handler->flag_jit = true;
@@ -55,6 +113,16 @@ static int parse_options(VPMUHandler *handler, int argc, char **argv)
         } else if (arg_is(argv[i], "--remove")) {
             DRY_MSG("enable monitoring\n");
             handler->flag_remove = true;
+        } else if (arg_is(argv[i], "--follow")) {
+            DRY_MSG("enable following exec\n");
+            handler->flag_follow = true;
+            handler->flag_trace  = true;
+            handler->flag_model |= VPMU_EVENT_TRACE;
+        } else if (arg_is(argv[i], "--forkserver")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            handler->forkserver_runs =
+              parse_long_arg("--forkserver", argv[++i], 1, INT_MAX);
+            DRY_MSG("enable fork server with %d runs\n", handler->forkserver_runs);
         } else if (arg_is(argv[i], "--phase")) {
             DRY_MSG("enable phase\n");
             DRY_MSG("enable trace\n");
@@ -77,7 +145,596 @@ static int parse_options(VPMUHandler *handler, int argc, char **argv)
     return i;
 }
 
-void profile_binary(VPMUHandler handler, int argc, char **argv)
+static void handle_sigchld(int sig)
+{
+    // Only to wake up the sleep of the intervals
+}
+
+// Sum of the counters named suffix or *_suffix, e.g. cpu0_instructions
+static double sum_counters(const VPMUCounterBlock *block,
+                           const uint64_t *        values,
+                           const char *            suffix)
+{
+    double sum = 0;
+    int    i   = 0;
+
+    for (i = 0; i < block->num_counters; i++) {
+        const char *name = block->counters[i].name;
+        size_t      len  = strlen(name);
+        size_t      slen = strlen(suffix);
+
+        if (len < slen || strcmp(name + len - slen, suffix) != 0) continue;
+        if (len > slen && name[len - slen - 1] != '_') continue;
+        sum += values[i];
+    }
+    return sum;
+}
+
+// Print the header of the intervals, the columns of CSV follow the counter block and
+// the columns of gauges are named gauge:NAME
+static void print_interval_header(const IntervalConfig *  cfg,
+                                  const VPMUCounterBlock *block)
+{
+    int i = 0;
+
+    if (cfg->csv) {
+        fprintf(cfg->out, "time_s,sim_ns");
+        for (i = 0; i < block->num_counters; i++)
+            fprintf(cfg->out,
+                    ",%s%s",
+                    (block->counters[i].flags & VPMU_COUNTER_GAUGE) ? "gauge:" : "",
+                    block->counters[i].name);
+        fprintf(cfg->out, ",ipc,icache_mpki,dcache_mpki,branch_miss_rate\n");
+    } else {
+        fprintf(cfg->out,
+                "#%11s %16s %16s %6s %8s %8s %9s\n",
+                "time(s)",
+                "instructions",
+                "cycles",
+                "IPC",
+                "I$ MPKI",
+                "D$ MPKI",
+                "BR miss%");
+    }
+}
+
+// Print the deltas from prev to block, gauges are printed as they are
+static void print_interval(const IntervalConfig * cfg,
+                           double                  time_s,
+                           const VPMUCounterBlock *prev,
+                           const VPMUCounterBlock *block)
+{
+    uint64_t deltas[VPMU_MAX_COUNTERS] = {};
+    double   insns = 0, cycles = 0, branches = 0;
+    double   ipc = 0, impki = 0, dmpki = 0, brmiss = 0;
+    int      i = 0;
+
+    for (i = 0; i < block->num_counters; i++) {
+        const VPMUCounter *c = &block->counters[i];
+
+        if (c->flags & VPMU_COUNTER_GAUGE || i >= prev->num_counters)
+            deltas[i] = c->value;
+        else
+            deltas[i] = c->value - prev->counters[i].value;
+    }
+    insns    = sum_counters(block, deltas, "instructions");
+    cycles   = sum_counters(block, deltas, "cycles");
+    branches = sum_counters(block, deltas, "branches");
+    if (cycles > 0) ipc = insns / cycles;
+    if (insns > 0) impki = sum_counters(block, deltas, "icache_misses") * 1000 / insns;
+    if (insns > 0) dmpki = sum_counters(block, deltas, "dcache_misses") * 1000 / insns;
+    if (branches > 0) brmiss = sum_counters(block, deltas, "branch_misses") / branches;
+
+    if (cfg->csv) {
+        fprintf(cfg->out, "%.3f,%" PRIu64, time_s, block->timestamp - prev->timestamp);
+        for (i = 0; i < block->num_counters; i++)
+            fprintf(cfg->out, ",%" PRIu64, deltas[i]);
+        fprintf(cfg->out, ",%.4f,%.4f,%.4f,%.6f\n", ipc, impki, dmpki, brmiss);
+    } else {
+        fprintf(cfg->out,
+                "%12.3f %16.0f %16.0f %6.2f %8.2f %8.2f %8.2f%%\n",
+                time_s,
+                insns,
+                cycles,
+                ipc,
+                impki,
+                dmpki,
+                brmiss * 100);
+    }
+    fflush(cfg->out);
+}
+
+// Run the binary and print the deltas of the counters every interval until it exits
+static void execute_binary_intervals(VPMUHandler           handler,
+                                     VPMUBinary *          binary,
+                                     const IntervalConfig *cfg)
+{
+    VPMUCounterBlock *prev   = (VPMUCounterBlock *)calloc(1, VPMU_COUNTER_BLOCK_SIZE);
+    VPMUCounterBlock *block  = (VPMUCounterBlock *)calloc(1, VPMU_COUNTER_BLOCK_SIZE);
+    VPMUCounterBlock *tmp    = NULL;
+    struct sigaction  act    = {};
+    struct timespec   start  = {};
+    struct timespec   next   = {};
+    struct timespec   now    = {};
+    pid_t             pid    = 0;
+    int               status = 0;
+    bool              done   = false;
+
+    if (prev == NULL || block == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    // SIGCHLD cuts the sleep short so the last interval ends with the command
+    act.sa_handler = handle_sigchld;
+    sigaction(SIGCHLD, &act, NULL);
+
+    vpmu_start_fullsystem_tracing(handler);
+    if (vpmu_read_counters(handler, prev) < 0) {
+        ERR_MSG("Read counters failed, VPMU or the driver might not support it");
+        exit(4);
+    }
+    print_interval_header(cfg, prev);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+    pid  = vpmu_spawn_binary(binary);
+
+    while (pid > 0 && !done) {
+        next.tv_sec += cfg->interval_ms / 1000;
+        next.tv_nsec += (cfg->interval_ms % 1000) * 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        while (!done
+               && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            done = (waitpid(pid, &status, WNOHANG) == pid);
+        if (!done) done = (waitpid(pid, &status, WNOHANG) == pid);
+
+        if (vpmu_read_counters(handler, block) < 0) break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        print_interval(cfg,
+                       (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9,
+                       prev,
+                       block);
+        tmp   = prev;
+        prev  = block;
+        block = tmp;
+    }
+    if (pid > 0 && !done) waitpid(pid, &status, 0);
+    vpmu_end_fullsystem_tracing(handler);
+
+    act.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &act, NULL);
+    free(prev);
+    free(block);
+}
+
+/*=====================================================================================*/
+// perf.data (PERFILE2) writer, see tools/perf/Documentation/perf.data-file-format.txt
+// of Linux. The file has one event, the samples of VPMU, and the process records
+// needed to symbolize them. No optional feature sections are written.
+#define PERF_FILE_MAGIC 0x32454c4946524550ULL // "PERFILE2"
+#define PERF_SAMPLE_TYPE                                                                 \
+    (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_PERIOD)
+
+typedef struct PerfFileSection {
+    uint64_t offset;
+    uint64_t size;
+} PerfFileSection;
+
+typedef struct PerfFileHeader {
+    uint64_t        magic;
+    uint64_t        size;      // sizeof(PerfFileHeader)
+    uint64_t        attr_size; // sizeof(PerfFileAttr)
+    PerfFileSection attrs;
+    PerfFileSection data;
+    PerfFileSection event_types;
+    uint64_t        features[4]; // Bitmap of HEADER_xxx sections after the data
+} PerfFileHeader;
+
+// The attr is in the size of the first ABI (PERF_ATTR_SIZE_VER0) which every perf reads,
+// the fields added later are not used
+typedef struct PerfFileAttr {
+    uint8_t         attr[PERF_ATTR_SIZE_VER0];
+    PerfFileSection ids;
+} PerfFileAttr;
+
+// Counters of VPMU and the generic perf events standing for them
+typedef struct PerfCounterEvent {
+    const char *name; // As in perf list
+    uint32_t    counter;
+    uint32_t    type;
+    uint64_t    config;
+} PerfCounterEvent;
+
+#define PERF_HW_CACHE_READ_MISS(_cache)                                                  \
+    ((_cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8)                                       \
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const PerfCounterEvent perf_counter_events[] = {
+  {"cycles", VPMU_PERF_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions",
+   VPMU_PERF_INSTRUCTIONS,
+   PERF_TYPE_HARDWARE,
+   PERF_COUNT_HW_INSTRUCTIONS},
+  {"L1-icache-load-misses",
+   VPMU_PERF_ICACHE_MISSES,
+   PERF_TYPE_HW_CACHE,
+   PERF_HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1I)},
+  {"L1-dcache-load-misses",
+   VPMU_PERF_DCACHE_MISSES,
+   PERF_TYPE_HW_CACHE,
+   PERF_HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+  {"branches",
+   VPMU_PERF_BRANCHES,
+   PERF_TYPE_HARDWARE,
+   PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+  {"branch-misses",
+   VPMU_PERF_BRANCH_MISSES,
+   PERF_TYPE_HARDWARE,
+   PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+typedef struct PerfRecordBuf {
+    uint8_t data[sizeof(struct perf_event_header) + 64 + VPMU_EVENT_NAME_MAX + 8];
+    size_t  size;
+} PerfRecordBuf;
+
+// An EXEC or MMAP record waiting for its VPMU_EVENT_NAME records
+typedef struct PendingName {
+    bool            valid;
+    bool            has_length; // The first VPMU_EVENT_NAME is received
+    VPMUEventRecord record;
+    uint64_t        pgoff;
+    uint32_t        length;
+    uint32_t        received;
+    char            name[VPMU_EVENT_NAME_MAX + 1];
+} PendingName;
+
+typedef struct PerfDataWriter {
+    FILE *      fp;
+    uint64_t    data_offset;
+    uint64_t    data_size;
+    uint64_t    num_samples;
+    uint64_t    num_records;
+    PendingName pending;
+} PerfDataWriter;
+
+static inline void buf_put(PerfRecordBuf *b, const void *p, size_t n)
+{
+    memcpy(b->data + b->size, p, n);
+    b->size += n;
+}
+
+static inline void buf_put_u32(PerfRecordBuf *b, uint32_t v)
+{
+    buf_put(b, &v, sizeof(v));
+}
+
+static inline void buf_put_u64(PerfRecordBuf *b, uint64_t v)
+{
+    buf_put(b, &v, sizeof(v));
+}
+
+// NUL-terminated and zero-padded to 8 bytes
+static void buf_put_name(PerfRecordBuf *b, const char *name)
+{
+    size_t len = strlen(name) + 1;
+
+    memset(b->data + b->size, 0, (len + 7) & ~7);
+    memcpy(b->data + b->size, name, len);
+    b->size += (len + 7) & ~7;
+}
+
+static const PerfCounterEvent *find_counter_event(const char *name)
+{
+    const PerfCounterEvent *event = NULL;
+    int                     i     = 0;
+
+    for (i = 0; i < sizeof(perf_counter_events) / sizeof(perf_counter_events[0]); i++) {
+        event = &perf_counter_events[i];
+        if (strcmp(name, event->name) == 0) return event;
+    }
+    return NULL;
+}
+
+static void perf_data_write_header(PerfDataWriter *        w,
+                                   const PerfCounterEvent *event,
+                                   uint64_t                period)
+{
+    PerfFileHeader         header     = {};
+    PerfFileAttr           attr       = {};
+    struct perf_event_attr event_attr = {};
+
+    header.magic        = PERF_FILE_MAGIC;
+    header.size         = sizeof(header);
+    header.attr_size    = sizeof(attr);
+    header.attrs.offset = sizeof(header);
+    header.attrs.size   = sizeof(attr);
+    header.data.offset  = w->data_offset;
+    header.data.size    = w->data_size;
+
+    event_attr.type          = event->type;
+    event_attr.size          = sizeof(attr.attr);
+    event_attr.config        = event->config;
+    event_attr.sample_period = period;
+    event_attr.sample_type   = PERF_SAMPLE_TYPE;
+    event_attr.sample_id_all = 1;
+    event_attr.mmap          = 1;
+    event_attr.comm          = 1;
+    event_attr.task          = 1;
+    memcpy(attr.attr, &event_attr, sizeof(attr.attr));
+
+    rewind(w->fp);
+    if (fwrite(&header, sizeof(header), 1, w->fp) != 1
+        || fwrite(&attr, sizeof(attr), 1, w->fp) != 1) {
+        ERR_MSG("Write perf.data header failed");
+        exit(4);
+    }
+}
+
+// Append a record, the non-sample ones end with the pid, tid and time of sample_id_all
+static void perf_data_write(PerfDataWriter *       w,
+                            uint32_t               type,
+                            uint16_t               misc,
+                            PerfRecordBuf *        body,
+                            const VPMUEventRecord *id)
+{
+    struct perf_event_header header = {};
+
+    if (id) {
+        buf_put_u32(body, id->pid);
+        buf_put_u32(body, id->tid);
+        buf_put_u64(body, id->timestamp);
+    }
+    header.type = type;
+    header.misc = misc;
+    header.size = sizeof(header) + body->size;
+    if (fwrite(&header, sizeof(header), 1, w->fp) != 1
+        || fwrite(body->data, 1, body->size, w->fp) != body->size) {
+        ERR_MSG("Write perf.data failed");
+        exit(4);
+    }
+    w->data_size += header.size;
+    w->num_records++;
+}
+
+// Emit the pending EXEC or MMAP with the name received so far
+static void perf_data_flush_name(PerfDataWriter *w)
+{
+    PendingName * p    = &w->pending;
+    PerfRecordBuf body = {};
+    uint16_t      misc = 0;
+
+    if (!p->valid) return;
+    p->valid = false;
+    // Anonymous and data mappings come without names, they are not needed by perf
+    if (!p->has_length) return;
+    p->name[(p->received < p->length) ? p->received : p->length] = '\0';
+    if (p->record.event == VPMU_EVENT_EXEC) {
+        buf_put_u32(&body, p->record.pid);
+        buf_put_u32(&body, p->record.tid);
+        buf_put_name(&body, p->name);
+        misc = PERF_RECORD_MISC_COMM_EXEC;
+        perf_data_write(w, PERF_RECORD_COMM, misc, &body, &p->record);
+    } else {
+        buf_put_u32(&body, p->record.pid);
+        buf_put_u32(&body, p->record.tid);
+        buf_put_u64(&body, p->record.addr);
+        buf_put_u64(&body, p->record.len);
+        buf_put_u64(&body, p->pgoff);
+        buf_put_name(&body, p->name);
+        perf_data_write(w, PERF_RECORD_MMAP, PERF_RECORD_MISC_USER, &body, &p->record);
+    }
+}
+
+static void perf_data_append_name(PerfDataWriter *w, const VPMUEventRecord *r)
+{
+    PendingName *p      = &w->pending;
+    uint32_t     offset = 0;
+
+    if (!p->valid || p->record.tid != r->tid) return;
+    if (r->flags == 0) {
+        p->has_length = true;
+        p->pgoff      = r->addr;
+        p->length     = (r->len < VPMU_EVENT_NAME_MAX) ? r->len : VPMU_EVENT_NAME_MAX;
+    } else {
+        offset = (r->flags - 1) * 16;
+        if (offset + 16 > VPMU_EVENT_NAME_MAX) return;
+        memcpy(p->name + offset, &r->addr, 8);
+        memcpy(p->name + offset + 8, &r->len, 8);
+        p->received += 16;
+    }
+    if (p->has_length && p->received >= p->length) perf_data_flush_name(w);
+}
+
+// Convert a record of the trace ring to the perf records
+static void perf_data_append(PerfDataWriter *w, const VPMUEventRecord *r)
+{
+    PerfRecordBuf body = {};
+    uint16_t      misc = 0;
+
+    if (r->event == VPMU_EVENT_NAME) {
+        perf_data_append_name(w, r);
+        return;
+    }
+    if (r->event == VPMU_EVENT_SAMPLE) {
+        // The names are contiguous in the event ring, samples might still cut in
+        misc = (r->flags & VPMU_EVENT_SAMPLE_KERNEL) ? PERF_RECORD_MISC_KERNEL
+                                                     : PERF_RECORD_MISC_USER;
+        buf_put_u64(&body, r->addr);
+        buf_put_u32(&body, r->pid);
+        buf_put_u32(&body, r->tid);
+        buf_put_u64(&body, r->timestamp);
+        buf_put_u64(&body, r->len);
+        perf_data_write(w, PERF_RECORD_SAMPLE, misc, &body, NULL);
+        w->num_samples++;
+        return;
+    }
+    perf_data_flush_name(w);
+    switch (r->event) {
+    case VPMU_EVENT_EXEC:
+    case VPMU_EVENT_MMAP:
+        memset(&w->pending, 0, sizeof(w->pending));
+        w->pending.valid  = true;
+        w->pending.record = *r;
+        break;
+    case VPMU_EVENT_FORK:
+        // pid, ppid, tid, ptid and time
+        buf_put_u32(&body, (r->flags & VPMU_EVENT_FORK_THREAD) ? r->pid : r->addr);
+        buf_put_u32(&body, r->pid);
+        buf_put_u32(&body, r->addr);
+        buf_put_u32(&body, r->tid);
+        buf_put_u64(&body, r->timestamp);
+        perf_data_write(w, PERF_RECORD_FORK, 0, &body, r);
+        break;
+    case VPMU_EVENT_EXIT:
+        buf_put_u32(&body, r->pid);
+        buf_put_u32(&body, r->pid);
+        buf_put_u32(&body, r->tid);
+        buf_put_u32(&body, r->tid);
+        buf_put_u64(&body, r->timestamp);
+        perf_data_write(w, PERF_RECORD_EXIT, 0, &body, r);
+        break;
+    default:
+        break; // Context switches and notifications are not recorded
+    }
+}
+
+static void perf_data_open(PerfDataWriter *        w,
+                           const char *            path,
+                           const PerfCounterEvent *event,
+                           uint64_t                period)
+{
+    memset(w, 0, sizeof(PerfDataWriter));
+    w->fp = fopen(path, "wb");
+    if (w->fp == NULL) {
+        ERR_MSG("Open '%s' failed", path);
+        exit(4);
+    }
+    w->data_offset = sizeof(PerfFileHeader) + sizeof(PerfFileAttr);
+    // Write the header with an empty data section, it's rewritten when closing
+    perf_data_write_header(w, event, period);
+}
+
+static void perf_data_close(PerfDataWriter *        w,
+                            const PerfCounterEvent *event,
+                            uint64_t                period)
+{
+    perf_data_flush_name(w);
+    perf_data_write_header(w, event, period);
+    fclose(w->fp);
+}
+
+typedef struct RecordConfig {
+    const char *            path;   ///< Output perf.data, NULL if not recording
+    const PerfCounterEvent *event;  ///< The counter of VPMU to sample
+    uint64_t                period; ///< Events of the counter between two samples
+} RecordConfig;
+
+// Parse the options of "record" from argv[i], return the index of the command
+static int parse_record_options(RecordConfig *rec, int i, int argc, char **argv)
+{
+    rec->path   = "perf.data";
+    rec->event  = &perf_counter_events[0];
+    rec->period = 100000;
+    for (; i < argc; i++) {
+        if (arg_is(argv[i], "-e")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            rec->event = find_counter_event(argv[++i]);
+            if (rec->event == NULL) {
+                ERR_MSG("Unknown event '%s', see --help for the events", argv[i]);
+                exit(4);
+            }
+        } else if (arg_is(argv[i], "-c")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            rec->period = strtoull(argv[++i], NULL, 0);
+            if (rec->period == 0) {
+                ERR_MSG("Sampling period of -c must be positive");
+                exit(4);
+            }
+        } else if (arg_is(argv[i], "-o")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            rec->path = argv[++i];
+        } else {
+            return i;
+        }
+    }
+    return i;
+}
+
+// Move the records of the trace ring to the file, return the number of records
+static uint32_t drain_trace_ring(VPMUEventRing *ring, PerfDataWriter *w)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+    uint32_t n    = head - tail;
+
+    for (; tail != head; tail++) {
+        perf_data_append(w, &ring->records[tail & (ring->num_records - 1)]);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Run the binary with the pc sampling of VPMU and write the samples to a perf.data
+static void
+record_binary(VPMUHandler handler, VPMUBinary *binary, const RecordConfig *rec)
+{
+    PerfDataWriter  writer    = {};
+    VPMUEventRing * ring      = NULL;
+    size_t          ring_size = 0;
+    uint32_t        dropped   = 0;
+    struct timespec backoff   = {0, 0};
+    pid_t           pid       = 0;
+    int             status    = 0;
+    bool            done      = false;
+
+    ring = vpmu_map_trace_ring(handler, &ring_size);
+    // Discard the records left in the ring by earlier runs, they are not of this one
+    __atomic_store_n(
+      &ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    dropped = ring->dropped;
+    perf_data_open(&writer, rec->path, rec->event, rec->period);
+
+    vpmu_set_pc_sampling(handler, rec->event->counter, rec->period);
+    vpmu_start_fullsystem_tracing(handler);
+    pid  = vpmu_spawn_binary(binary);
+    done = (pid <= 0);
+    while (!done) {
+        done = (waitpid(pid, &status, WNOHANG) == pid);
+        if (drain_trace_ring(ring, &writer) > 0 || done) {
+            backoff.tv_nsec = 0;
+            continue;
+        }
+        // Back off exponentially from 50us up to 5ms while the ring is empty
+        backoff.tv_nsec = (backoff.tv_nsec == 0) ? 50000 : backoff.tv_nsec * 2;
+        if (backoff.tv_nsec > 5000000) backoff.tv_nsec = 5000000;
+        nanosleep(&backoff, NULL);
+    }
+    vpmu_end_fullsystem_tracing(handler);
+    vpmu_set_pc_sampling(handler, rec->event->counter, 0);
+    // The samples till the end of tracing
+    drain_trace_ring(ring, &writer);
+
+    perf_data_close(&writer, rec->event, rec->period);
+    LOG_MSG("%" PRIu64 " samples of %s in %" PRIu64 " records written to '%s'",
+            writer.num_samples,
+            rec->event->name,
+            writer.num_records,
+            rec->path);
+    dropped = ring->dropped - dropped;
+    if (dropped) {
+        LOG_MSG("\033[1;33mWarning\033[0;00m: %u records were dropped by VPMU", dropped);
+    }
+    vpmu_unmap_trace_ring(ring, ring_size);
+}
+
+void profile_binary(VPMUHandler           handler,
+                    const IntervalConfig *cfg,
+                    const RecordConfig *  rec,
+                    int                   argc,
+                    char **               argv)
 {
     if (argc == 0 || argv == NULL) return;
 
@@ -100,6 +757,12 @@ void profile_binary(VPMUHandler handler, int argc, char **argv)
         vpmu_stop_monitoring_binary(handler, binary);
     } else if (handler.flag_trace) {
         vpmu_profile_binary(handler, binary);
+    } else if (handler.forkserver_runs > 0) {
+        vpmu_forkserver_binary(handler, binary);
+    } else if (rec->path) {
+        record_binary(handler, binary, rec);
+    } else if (cfg->interval_ms > 0) {
+        execute_binary_intervals(handler, binary, cfg);
     } else {
         vpmu_start_fullsystem_tracing(handler);
         vpmu_execute_binary(binary);
@@ -112,8 +775,14 @@ int main(int argc, char **argv)
 {
     // Initialize handler with zeros
     VPMUHandler handler = {};
+    // Counting by intervals (-I)
+    IntervalConfig cfg = {};
+    // Sampling to perf.data (record)
+    RecordConfig rec = {};
     // Default device
     char dev_path[256] = "/dev/vpmu-device-0";
+    // The session (register window) of VPMU to use
+    int session = 0;
     // Declaring i here for C98
     int i = 0;
 
@@ -122,6 +791,17 @@ int main(int argc, char **argv)
         exit(-1);
     }
 
+    for (i = 0; i < argc; i++) {
+        if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            session = atoi(argv[++i]);
+            if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) {
+                ERR_MSG("Session must be in 0..%d", VPMU_DEVICE_MAX_SESSIONS - 1);
+                exit(4);
+            }
+        }
+    }
+    snprintf(dev_path, sizeof(dev_path), "/dev/vpmu-device-%d", session);
     for (i = 0; i < argc; i++) {
         if (arg_is(argv[i], "--mem")) {
             strcpy(dev_path, "/dev/mem");
@@ -129,17 +809,30 @@ int main(int argc, char **argv)
     }
     // After parsing the real path of vpmu-device and help message,
     // we can do the initialization now.
-    handler = vpmu_open(dev_path);
+    handler = vpmu_open_session(dev_path, session);
 
     // First Parse Settings/Configurations
-    int cmd_idx = parse_options(&handler, argc, argv);
+    cfg.out     = stderr;
+    int cmd_idx = parse_options(&handler, &cfg, argc, argv);
+    if (cfg.interval_ms > 0 && (handler.flag_trace || handler.forkserver_runs > 0)) {
+        ERR_MSG("-I can not be used with tracing or --forkserver");
+        exit(4);
+    }
+    if (cmd_idx < argc && arg_is(argv[cmd_idx], "record")) {
+        cmd_idx = parse_record_options(&rec, cmd_idx + 1, argc, argv);
+        if (cfg.interval_ms > 0 || handler.flag_trace || handler.forkserver_runs > 0) {
+            ERR_MSG("record can not be used with -I, tracing or --forkserver");
+            exit(4);
+        }
+    }
 
     if (cmd_idx == argc) {
         ERR_MSG("No command specified!");
     } else {
         DRY_MSG("Command '%s' at index %d\n", argv[cmd_idx], cmd_idx);
-        profile_binary(handler, argc - cmd_idx, &argv[cmd_idx]);
+        profile_binary(handler, &cfg, &rec, argc - cmd_idx, &argv[cmd_idx]);
     }
+    if (cfg.out != stderr) fclose(cfg.out);
 
     vpmu_close(handler);
     return 0;
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h> // clock_gettime()
+
+#include "vpmu-path-lib.h"
+#include "vpmu-control-lib.h"
+
+typedef struct Profile {
+    const VPMUProfileHeader *   header;
+    const VPMUProfileFunction **functions; ///< Sorted by addr
+    const VPMUProfileStack **   stacks;
+    const char *                strtab;
+    int                         counter; ///< Index of the counter for folded and --top
+} Profile;
+
+// A growable buffer of protocol buffers encoding
+typedef struct PbBuf {
+    unsigned char *data;
+    size_t         size;
+    size_t         capacity;
+} PbBuf;
+
+/* ================================================================ */
+static int compare_function_addr(const void *a, const void *b)
+{
+    const VPMUProfileFunction *fa = *(const VPMUProfileFunction **)a;
+    const VPMUProfileFunction *fb = *(const VPMUProfileFunction **)b;
+
+    return (fa->addr > fb->addr) - (fa->addr < fb->addr);
+}
+
+// Index the records of the stream, return false if it is truncated or corrupted
+static bool parse_profile(char *buf, Profile *prof)
+{
+    VPMUProfileHeader *header = (VPMUProfileHeader *)buf;
+    const char *       p      = buf + sizeof(VPMUProfileHeader);
+    const char *       end    = buf + header->total_size - header->strtab_size;
+    uint32_t           nc     = header->num_counters;
+    int                i      = 0;
+
+    if (header->strtab_size == 0
+        || header->strtab_size > header->total_size - sizeof(VPMUProfileHeader)
+        || buf[header->total_size - 1] != '\0')
+        return false;
+    for (i = 0; i < nc; i++) header->names[i][sizeof(header->names[i]) - 1] = '\0';
+    prof->header    = header;
+    prof->strtab    = end;
+    prof->functions = (const VPMUProfileFunction **)calloc(header->num_functions + 1,
+                                                           sizeof(void *));
+    prof->stacks =
+      (const VPMUProfileStack **)calloc(header->num_stacks + 1, sizeof(void *));
+    if (prof->functions == NULL || prof->stacks == NULL) return false;
+
+    for (i = 0; i < header->num_functions; i++) {
+        const VPMUProfileFunction *f = (const VPMUProfileFunction *)p;
+
+        if (end - p < VPMU_PROFILE_FUNCTION_SIZE(nc)) return false;
+        if (f->name >= header->strtab_size || f->binary >= header->strtab_size)
+            return false;
+        prof->functions[i] = f;
+        p += VPMU_PROFILE_FUNCTION_SIZE(nc);
+    }
+    for (i = 0; i < header->num_stacks; i++) {
+        const VPMUProfileStack *s = (const VPMUProfileStack *)p;
+
+        if (end - p < VPMU_PROFILE_STACK_SIZE(nc, 0)) return false;
+        if (s->depth > VPMU_MAX_PROFILE_DEPTH
+            || end - p < VPMU_PROFILE_STACK_SIZE(nc, s->depth))
+            return false;
+        prof->stacks[i] = s;
+        p += VPMU_PROFILE_STACK_SIZE(nc, s->depth);
+    }
+    qsort(prof->functions,
+          header->num_functions,
+          sizeof(void *),
+          compare_function_addr);
+    return true;
+}
+
+// Return the index of the function at addr in prof->functions, or -1
+static int find_function(const Profile *prof, uint64_t addr)
+{
+    int lo = 0, hi = (int)prof->header->num_functions - 1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (prof->functions[mid]->addr == addr) return mid;
+        if (prof->functions[mid]->addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+static void print_frame(FILE *fp, const Profile *prof, uint64_t addr)
+{
+    int i = find_function(prof, addr);
+
+    if (i >= 0 && prof->strtab[prof->functions[i]->name] != '\0')
+        fprintf(fp, "%s", prof->strtab + prof->functions[i]->name);
+    else
+        fprintf(fp, "0x%" PRIx64, addr);
+}
+
+/* ================================================================ */
+// One line per stack from the root to the leaf, e.g. "main;compute;memcpy 1234"
+static void write_folded(const Profile *prof, const char *path)
+{
+    const VPMUProfileHeader *header = prof->header;
+    FILE *                   fp     = fopen(path, "w");
+    int                      i = 0, f = 0;
+
+    if (fp == NULL) {
+        ERR_MSG("Open '%s' failed", path);
+        exit(4);
+    }
+    // Without call stacks, each function is a stack of itself
+    for (i = 0; header->num_stacks == 0 && i < header->num_functions; i++) {
+        const VPMUProfileFunction *func = prof->functions[i];
+
+        if (func->values[prof->counter] == 0) continue;
+        print_frame(fp, prof, func->addr);
+        fprintf(fp, " %" PRIu64 "\n", func->values[prof->counter]);
+    }
+    for (i = 0; i < header->num_stacks; i++) {
+        const VPMUProfileStack *stack  = prof->stacks[i];
+        const uint64_t *        frames = stack->values + header->num_counters;
+
+        if (stack->values[prof->counter] == 0 || stack->depth == 0) continue;
+        for (f = stack->depth - 1; f >= 0; f--) {
+            print_frame(fp, prof, frames[f]);
+            if (f > 0) fputc(';', fp);
+        }
+        fprintf(fp, " %" PRIu64 "\n", stack->values[prof->counter]);
+    }
+    if (fclose(fp) != 0) {
+        ERR_MSG("Write '%s' failed", path);
+        exit(4);
+    }
+}
+
+/* ================================================================ */
+static void pb_reserve(PbBuf *b, size_t n)
+{
+    if (b->size + n <= b->capacity) return;
+    while (b->size + n > b->capacity) b->capacity = (b->capacity) ? b->capacity * 2 : 256;
+    b->data = (unsigned char *)realloc(b->data, b->capacity);
+    if (b->data == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+}
+
+static void pb_varint(PbBuf *b, uint64_t value)
+{
+    pb_reserve(b, 10);
+    while (value >= 0x80) {
+        b->data[b->size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    b->data[b->size++] = (unsigned char)value;
+}
+
+static void pb_uint(PbBuf *b, int field, uint64_t value)
+{
+    pb_varint(b, (uint64_t)field << 3); // Wire type 0, varint
+    pb_varint(b, value);
+}
+
+static void pb_bytes(PbBuf *b, int field, const void *data, size_t size)
+{
+    pb_varint(b, ((uint64_t)field << 3) | 2); // Wire type 2, length-delimited
+    pb_varint(b, size);
+    pb_reserve(b, size);
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+// Append msg as field of b, and empty msg for the next message
+static void pb_message(PbBuf *b, int field, PbBuf *msg)
+{
+    pb_bytes(b, field, msg->data, msg->size);
+    msg->size = 0;
+}
+
+// Strings of pprof are referred by the index in string_table, add each of them once
+typedef struct PprofStrings {
+    const char **strs;
+    int          num;
+    int *        index_of_offset; ///< Index of each offset of the VPMU string table
+} PprofStrings;
+
+static int64_t pprof_string(PprofStrings *t, const char *str)
+{
+    t->strs = (const char **)realloc(t->strs, (t->num + 1) * sizeof(char *));
+    if (t->strs == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    t->strs[t->num] = str;
+    return t->num++;
+}
+
+static int64_t pprof_strtab(PprofStrings *t, const Profile *prof, uint32_t offset)
+{
+    // Offset 0 is "", which is string_table[0] as well
+    if (offset != 0 && t->index_of_offset[offset] == 0)
+        t->index_of_offset[offset] = pprof_string(t, prof->strtab + offset);
+    return t->index_of_offset[offset];
+}
+
+// See profile.proto of github.com/google/pprof, the file is not compressed
+static void write_pprof(const Profile *prof, const char *path)
+{
+    const VPMUProfileHeader *header  = prof->header;
+    PprofStrings             strings = {};
+    PbBuf                    out = {}, msg = {}, sub = {};
+    int64_t                  types[VPMU_MAX_SAMPLE_COUNTERS] = {};
+    int64_t                  unit                            = 0;
+    struct timespec          ts                              = {};
+    FILE *                   fp                              = NULL;
+    int                      i = 0, c = 0, f = 0;
+
+    strings.index_of_offset = (int *)calloc(header->strtab_size, sizeof(int));
+    if (strings.index_of_offset == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    pprof_string(&strings, ""); // string_table[0] must be ""
+    unit = pprof_string(&strings, "count");
+
+    // Profile.sample_type = 1, ValueType {type = 1, unit = 2}
+    for (c = 0; c < header->num_counters; c++) {
+        types[c] = pprof_string(&strings, header->names[c]);
+        pb_uint(&msg, 1, types[c]);
+        pb_uint(&msg, 2, unit);
+        pb_message(&out, 1, &msg);
+    }
+    // Profile.function = 5, Function {id = 1, name = 2, system_name = 3, filename = 4}
+    // Profile.location = 4, Location {id = 1, address = 3, line = 4 {function_id = 1}}
+    // A function has one location at its start address, both with the id i + 1
+    for (i = 0; i < header->num_functions; i++) {
+        const VPMUProfileFunction *func = prof->functions[i];
+
+        pb_uint(&msg, 1, i + 1);
+        pb_uint(&msg, 2, pprof_strtab(&strings, prof, func->name));
+        pb_uint(&msg, 3, pprof_strtab(&strings, prof, func->name));
+        pb_uint(&msg, 4, pprof_strtab(&strings, prof, func->binary));
+        pb_message(&out, 5, &msg);
+
+        pb_uint(&msg, 1, i + 1);
+        pb_uint(&msg, 3, func->addr);
+        pb_uint(&sub, 1, i + 1);
+        pb_message(&msg, 4, &sub);
+        pb_message(&out, 4, &msg);
+    }
+    // Profile.sample = 2, Sample {location_id = 1 (packed), value = 2 (packed)}
+    for (i = 0; header->num_stacks == 0 && i < header->num_functions; i++) {
+        pb_varint(&sub, i + 1);
+        pb_message(&msg, 1, &sub);
+        for (c = 0; c < header->num_counters; c++)
+            pb_varint(&sub, prof->functions[i]->values[c]);
+        pb_message(&msg, 2, &sub);
+        pb_message(&out, 2, &msg);
+    }
+    for (i = 0; i < header->num_stacks; i++) {
+        const VPMUProfileStack *stack  = prof->stacks[i];
+        const uint64_t *        frames = stack->values + header->num_counters;
+
+        // Frames are from the leaf as pprof expects, unknown ones are dropped
+        for (f = 0; f < stack->depth; f++) {
+            int index = find_function(prof, frames[f]);
+            if (index >= 0) pb_varint(&sub, index + 1);
+        }
+        pb_message(&msg, 1, &sub);
+        for (c = 0; c < header->num_counters; c++) pb_varint(&sub, stack->values[c]);
+        pb_message(&msg, 2, &sub);
+        pb_message(&out, 2, &msg);
+    }
+    // Profile.time_nanos = 9, Profile.default_sample_type = 14
+    clock_gettime(CLOCK_REALTIME, &ts);
+    pb_uint(&out, 9, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+    pb_uint(&out, 14, types[prof->counter]);
+    // Profile.string_table = 6
+    for (i = 0; i < strings.num; i++)
+        pb_bytes(&out, 6, strings.strs[i], strlen(strings.strs[i]));
+
+    fp = fopen(path, "wb");
+    if (fp == NULL || fwrite(out.data, 1, out.size, fp) != out.size || fclose(fp) != 0) {
+        ERR_MSG("Write '%s' failed", path);
+        exit(4);
+    }
+    free(out.data);
+    free(msg.data);
+    free(sub.data);
+    free(strings.strs);
+    free(strings.index_of_offset);
+}
+
+/* ================================================================ */
+static const Profile *sort_profile = NULL;
+
+static int compare_function_value(const void *a, const void *b)
+{
+    uint64_t va = (*(const VPMUProfileFunction **)a)->values[sort_profile->counter];
+    uint64_t vb = (*(const VPMUProfileFunction **)b)->values[sort_profile->counter];
+
+    return (va < vb) - (va > vb);
+}
+
+static void print_top(const Profile *prof, int num)
+{
+    const VPMUProfileHeader *   header = prof->header;
+    const VPMUProfileFunction **sorted = NULL;
+    uint64_t                    total  = 0;
+    int                         i      = 0;
+
+    sorted =
+      (const VPMUProfileFunction **)calloc(header->num_functions + 1, sizeof(void *));
+    if (sorted == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    memcpy(sorted, prof->functions, header->num_functions * sizeof(void *));
+    sort_profile = prof;
+    qsort(sorted, header->num_functions, sizeof(void *), compare_function_value);
+
+    for (i = 0; i < header->num_functions; i++) total += sorted[i]->values[prof->counter];
+    printf("%8s %16s  %-32s %s\n",
+           "%",
+           header->names[prof->counter],
+           "function",
+           "binary");
+    for (i = 0; i < header->num_functions && i < num; i++) {
+        const VPMUProfileFunction *func = sorted[i];
+
+        printf("%7.2f%% %16" PRIu64 "  %-32s %s\n",
+               (total) ? 100.0 * func->values[prof->counter] / total : 0.0,
+               func->values[prof->counter],
+               prof->strtab + func->name,
+               prof->strtab + func->binary);
+    }
+    if (header->dropped)
+        printf("%" PRIu64 " events were not attributed (tables full)\n", header->dropped);
+    free(sorted);
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s [options]\n"                                                              \
+    "Read the counters aggregated per function (and call stack) by VPMU.\n"              \
+    "Profile with \"vpmu-control --func-profile <DEPTH>\" first.\n"                      \
+    "Options:\n"                                                                         \
+    "  --pprof <FILE>     Write FILE in pprof protobuf format (all counters)\n"          \
+    "  --folded <FILE>    Write folded stacks of the counter for flame graphs\n"         \
+    "  --counter <NAME>   Counter of --folded and --top (default: cycles)\n"             \
+    "  --top <N>          Print the N functions with the most counts (default: 20)\n"    \
+    "  --session <N>      Read the session of /dev/vpmu-device-N (default: 0)\n"         \
+    "  --help             Show this message\n"                                           \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s --pprof vpmu.pb && pprof -top -sample_index=dcache_misses vpmu.pb\n"         \
+    "    %s --folded cycles.folded && flamegraph.pl cycles.folded > cycles.svg\n"
+
+    printf(HELP_MESG, self, self, self);
+}
+
+int main(int argc, char **argv)
+{
+    VPMUHandler handler       = {};
+    Profile     prof          = {};
+    char        dev_path[256] = {};
+    const char *pprof_path    = NULL;
+    const char *folded_path   = NULL;
+    const char *counter       = "cycles";
+    char *      buf           = NULL;
+    int         top           = -1;
+    int         session       = 0;
+    // Declaring i here for C98
+    int i = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "--help")) {
+            print_help_message(argv[0]);
+            exit(0);
+        } else if (arg_is(argv[i], "--pprof")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            pprof_path = argv[++i];
+        } else if (arg_is(argv[i], "--folded")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            folded_path = argv[++i];
+        } else if (arg_is(argv[i], "--counter")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            counter = argv[++i];
+        } else if (arg_is(argv[i], "--top")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            top = atoi(argv[++i]);
+        } else if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            session = atoi(argv[++i]);
+        } else {
+            ERR_MSG("Unknown option '%s'", argv[i]);
+            exit(4);
+        }
+    }
+    if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) {
+        ERR_MSG("Session must be in 0..%d", VPMU_DEVICE_MAX_SESSIONS - 1);
+        exit(4);
+    }
+    // Print the top functions if nothing else is asked
+    if (top < 0 && pprof_path == NULL && folded_path == NULL) top = 20;
+    sprintf(dev_path, "/dev/vpmu-device-%d", session);
+
+    handler = vpmu_open(dev_path);
+    buf     = (char *)vpmu_read_profile(handler);
+    vpmu_close(handler);
+    if (buf == NULL) {
+        ERR_MSG("No profile, did it run with vpmu-control --func-profile?");
+        exit(4);
+    }
+    if (!parse_profile(buf, &prof)) {
+        ERR_MSG("The profile read from VPMU is corrupted");
+        exit(4);
+    }
+    for (i = 0; i < prof.header->num_counters; i++) {
+        if (strncmp(prof.header->names[i], counter, sizeof(prof.header->names[i])) == 0)
+            break;
+    }
+    if (i == prof.header->num_counters) {
+        ERR_MSG("No counter named '%s'", counter);
+        exit(4);
+    }
+    prof.counter = i;
+
+    if (pprof_path) write_pprof(&prof, pprof_path);
+    if (folded_path) write_folded(&prof, folded_path);
+    if (top > 0) print_top(&prof, top);
+
+    free(prof.functions);
+    free(prof.stacks);
+    free(buf);
+    return 0;
+}
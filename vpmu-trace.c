@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>   // sigaction()
+#include <time.h>     // clock_gettime(), nanosleep()
+
+#include "vpmu-path-lib.h"
+#include "vpmu-control-lib.h"
+#include "vpmu-event.h"
+
+// Layout of a trace file:
+//   TraceFileHeader
+//   TraceChunkHeader + encoded records      (repeated)
+//   TraceIndexEntry x num_chunks            (written when the trace ends)
+//   TraceFileTrailer
+// Chunks are self-contained, a file without the trailer (e.g. the writer was killed)
+// is still readable by scanning the chunks one by one.
+#define TRACE_FILE_MAGIC    "VPMUTRC1"
+#define TRACE_CHUNK_MAGIC   0x4b4e4843 // "CHNK"
+#define TRACE_FILE_VERSION  1
+#define TRACE_DEFAULT_CHUNK 65536
+#define TRACE_MAX_CHUNK     (1 << 20)
+// The worst case of an encoded record, 7 varints with 10 bytes at most
+#define TRACE_MAX_RECORD_SIZE 70
+
+typedef struct TraceFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size; // sizeof(VPMUEventRecord)
+} TraceFileHeader;
+
+typedef struct TraceChunkHeader {
+    uint32_t magic;
+    uint32_t num_records;
+    uint32_t size; // Bytes of encoded records following this header
+    uint32_t reserved;
+    uint64_t first_timestamp; // The earliest timestamp in this chunk
+    uint64_t last_timestamp;  // The latest timestamp in this chunk
+} TraceChunkHeader;
+
+typedef struct TraceIndexEntry {
+    uint64_t offset; // File offset of TraceChunkHeader
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    uint64_t num_records;
+} TraceIndexEntry;
+
+typedef struct TraceFileTrailer {
+    uint64_t index_offset;
+    uint64_t num_chunks;
+    uint64_t num_records;
+    uint64_t dropped; // Records dropped by VPMU while tracing
+    char     magic[8];
+} TraceFileTrailer;
+
+// Each record is encoded as the difference to the previous one in the same chunk
+typedef struct TraceCodec {
+    VPMUEventRecord prev;
+} TraceCodec;
+
+typedef struct TraceWriter {
+    FILE *           fp;
+    uint8_t *        buffer;
+    size_t           used;
+    uint32_t         chunk_records;
+    TraceChunkHeader chunk;
+    TraceCodec       codec;
+    TraceIndexEntry *index;
+    uint64_t         num_chunks;
+    uint64_t         max_chunks;
+    uint64_t         num_records;
+} TraceWriter;
+
+static volatile sig_atomic_t trace_stop = 0;
+
+static void handle_stop_signal(int sig)
+{
+    trace_stop = 1;
+}
+
+static inline double time_now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) return p;
+        shift += 7;
+    }
+    return NULL; // Truncated or corrupted
+}
+
+// Zigzag encoding keeps small negative differences small
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint8_t *encode_record(TraceCodec *codec, uint8_t *p, const VPMUEventRecord *r)
+{
+    p = put_varint(p, zigzag(r->timestamp - codec->prev.timestamp));
+    p = put_varint(p, zigzag((int32_t)(r->pid - codec->prev.pid)));
+    p = put_varint(p, zigzag((int32_t)(r->tid - codec->prev.tid)));
+    p = put_varint(p, r->event);
+    p = put_varint(p, r->flags);
+    p = put_varint(p, zigzag(r->addr - codec->prev.addr));
+    p = put_varint(p, r->len);
+    codec->prev = *r;
+    return p;
+}
+
+static const uint8_t *
+decode_record(TraceCodec *codec, const uint8_t *p, const uint8_t *end, VPMUEventRecord *r)
+{
+    uint64_t v[7] = {};
+    int      i    = 0;
+
+    for (i = 0; i < 7; i++) {
+        p = get_varint(p, end, &v[i]);
+        if (p == NULL) return NULL;
+    }
+    r->timestamp = codec->prev.timestamp + unzigzag(v[0]);
+    r->pid       = codec->prev.pid + (int32_t)unzigzag(v[1]);
+    r->tid       = codec->prev.tid + (int32_t)unzigzag(v[2]);
+    r->event     = v[3];
+    r->flags     = v[4];
+    r->addr      = codec->prev.addr + unzigzag(v[5]);
+    r->len       = v[6];
+    codec->prev  = *r;
+    return p;
+}
+
+/*=====================================================================================*/
+static void trace_writer_open(TraceWriter *w, const char *path, uint32_t chunk_records)
+{
+    TraceFileHeader header = {};
+
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version     = TRACE_FILE_VERSION;
+    header.record_size = sizeof(VPMUEventRecord);
+    memset(w, 0, sizeof(TraceWriter));
+    w->fp = fopen(path, "wb");
+    if (w->fp == NULL) {
+        ERR_MSG("Open '%s' failed", path);
+        exit(4);
+    }
+    w->chunk_records = chunk_records;
+    // The only buffer growing with the trace is the index, one entry per chunk
+    w->buffer     = (uint8_t *)malloc((size_t)chunk_records * TRACE_MAX_RECORD_SIZE);
+    w->max_chunks = 1024;
+    w->index      = (TraceIndexEntry *)malloc(w->max_chunks * sizeof(TraceIndexEntry));
+    if (w->buffer == NULL || w->index == NULL) {
+        ERR_MSG("Memory error");
+        exit(4);
+    }
+    fwrite(&header, sizeof(header), 1, w->fp);
+}
+
+static void trace_writer_flush(TraceWriter *w)
+{
+    TraceIndexEntry *entry = NULL;
+
+    if (w->chunk.num_records == 0) return;
+    if (w->num_chunks == w->max_chunks) {
+        w->max_chunks *= 2;
+        w->index =
+          (TraceIndexEntry *)realloc(w->index, w->max_chunks * sizeof(TraceIndexEntry));
+        if (w->index == NULL) {
+            ERR_MSG("Memory error");
+            exit(4);
+        }
+    }
+    entry                  = &w->index[w->num_chunks++];
+    entry->offset          = ftello(w->fp);
+    entry->first_timestamp = w->chunk.first_timestamp;
+    entry->last_timestamp  = w->chunk.last_timestamp;
+    entry->num_records     = w->chunk.num_records;
+
+    w->chunk.magic = TRACE_CHUNK_MAGIC;
+    w->chunk.size  = w->used;
+    if (fwrite(&w->chunk, sizeof(w->chunk), 1, w->fp) != 1
+        || fwrite(w->buffer, 1, w->used, w->fp) != w->used) {
+        ERR_MSG("Write trace failed");
+        exit(4);
+    }
+    w->num_records += w->chunk.num_records;
+    memset(&w->chunk, 0, sizeof(w->chunk));
+    memset(&w->codec, 0, sizeof(w->codec));
+    w->used = 0;
+}
+
+static inline void trace_writer_append(TraceWriter *w, const VPMUEventRecord *record)
+{
+    // Records of different cores might be slightly out of order, keep the range
+    if (w->chunk.num_records == 0) {
+        w->chunk.first_timestamp = record->timestamp;
+        w->chunk.last_timestamp  = record->timestamp;
+    } else if (record->timestamp < w->chunk.first_timestamp) {
+        w->chunk.first_timestamp = record->timestamp;
+    } else if (record->timestamp > w->chunk.last_timestamp) {
+        w->chunk.last_timestamp = record->timestamp;
+    }
+    w->used = encode_record(&w->codec, w->buffer + w->used, record) - w->buffer;
+    if (++w->chunk.num_records == w->chunk_records) trace_writer_flush(w);
+}
+
+static void trace_writer_close(TraceWriter *w, uint64_t dropped)
+{
+    TraceFileTrailer trailer = {};
+
+    trace_writer_flush(w);
+    trailer.index_offset = ftello(w->fp);
+    trailer.num_chunks   = w->num_chunks;
+    trailer.num_records  = w->num_records;
+    trailer.dropped      = dropped;
+    memcpy(trailer.magic, TRACE_FILE_MAGIC, sizeof(trailer.magic));
+    fwrite(w->index, sizeof(TraceIndexEntry), w->num_chunks, w->fp);
+    fwrite(&trailer, sizeof(trailer), 1, w->fp);
+    fclose(w->fp);
+    free(w->buffer);
+    free(w->index);
+}
+
+/*=====================================================================================*/
+static void trace_record(VPMUHandler handler,
+                         const char *path,
+                         uint32_t    chunk_records,
+                         double      duration)
+{
+    TraceWriter      writer     = {};
+    VPMUEventRing *  ring       = NULL;
+    size_t           ring_size  = 0;
+    uint32_t         mask       = 0;
+    uint32_t         dropped    = 0;
+    double           start      = time_now_sec();
+    double           last_flush = start;
+    struct timespec  backoff    = {0, 0};
+    struct sigaction act        = {};
+
+    act.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    ring    = vpmu_map_trace_ring(handler, &ring_size);
+    mask    = ring->num_records - 1;
+    dropped = ring->dropped;
+    trace_writer_open(&writer, path, chunk_records);
+    LOG_MSG("Tracing to '%s' (ring of %u records), Ctrl-C to stop",
+            path,
+            ring->num_records);
+
+    while (!trace_stop) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+        double   now  = time_now_sec();
+
+        if (duration > 0 && now - start >= duration) break;
+        if (head == tail) {
+            // Do not keep a partial chunk in memory for too long
+            if (now - last_flush >= 1.0) {
+                trace_writer_flush(&writer);
+                last_flush = now;
+            }
+            // Back off exponentially from 50us up to 5ms while the ring is empty
+            backoff.tv_nsec = (backoff.tv_nsec == 0) ? 50000 : backoff.tv_nsec * 2;
+            if (backoff.tv_nsec > 5000000) backoff.tv_nsec = 5000000;
+            nanosleep(&backoff, NULL);
+            continue;
+        }
+        backoff.tv_nsec = 0;
+        // Encode straight from the ring, then hand the slots back to VPMU at once
+        for (; tail != head; tail++) {
+            trace_writer_append(&writer, &ring->records[tail & mask]);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (writer.chunk.num_records == 0) last_flush = now;
+    }
+
+    dropped = ring->dropped - dropped;
+    trace_writer_close(&writer, dropped);
+    LOG_MSG("%" PRIu64 " records in %" PRIu64 " chunks written to '%s'",
+            writer.num_records,
+            writer.num_chunks,
+            path);
+    if (dropped) {
+        LOG_MSG("\033[1;33mWarning\033[0;00m: %u records were dropped by VPMU", dropped);
+    }
+    vpmu_unmap_trace_ring(ring, ring_size);
+}
+
+/*=====================================================================================*/
+static const char *event_name(uint32_t event)
+{
+    switch (event) {
+    case VPMU_EVENT_SWITCH:
+        return "switch";
+    case VPMU_EVENT_FORK:
+        return "fork";
+    case VPMU_EVENT_EXIT:
+        return "exit";
+    case VPMU_EVENT_EXEC:
+        return "exec";
+    case VPMU_EVENT_MMAP:
+        return "mmap";
+    case VPMU_EVENT_SAMPLE:
+        return "sample";
+    case VPMU_EVENT_NAME:
+        return "name";
+    default:
+        return "unknown";
+    }
+}
+
+// Return false if the chunk is truncated or corrupted
+static bool dump_chunk(FILE *fp, uint64_t from, uint64_t to)
+{
+    TraceChunkHeader chunk  = {};
+    TraceCodec       codec  = {};
+    VPMUEventRecord  record = {};
+    uint8_t *        buffer = NULL;
+    const uint8_t *  p      = NULL;
+    uint32_t         i      = 0;
+
+    if (fread(&chunk, sizeof(chunk), 1, fp) != 1 || chunk.magic != TRACE_CHUNK_MAGIC)
+        return false;
+    buffer = (uint8_t *)malloc(chunk.size);
+    if (buffer == NULL || fread(buffer, 1, chunk.size, fp) != chunk.size) {
+        free(buffer);
+        return false;
+    }
+    p = buffer;
+    for (i = 0; i < chunk.num_records && p != NULL; i++) {
+        p = decode_record(&codec, p, buffer + chunk.size, &record);
+        if (p == NULL || record.timestamp < from || record.timestamp > to) continue;
+        printf("%16" PRIu64 " %6u %6u %-8s %8x %16" PRIx64 " %10" PRIu64 "\n",
+               (uint64_t)record.timestamp,
+               record.pid,
+               record.tid,
+               event_name(record.event),
+               record.flags,
+               (uint64_t)record.addr,
+               (uint64_t)record.len);
+    }
+    free(buffer);
+    return p != NULL;
+}
+
+static void trace_dump(const char *path, uint64_t from, uint64_t to)
+{
+    TraceFileHeader  header  = {};
+    TraceFileTrailer trailer = {};
+    TraceIndexEntry  entry   = {};
+    FILE *           fp      = fopen(path, "rb");
+    uint64_t         i       = 0;
+
+    if (fp == NULL) {
+        ERR_MSG("Open '%s' failed", path);
+        exit(4);
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != TRACE_FILE_VERSION) {
+        ERR_MSG("'%s' is not a VPMU trace", path);
+        exit(4);
+    }
+
+    printf("#%15s %6s %6s %-8s %8s %16s %10s\n",
+           "timestamp",
+           "pid",
+           "tid",
+           "event",
+           "flags",
+           "addr",
+           "len");
+    fseeko(fp, -(off_t)sizeof(trailer), SEEK_END);
+    if (fread(&trailer, sizeof(trailer), 1, fp) == 1
+        && memcmp(trailer.magic, TRACE_FILE_MAGIC, sizeof(trailer.magic)) == 0) {
+        // Use the index to skip the chunks out of the time range
+        for (i = 0; i < trailer.num_chunks; i++) {
+            fseeko(fp, trailer.index_offset + i * sizeof(TraceIndexEntry), SEEK_SET);
+            if (fread(&entry, sizeof(entry), 1, fp) != 1) break;
+            if (entry.last_timestamp < from || entry.first_timestamp > to) continue;
+            fseeko(fp, entry.offset, SEEK_SET);
+            if (!dump_chunk(fp, from, to)) break;
+        }
+        if (trailer.dropped) printf("# %" PRIu64 " records dropped\n", trailer.dropped);
+    } else {
+        // The trace was not closed properly, scan the chunks sequentially
+        LOG_MSG("No index in '%s', scanning chunks", path);
+        fseeko(fp, sizeof(header), SEEK_SET);
+        while (dump_chunk(fp, from, to))
+            ;
+    }
+    fclose(fp);
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s [options]\n"                                                              \
+    "Stream the trace records of VPMU to a chunked, compressed and indexed file.\n"      \
+    "Options:\n"                                                                         \
+    "  -o <FILE>          Output file (default: vpmu.trace)\n"                           \
+    "  --session <N>      Trace the session of /dev/vpmu-device-N (default: 0)\n"        \
+    "  --chunk <N>        Number of records per chunk (default: 65536)\n"                \
+    "  --duration <SEC>   Stop after SEC seconds, otherwise stop on Ctrl-C\n"            \
+    "  --dump <FILE>      Print the records of a trace file as text\n"                   \
+    "  --from <NS>        Print only the records at or after timestamp NS (--dump)\n"    \
+    "  --to <NS>          Print only the records at or before timestamp NS (--dump)\n"   \
+    "  --help             Show this message\n"                                           \
+    "\n"                                                                                 \
+    "Only one vpmu-trace should consume the ring of a session at a time.\n"              \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s -o ls.trace --duration 60\n"                                                 \
+    "    %s --dump ls.trace --from 1000000 --to 2000000\n"
+
+    printf(HELP_MESG, self, self, self);
+}
+
+int main(int argc, char **argv)
+{
+    VPMUHandler handler       = {};
+    char        dev_path[256] = "/dev/vpmu-device-0";
+    const char *out_path      = "vpmu.trace";
+    const char *dump_path     = NULL;
+    uint64_t    chunk_records = TRACE_DEFAULT_CHUNK;
+    uint64_t    from          = 0;
+    uint64_t    to            = UINT64_MAX;
+    double      duration      = 0;
+    int         session       = 0;
+    // Declaring i here for C98
+    int i = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (arg_is(argv[i], "--help")) {
+            print_help_message(argv[0]);
+            exit(0);
+        } else if (arg_is(argv[i], "-o")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            out_path = argv[++i];
+        } else if (arg_is(argv[i], "--session")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            session = atoi(argv[++i]);
+        } else if (arg_is(argv[i], "--chunk")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            chunk_records = strtoull(argv[++i], NULL, 0);
+        } else if (arg_is(argv[i], "--duration")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            duration = atof(argv[++i]);
+        } else if (arg_is(argv[i], "--dump")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            dump_path = argv[++i];
+        } else if (arg_is(argv[i], "--from")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            from = strtoull(argv[++i], NULL, 0);
+        } else if (arg_is(argv[i], "--to")) {
+            check_arg_and_exit(argc, argv, i, 1);
+            to = strtoull(argv[++i], NULL, 0);
+        } else {
+            ERR_MSG("Unknown option '%s'", argv[i]);
+            exit(4);
+        }
+    }
+
+    if (dump_path) {
+        trace_dump(dump_path, from, to);
+        return 0;
+    }
+    if (chunk_records == 0 || chunk_records > TRACE_MAX_CHUNK) {
+        ERR_MSG("Number of records per chunk must be in 1..%d", TRACE_MAX_CHUNK);
+        exit(4);
+    }
+    if (session < 0 || session >= VPMU_DEVICE_MAX_SESSIONS) {
+        ERR_MSG("Session must be in 0..%d", VPMU_DEVICE_MAX_SESSIONS - 1);
+        exit(4);
+    }
+    sprintf(dev_path, "/dev/vpmu-device-%d", session);
+
+    handler = vpmu_open(dev_path);
+    trace_record(handler, out_path, chunk_records, duration);
+    vpmu_close(handler);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#!/bin/sh
+# Run the micro workloads of vpmu-workload under vpmu-perf and check the counts of one
+# unit of work against the expected ranges, or measure the slowdown of each model.
+# The counts of a unit are (counts with N units - counts with 0 units) / N, which
+# cancels the start-up of the process. Exit with 1 if any check fails.
+
+SCRIPT_SRC=$(dirname $0)
+case "$(uname -m)" in
+    arm* | aarch64 ) ARCH=arm ;;
+    * ) ARCH=x86 ;;
+esac
+PERF=${VPMU_PERF:-${SCRIPT_SRC}/vpmu-perf-${ARCH}}
+WORKLOAD=${VPMU_WORKLOAD:-${SCRIPT_SRC}/vpmu-workload-${ARCH}}
+MODELS="--all_models"
+ONLY=""
+SLOWDOWN=0
+TMP=${TMPDIR:-/tmp}/vpmu-validate.$$.csv
+
+# name  N  counter  min  max  kernel  params (after N)
+# The ranges are for 64-byte cache lines, an L1 D$ smaller than 8M and larger than 8K,
+# and the default in-order pipeline: a unit of the loops is a few instructions of one
+# cycle each, a multiply-add takes 3 to 5 cycles and a load missing every cache level
+# 50 to 400 cycles. Tune them for other configurations.
+CASES="
+stride-hit      1000000 dcache_misses  0     0.05   stride 8K 64
+stride-miss     1000000 dcache_misses  0.9   1.1    stride 8M 64
+stride-latency  1000000 cycles         2     20     stride 8K 64
+chase-miss      200000  dcache_misses  0.9   1.1    chase 8M 64
+chase-latency   200000  cycles         50    500    chase 8M 64
+branch-taken    1000000 branch_misses  0     0.02   branch taken
+branch-random   1000000 branch_misses  0.4   0.6    branch random
+depchain-dep    1000000 cycles         3     12     depchain dep
+depchain-indep  1000000 cycles         1     6      depchain indep
+syscall         20000   instructions   100   5000   syscall
+fork            200     instructions   30000 500000 fork
+"
+
+# greater  less
+# The value per unit of the first case must be larger than that of the second one,
+# which holds whatever the configuration is
+RELATIONS="
+depchain-dep    depchain-indep
+chase-miss      stride-hit
+chase-latency   stride-latency
+"
+
+print_help()
+{
+    echo "Usage: $0 [OPTIONS]"
+    echo "    --perf PATH       vpmu-perf to use (default: ${PERF})"
+    echo "    --workload PATH   vpmu-workload to use (default: ${WORKLOAD})"
+    echo "    --models OPTS     Models of vpmu-perf (default: ${MODELS})"
+    echo "    --only NAME       Run the case NAME only"
+    echo "    --slowdown        Measure the wall time of each case under each model"
+    echo "                      instead of checking the counts"
+    echo "Cases:"
+    echo "${CASES}" | awk 'NF { s = $6 " N"; for (i = 7; i <= NF; i++) s = s " " $i
+                                printf "    %-16s %s\n", $1, s }'
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        "--perf" )
+            PERF=$2
+            shift 1
+            ;;
+        "--workload" )
+            WORKLOAD=$2
+            shift 1
+            ;;
+        "--models" )
+            MODELS=$2
+            shift 1
+            ;;
+        "--only" )
+            ONLY=$2
+            shift 1
+            ;;
+        "--slowdown" )
+            SLOWDOWN=1
+            ;;
+        "--help" | "-h" )
+            print_help
+            exit 0
+            ;;
+        * )
+            echo "Unknown option '$1'"
+            exit 4
+            ;;
+    esac
+    shift 1
+done
+
+for f in "${PERF}" "${WORKLOAD}"; do
+    if [ ! -x "$f" ]; then
+        echo "'$f' is not found, build it by make first"
+        exit 4
+    fi
+done
+
+# measure MODELS COUNTER ARGS...
+# Print the sum of COUNTER (or *_COUNTER, e.g. cpu0_cycles) and the wall time
+measure()
+{
+    models=$1
+    counter=$2
+    shift 2
+    # One interval as long as the run, the intervals are cut short when it exits
+    if ! ${PERF} ${models} -I 86400000 --csv -o ${TMP} ${WORKLOAD} "$@" >/dev/null 2>&1
+    then
+        echo "fail 0"
+        return
+    fi
+    awk -F, -v counter="${counter}" '
+        NR == 1 {
+            for (i = 1; i <= NF; i++) {
+                n = length($i) - length(counter)
+                if ($i == counter || (n > 0 && substr($i, n) == "_" counter)) use[i] = 1
+            }
+            next
+        }
+        { for (i in use) sum += $i; time = $1 }
+        END { printf "%.0f %.3f\n", sum, time }' ${TMP}
+}
+
+failed=0
+if [ ${SLOWDOWN} -eq 1 ]; then
+    printf "%-16s %10s %10s %10s %10s %10s %10s\n" "case(s)" "none" \
+        "inst" "cache" "branch" "pipeline" "all"
+fi
+echo "${CASES}" | while read name n counter min max kernel params; do
+    [ -z "${name}" ] && continue
+    [ -n "${ONLY}" ] && [ "${ONLY}" != "${name}" ] && continue
+
+    if [ ${SLOWDOWN} -eq 1 ]; then
+        # Wall time under no model first, then one model at a time and all of them
+        line=$(printf "%-16s" "${name}")
+        base=""
+        for m in "" "--inst" "--cache" "--branch" "--pipeline" "--all_models"; do
+            set -- $(measure "$m" instructions ${kernel} ${n} ${params})
+            [ -z "${base}" ] && base=$2
+            line="${line} $(awk -v t=$2 -v b=${base} 'BEGIN {
+                if (b > 0) printf "%10s", sprintf("%.2fx", t / b)
+                else printf "%10s", sprintf("%.2fs", t) }')"
+        done
+        echo "${line}"
+        continue
+    fi
+
+    set -- $(measure "${MODELS}" ${counter} ${kernel} 0 ${params})
+    zero=$1
+    set -- $(measure "${MODELS}" ${counter} ${kernel} ${n} ${params})
+    full=$1
+    if [ "${zero}" = "fail" ] || [ "${full}" = "fail" ]; then
+        printf "%-16s \033[1;31mFAIL\033[0;00m vpmu-perf failed\n" "${name}"
+        echo 1 >> ${TMP}.failed
+        continue
+    fi
+    value=$(awk -v zero=${zero} -v full=${full} -v n=${n} \
+        'BEGIN { printf "%.6f", (full - zero) / n }')
+    echo "${name} ${value}" >> ${TMP}.values
+    awk -v name=${name} -v value=${value} \
+        -v counter=${counter} -v min=${min} -v max=${max} 'BEGIN {
+        ok = (value >= min && value <= max)
+        printf "%-16s %s %-14s %12.4f per unit, expected %g..%g\n", name,
+            ok ? "\033[1;32mPASS\033[0;00m" : "\033[1;31mFAIL\033[0;00m",
+            counter, value, min, max
+        exit !ok }' || echo 1 >> ${TMP}.failed
+done
+
+# Check the relations between the cases measured above
+[ -f ${TMP}.values ] && echo "${RELATIONS}" | while read greater less; do
+    [ -z "${greater}" ] && continue
+    a=$(awk -v name=${greater} '$1 == name { print $2 }' ${TMP}.values)
+    b=$(awk -v name=${less} '$1 == name { print $2 }' ${TMP}.values)
+    [ -z "${a}" ] || [ -z "${b}" ] && continue
+    awk -v greater=${greater} -v less=${less} -v a=${a} -v b=${b} 'BEGIN {
+        ok = (a > b)
+        printf "%-16s %s %s > %s per unit (%.4f vs %.4f)\n", greater,
+            ok ? "\033[1;32mPASS\033[0;00m" : "\033[1;31mFAIL\033[0;00m",
+            greater, less, a, b
+        exit !ok }' || echo 1 >> ${TMP}.failed
+done
+
+[ -f ${TMP}.failed ] && failed=1
+rm -f ${TMP} ${TMP}.failed ${TMP}.values
+exit ${failed}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>      // uint64_t
+#include <stdbool.h>     // bool
+#include <string.h>      // strcmp(), memset()
+#include <unistd.h>      // fork(), syscall()
+#include <sys/syscall.h> // SYS_getppid
+#include <sys/wait.h>    // waitpid()
+
+// Micro workloads with known event counts for validating the timing models of VPMU.
+// Every kernel runs N units of work after the same setup, so the counts of one unit are
+// (counts with N - counts with 0) / N. vpmu-validate.sh runs them under vpmu-perf.
+
+// Keeps the results alive under optimization
+static volatile uint64_t sink_a, sink_b;
+
+static inline uint64_t lcg_next(uint64_t x)
+{
+    return x * 6364136223846793005ULL + 1442695040888963407ULL;
+}
+
+// Parse a size with an optional K or M suffix
+static size_t parse_size(const char *str)
+{
+    char * end  = NULL;
+    size_t size = strtoull(str, &end, 0);
+
+    if (*end == 'K' || *end == 'k') size <<= 10;
+    if (*end == 'M' || *end == 'm') size <<= 20;
+    return size;
+}
+
+static uint8_t *alloc_buffer(size_t size)
+{
+    uint8_t *buf = (uint8_t *)malloc(size);
+
+    if (buf == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(4);
+    }
+    // Fault the pages in during the setup, not while counting
+    memset(buf, 1, size);
+    return buf;
+}
+
+// Load one byte every stride bytes, wrapping around the buffer. A unit is one load:
+// 1 D$ miss if the buffer does not fit the cache and stride >= line size, ~0 if it fits
+static void kernel_stride(uint64_t n, size_t size, size_t stride)
+{
+    volatile uint8_t *buf    = alloc_buffer(size);
+    uint64_t          sum    = 0;
+    size_t            offset = 0;
+    uint64_t          i      = 0;
+
+    for (i = 0; i < n; i++) {
+        sum += buf[offset];
+        offset += stride;
+        if (offset >= size) offset = 0;
+    }
+    sink_a = sum;
+    free((void *)buf);
+}
+
+// Follow a random cycle through nodes of node_size bytes (Sattolo's algorithm), so
+// neither the cache nor a prefetcher helps. A unit is one dependent load
+static void kernel_chase(uint64_t n, size_t size, size_t node_size)
+{
+    uint8_t * buf   = alloc_buffer(size);
+    size_t    nodes = size / node_size;
+    size_t *  order = (size_t *)malloc(nodes * sizeof(size_t));
+    uint64_t  x     = 1;
+    void **   p     = NULL;
+    size_t    i     = 0;
+    size_t    j     = 0;
+    size_t    tmp   = 0;
+    uint64_t  k     = 0;
+
+    if (node_size < sizeof(void *) || nodes < 2) {
+        fprintf(stderr, "Nodes must hold a pointer and there must be two of them\n");
+        exit(4);
+    }
+    if (order == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(4);
+    }
+    for (i = 0; i < nodes; i++) order[i] = i;
+    for (i = nodes - 1; i > 0; i--) {
+        x        = lcg_next(x);
+        j        = (x >> 33) % i;
+        tmp      = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < nodes; i++)
+        *(void **)(buf + order[i] * node_size) = buf + order[(i + 1) % nodes] * node_size;
+    free(order);
+
+    p = (void **)buf;
+    for (k = 0; k < n; k++) p = (void **)*p;
+    sink_a = (uintptr_t)p;
+    free(buf);
+}
+
+// A conditional branch on a pattern. A unit is one branch (and one loop branch):
+// "taken" is never mispredicted, "random" is mispredicted half of the time
+static void kernel_branch(uint64_t n, const char *pattern)
+{
+    bool     random = (strcmp(pattern, "random") == 0);
+    uint64_t x      = 1;
+    uint64_t i      = 0;
+
+    if (!random && strcmp(pattern, "taken") != 0) {
+        fprintf(stderr, "Unknown branch pattern '%s'\n", pattern);
+        exit(4);
+    }
+    for (i = 0; i < n; i++) {
+        x = lcg_next(x);
+        if (!random || (x >> 63)) {
+            sink_a++;
+        } else {
+            // Keep the compiler from turning the branch into a conditional move
+            __asm__ volatile("" ::: "memory");
+            sink_b ^= x;
+        }
+    }
+}
+
+// Multiply-adds through one register ("dep"), or four independent ones ("indep").
+// A unit is one multiply-add, "dep" waits for the latency of each one
+static void kernel_depchain(uint64_t n, const char *mode)
+{
+    uint64_t a = 1, b = 2, c = 3, d = 4;
+    uint64_t i = 0;
+
+    if (strcmp(mode, "dep") == 0) {
+        for (i = 0; i < n; i++) a = a * 2862933555777941757ULL + 3037000493ULL;
+    } else if (strcmp(mode, "indep") == 0) {
+        for (i = 0; i < n / 4; i++) {
+            a = a * 2862933555777941757ULL + 3037000493ULL;
+            b = b * 2862933555777941757ULL + 3037000493ULL;
+            c = c * 2862933555777941757ULL + 3037000493ULL;
+            d = d * 2862933555777941757ULL + 3037000493ULL;
+        }
+    } else {
+        fprintf(stderr, "Unknown dependency mode '%s'\n", mode);
+        exit(4);
+    }
+    sink_a = a ^ b ^ c ^ d;
+}
+
+// A unit is one round trip to the kernel
+static void kernel_syscall(uint64_t n)
+{
+    uint64_t i = 0;
+
+    for (i = 0; i < n; i++) sink_a += syscall(SYS_getppid);
+}
+
+// A unit is one fork, exit of the child and wait of the parent
+static void kernel_fork(uint64_t n)
+{
+    uint64_t i      = 0;
+    int      status = 0;
+    pid_t    pid    = 0;
+
+    for (i = 0; i < n; i++) {
+        pid = fork();
+        if (pid == 0) _exit(0);
+        if (pid < 0) {
+            fprintf(stderr, "fork() failed\n");
+            exit(4);
+        }
+        waitpid(pid, &status, 0);
+    }
+}
+
+void print_help_message(const char *self)
+{
+#define HELP_MESG                                                                        \
+    "Usage: %s KERNEL N [PARAMS]\n"                                                      \
+    "Run N units of a micro workload with known event counts.\n"                         \
+    "Kernels:\n"                                                                         \
+    "  stride N SIZE STRIDE   Strided loads over SIZE bytes (K and M suffixes)\n"        \
+    "  chase N SIZE NODE      Pointer chasing through a random cycle of NODE bytes\n"    \
+    "                         nodes over SIZE bytes\n"                                   \
+    "  branch N taken|random  A branch always taken or taken at random\n"                \
+    "  depchain N dep|indep   Dependent or independent multiply-adds\n"                  \
+    "  syscall N              getppid() system calls\n"                                  \
+    "  fork N                 fork(), exit and wait\n"                                   \
+    "\n"                                                                                 \
+    "Example:\n"                                                                         \
+    "    %s stride 1000000 8M 64\n"                                                      \
+    "    vpmu-perf-arm --all_models -I 100000 --csv %s branch 1000000 random\n"
+
+    printf(HELP_MESG, self, self, self);
+}
+
+int main(int argc, char **argv)
+{
+    const char *kernel = (argc > 1) ? argv[1] : "--help";
+    uint64_t    n      = (argc > 2) ? strtoull(argv[2], NULL, 0) : 0;
+
+    if (strcmp(kernel, "stride") == 0 && argc == 5) {
+        kernel_stride(n, parse_size(argv[3]), parse_size(argv[4]));
+    } else if (strcmp(kernel, "chase") == 0 && argc == 5) {
+        kernel_chase(n, parse_size(argv[3]), parse_size(argv[4]));
+    } else if (strcmp(kernel, "branch") == 0 && argc == 4) {
+        kernel_branch(n, argv[3]);
+    } else if (strcmp(kernel, "depchain") == 0 && argc == 4) {
+        kernel_depchain(n, argv[3]);
+    } else if (strcmp(kernel, "syscall") == 0 && argc == 3) {
+        kernel_syscall(n);
+    } else if (strcmp(kernel, "fork") == 0 && argc == 3) {
+        kernel_fork(n);
+    } else {
+        print_help_message(argv[0]);
+        exit(strcmp(kernel, "--help") == 0 ? 0 : 4);
+    }
+    return 0;
+}